@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <thread>
+
+#include "common.hpp"
+
+// Rectangle to place, in texels, including the gutters
+struct AtlasRect {
+	int32_t width;
+	int32_t height;
+	int32_t index;
+};
+
+struct AtlasPlacement {
+	int32_t x = 0;
+	int32_t y = 0;
+	bool rotated = false;
+};
+
+// Horizontal segment of the skyline, at height y
+struct SkylineSegment {
+	int32_t x;
+	int32_t y;
+	int32_t width;
+};
+
+// Bottom left skyline packing into a fixed width; returns the height used
+static int32_t skyline_pack(const std::vector <AtlasRect> &rects, int32_t width, bool rotate,
+		std::vector <AtlasPlacement> &placements)
+{
+	std::vector <SkylineSegment> skyline { { 0, 0, width } };
+
+	// Lowest position of a w wide rectangle resting on segment i, if it fits
+	auto fit = [&](size_t i, int32_t w) -> int32_t {
+		int32_t x = skyline[i].x;
+		if (x + w > width)
+			return -1;
+
+		int32_t y = 0;
+		int32_t remaining = w;
+		for (size_t j = i; remaining > 0; j++) {
+			y = std::max(y, skyline[j].y);
+			remaining -= skyline[j].width;
+		}
+
+		return y;
+	};
+
+	int32_t height = 0;
+	for (const AtlasRect &r : rects) {
+		int32_t best_top = INT32_MAX;
+		int32_t best_x = INT32_MAX;
+		size_t best_segment = 0;
+		bool best_rotated = false;
+
+		// Landscape orientation first, so that ties keep rectangles flat
+		for (int32_t orientation = 0; orientation < (rotate ? 2 : 1); orientation++) {
+			bool flip = rotate && (bool(orientation) != (r.height > r.width));
+			int32_t w = flip ? r.height : r.width;
+			int32_t h = flip ? r.width : r.height;
+
+			for (size_t i = 0; i < skyline.size(); i++) {
+				int32_t y = fit(i, w);
+				if (y < 0)
+					break;
+
+				int32_t top = y + h;
+				if (top < best_top || (top == best_top && skyline[i].x < best_x)) {
+					best_top = top;
+					best_x = skyline[i].x;
+					best_segment = i;
+					best_rotated = flip;
+				}
+			}
+		}
+
+		int32_t w = best_rotated ? r.height : r.width;
+		int32_t h = best_rotated ? r.width : r.height;
+		int32_t y = best_top - h;
+
+		placements[r.index] = { best_x, y, best_rotated };
+		height = std::max(height, best_top);
+
+		// Replace the covered part of the skyline with the new top
+		SkylineSegment top { best_x, best_top, w };
+
+		size_t i = best_segment;
+		int32_t end = best_x + w;
+		while (i < skyline.size() && skyline[i].x < end) {
+			int32_t segment_end = skyline[i].x + skyline[i].width;
+			if (segment_end <= end) {
+				skyline.erase(skyline.begin() + i);
+			} else {
+				skyline[i].width = segment_end - end;
+				skyline[i].x = end;
+				break;
+			}
+		}
+
+		skyline.insert(skyline.begin() + best_segment, top);
+
+		// Merge neighbors at the same height
+		for (size_t j = 0; j + 1 < skyline.size(); ) {
+			if (skyline[j].y == skyline[j + 1].y) {
+				skyline[j].width += skyline[j + 1].width;
+				skyline.erase(skyline.begin() + j + 1);
+			} else {
+				j++;
+			}
+		}
+	}
+
+	return height;
+}
+
+// Packs charts given by their uv bounds (C x 4, as umin, vmin, umax, vmax) at
+// a fixed texel density, with gutter texels on every side and optional 90
+// degree rotations. Candidate atlas widths are packed in parallel and the one
+// with the least area is kept. Returns per chart affine transforms from chart
+// uvs to atlas uvs (C x 2 x 3), the texel rectangles (C x 5, as x, y, width,
+// height, rotated), and the atlas width, height and utilization
+std::tuple <torch::Tensor, torch::Tensor, int32_t, int32_t, float>
+pack_atlas(const torch::Tensor &bounds, float density, int32_t gutter, bool rotate, int32_t candidates)
+{
+	assert(bounds.dim() == 2 && bounds.size(1) == 4);
+	assert(bounds.device().is_cpu() && bounds.dtype() == torch::kFloat32);
+
+	torch::Tensor contiguous = bounds.contiguous();
+	const glm::vec4 *B = (const glm::vec4 *) contiguous.data_ptr <float> ();
+
+	size_t count = bounds.size(0);
+
+	std::vector <glm::ivec2> sizes(count);
+	std::vector <AtlasRect> rects(count);
+
+	int64_t area = 0;
+	int64_t chart_area = 0;
+	int32_t fixed_width = 1;
+	int32_t rotated_width = 1;
+	for (size_t i = 0; i < count; i++) {
+		glm::vec2 extent = glm::vec2(B[i].z - B[i].x, B[i].w - B[i].y);
+
+		sizes[i].x = std::max(1, int32_t(std::ceil(extent.x * density)));
+		sizes[i].y = std::max(1, int32_t(std::ceil(extent.y * density)));
+
+		rects[i] = { sizes[i].x + 2 * gutter, sizes[i].y + 2 * gutter, int32_t(i) };
+
+		area += int64_t(rects[i].width) * rects[i].height;
+		chart_area += int64_t(sizes[i].x) * sizes[i].y;
+
+		// Narrowest atlas each policy can pack
+		fixed_width = std::max(fixed_width, rects[i].width);
+		rotated_width = std::max(rotated_width, std::min(rects[i].width, rects[i].height));
+	}
+
+	// Tallest first for fixed orientations; with rotations, by the shorter
+	// side since the rectangles are laid flat where possible
+	auto order = [&](bool rotated) {
+		std::vector <AtlasRect> sorted = rects;
+
+		auto key = [&](const AtlasRect &r) {
+			return rotated ? std::make_pair(std::min(r.width, r.height), std::max(r.width, r.height))
+				: std::make_pair(r.height, r.width);
+		};
+
+		std::sort(sorted.begin(), sorted.end(), [&](const AtlasRect &a, const AtlasRect &b) {
+			auto ka = key(a);
+			auto kb = key(b);
+			return ka > kb || (ka == kb && a.index < b.index);
+		});
+
+		return sorted;
+	};
+
+	// Neither policy is consistently better, so with rotations enabled both
+	// are tried over the same widths, around the side of a square of the
+	// same area as the rectangles
+	struct Candidate {
+		int32_t width;
+		bool rotate;
+		int32_t height = 0;
+		std::vector <AtlasPlacement> placements;
+	};
+
+	std::array <std::vector <AtlasRect>, 2> orders;
+	orders[0] = order(false);
+	if (rotate)
+		orders[1] = order(true);
+
+	candidates = std::max(candidates, 1);
+
+	int32_t square = std::ceil(std::sqrt(double(area)));
+
+	std::vector <Candidate> packings;
+	for (int32_t policy = 0; policy < (rotate ? 2 : 1); policy++) {
+		for (int32_t i = 0; i < candidates; i++) {
+			double t = candidates > 1 ? double(i) / (candidates - 1) : 0.5;
+			int32_t width = int32_t(square * (0.75 + 0.75 * t));
+			packings.push_back({ std::max(policy ? rotated_width : fixed_width, width), bool(policy) });
+		}
+	}
+
+	std::vector <std::thread> workers;
+	for (Candidate &c : packings) {
+		workers.emplace_back([&]() {
+			c.placements.resize(count);
+			c.height = skyline_pack(orders[c.rotate], c.width, c.rotate, c.placements);
+		});
+	}
+
+	for (auto &worker : workers)
+		worker.join();
+
+	size_t best = 0;
+	for (size_t i = 1; i < packings.size(); i++) {
+		const Candidate &a = packings[i];
+		const Candidate &b = packings[best];
+		if (int64_t(a.width) * a.height < int64_t(b.width) * b.height)
+			best = i;
+	}
+
+	int32_t width = packings[best].width;
+	int32_t height = std::max(packings[best].height, 1);
+
+	torch::Tensor transforms = torch::zeros({ (long) count, 2, 3 }, torch::TensorOptions().dtype(torch::kFloat32));
+	torch::Tensor texels = torch::zeros({ (long) count, 5 }, torch::TensorOptions().dtype(torch::kInt32));
+
+	float *T = transforms.data_ptr <float> ();
+	int32_t *R = texels.data_ptr <int32_t> ();
+
+	for (size_t i = 0; i < count; i++) {
+		const AtlasPlacement &p = packings[best].placements[i];
+
+		float x = p.x + gutter;
+		float y = p.y + gutter;
+		float sx = density / width;
+		float sy = density / height;
+
+		float *t = T + 6 * i;
+		if (p.rotated) {
+			// u runs down the rectangle, v runs across it
+			t[0] = 0.0f;
+			t[1] = sx;
+			t[2] = (x - B[i].y * density) / width;
+			t[3] = -sy;
+			t[4] = 0.0f;
+			t[5] = (y + B[i].z * density) / height;
+		} else {
+			t[0] = sx;
+			t[1] = 0.0f;
+			t[2] = (x - B[i].x * density) / width;
+			t[3] = 0.0f;
+			t[4] = sy;
+			t[5] = (y - B[i].y * density) / height;
+		}
+
+		int32_t *r = R + 5 * i;
+		r[0] = x;
+		r[1] = y;
+		r[2] = p.rotated ? sizes[i].y : sizes[i].x;
+		r[3] = p.rotated ? sizes[i].x : sizes[i].y;
+		r[4] = p.rotated;
+	}
+
+	float utilization = float(chart_area) / (float(width) * float(height));
+
+	return { transforms, texels, width, height, utilization };
+}
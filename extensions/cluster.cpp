@@ -5,6 +5,7 @@
 #include <unordered_map>
 
 #include "common.hpp"
+#include "util.hpp"
 
 // Chartifying geometry into N clusters
 static std::vector <std::unordered_set <int32_t>> cluster_once(const geometry &g, const geometry::dual_graph &dgraph, const std::vector <int32_t> &seeds, const std::string &metric)
@@ -146,3 +147,100 @@ std::vector <std::vector <int32_t>> cluster_geometry(const geometry &g, const st
 
 	return clusters_linear;
 }
+
+// Clusters as offsets (C + 1) into the concatenated face indices, each
+// cluster in ascending order
+std::tuple <torch::Tensor, torch::Tensor> cluster_geometry_csr(const geometry &g, const std::vector <int32_t> &seeds, int32_t iterations, const std::string &metric)
+{
+	std::vector <std::vector <int32_t>> clusters = cluster_geometry(g, seeds, iterations, metric);
+
+	std::vector <int64_t> offsets(clusters.size() + 1, 0);
+	for (size_t i = 0; i < clusters.size(); i++)
+		offsets[i + 1] = offsets[i] + clusters[i].size();
+
+	std::vector <int32_t> indices(offsets.back());
+	parallel_for(clusters.size(), 16, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			std::copy(clusters[i].begin(), clusters[i].end(), indices.begin() + offsets[i]);
+			std::sort(indices.begin() + offsets[i], indices.begin() + offsets[i + 1]);
+		}
+	});
+
+	return {
+		vector_to_tensor <int64_t, torch::kInt64> (std::move(offsets)),
+		vector_to_tensor <int32_t, torch::kInt32> (std::move(indices))
+	};
+}
+
+// One camera per cluster, looking at its area weighted centroid from radius
+// away along its area weighted normal. Returns the view matrices (C x 4 x 4)
+// and the eyes (C x 3); the views are inverted in closed form since their
+// bases are orthonormal
+std::tuple <torch::Tensor, torch::Tensor> arrange_views(const geometry &g, const std::vector <int32_t> &seeds, int32_t iterations, const std::string &metric, float radius)
+{
+	std::vector <std::vector <int32_t>> clusters = cluster_geometry(g, seeds, iterations, metric);
+
+	size_t count = clusters.size();
+
+	torch::Tensor views = torch::zeros({ (long) count, 4, 4 }, torch::TensorOptions().dtype(torch::kFloat32));
+	torch::Tensor eyes = torch::zeros({ (long) count, 3 }, torch::TensorOptions().dtype(torch::kFloat32));
+
+	float *V = views.data_ptr <float> ();
+	glm::vec3 *E = (glm::vec3 *) eyes.data_ptr <float> ();
+
+	parallel_for(count, 4, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			glm::dvec3 centroid(0.0);
+			glm::dvec3 normal(0.0);
+			double weight = 0.0;
+
+			for (int32_t f : clusters[i]) {
+				const glm::ivec3 &t = g.triangles[f];
+				glm::dvec3 v0 = g.vertices[t.x];
+				glm::dvec3 v1 = g.vertices[t.y];
+				glm::dvec3 v2 = g.vertices[t.z];
+
+				glm::dvec3 n = glm::cross(v1 - v0, v2 - v0);
+				double area = glm::length(n);
+
+				centroid += area * (v0 + v1 + v2) / 3.0;
+				normal += n;
+				weight += area;
+			}
+
+			if (weight > 0.0)
+				centroid /= weight;
+
+			double length = glm::length(normal);
+			normal = length > 0.0 ? normal / length : glm::dvec3(0.0, 0.0, 1.0);
+
+			glm::dvec3 eye = centroid + double(radius) * normal;
+			glm::dvec3 look = -normal;
+
+			glm::dvec3 up(0.0, 1.0, 0.0);
+			if (std::abs(glm::dot(look, up)) > 1.0 - 1e-6)
+				up = glm::dvec3(1.0, 0.0, 0.0);
+			if (std::abs(glm::dot(look, up)) > 1.0 - 1e-6)
+				up = glm::dvec3(0.0, 0.0, 1.0);
+
+			glm::dvec3 right = glm::normalize(glm::cross(look, up));
+			up = glm::normalize(glm::cross(look, right));
+
+			// Rows of the inverse of the [right, up, look, eye] frame
+			glm::dvec3 rows[3] = { right, up, look };
+
+			float *view = V + 16 * i;
+			for (int32_t r = 0; r < 3; r++) {
+				view[4 * r + 0] = rows[r].x;
+				view[4 * r + 1] = rows[r].y;
+				view[4 * r + 2] = rows[r].z;
+				view[4 * r + 3] = -glm::dot(rows[r], eye);
+			}
+
+			view[15] = 1.0f;
+			E[i] = glm::vec3(eye);
+		}
+	});
+
+	return { views, eyes };
+}
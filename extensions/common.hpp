@@ -28,6 +28,13 @@ struct Graph {
 std::vector <std::vector <int32_t>> cluster_geometry
 (const geometry &, const std::vector <int32_t> &, int32_t, const std::string &);
 
+std::tuple <torch::Tensor, torch::Tensor> cluster_geometry_csr
+(const geometry &, const std::vector <int32_t> &, int32_t, const std::string &);
+
+// Cameras facing the clusters of a geometry; returns views and eyes
+std::tuple <torch::Tensor, torch::Tensor> arrange_views
+(const geometry &, const std::vector <int32_t> &, int32_t, const std::string &, float);
+
 // Patch parametrization (multichart geometry images)
 // std::tuple <torch::Tensor, torch::Tensor> parametrize
 torch::Tensor parametrize
@@ -36,10 +43,106 @@ torch::Tensor parametrize
 std::vector <torch::Tensor> parametrize_parallel
 (const std::vector <std::tuple <torch::Tensor, torch::Tensor, std::vector <int32_t>>> &);
 
+std::tuple <torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor>
+parametrize_multicharts_packed(const geometry &, const std::vector <int32_t> &, int32_t, const std::string &);
+
+// Skyline packing of chart uv bounds into a single atlas
+std::tuple <torch::Tensor, torch::Tensor, int32_t, int32_t, float>
+pack_atlas(const torch::Tensor &, float, int32_t, bool, int32_t);
+
 // Triangulation utilities
 // TODO: refactor
 torch::Tensor triangulate_shorted(const torch::Tensor &, size_t, size_t);
 
-// Loading a mesh
+// Patch order along a space filling curve and first touch vertex indices
+std::tuple <torch::Tensor, torch::Tensor> spatial_order
+(const torch::Tensor &, const torch::Tensor &, const std::string &);
+
+// Loading a mesh (native STL, OBJ and binary PLY, Assimp otherwise)
+std::tuple <torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor>
+load_mesh(const std::string &, bool, bool);
+
+// Loading through the content hashed cache: vertices, normals, triangles and
+// the normalization (center and extent); stats are hits, misses and ms saved
 std::tuple <torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor>
-load_mesh(const std::string &);
+load_mesh_cached(const std::string &, bool, bool, const std::string &);
+
+std::tuple <size_t, size_t, double> mesh_cache_stats();
+
+// Progressive mesh from a single sequence of quadric error edge collapses
+struct ProgressiveMesh {
+	struct Collapse {
+		int32_t kept;
+		int32_t removed;
+		glm::vec3 position;
+	};
+
+	std::vector <glm::vec3> vertices;
+	std::vector <glm::ivec3> triangles;
+	std::vector <Collapse> collapses;
+
+	// Live counts after each prefix of the sequence
+	std::vector <int64_t> triangle_counts;
+	std::vector <int64_t> vertex_counts;
+
+	ProgressiveMesh(const torch::Tensor &, const torch::Tensor &);
+
+	size_t steps_for_triangles(int64_t) const;
+	size_t steps_for_bytes(int64_t) const;
+
+	std::tuple <torch::Tensor, torch::Tensor> extract(size_t) const;
+	std::tuple <torch::Tensor, torch::Tensor> extract_triangles(int64_t) const;
+	std::tuple <torch::Tensor, torch::Tensor> extract_bytes(int64_t) const;
+};
+
+// Quad patch layout of a triangle mesh with about the given number of patches
+std::tuple <torch::Tensor, torch::Tensor> quadrangulate(const torch::Tensor &, const torch::Tensor &, int64_t);
+
+// Bilinear texture fetches on the CPU, for (complexes, resx, resy, 3) maps
+torch::Tensor ngf_texture_fetch_forward_cpu
+(const torch::Tensor &, const torch::Tensor &, const torch::Tensor &, int32_t, int32_t, int32_t, int32_t);
+
+torch::Tensor ngf_texture_fetch_backward_cpu
+(const torch::Tensor &, const torch::Tensor &, const torch::Tensor &, int32_t, int32_t, int32_t, int32_t);
+
+// Reduced precision CPU evaluation of the NGF MLP
+struct QuantizedMLP {
+	enum Precision : int32_t {
+		eFloat32 = 0,
+		eFloat16 = 1,
+		eInt8 = 2,
+	} precision;
+
+	enum Kernel {
+		eScalar,
+		eAVX2,
+		eF16C,
+		eVNNI,
+		eAVXVNNI,
+	} kernel;
+
+	// Row major weights, with rows padded to a multiple of 32 elements
+	struct Layer {
+		int32_t rows;
+		int32_t cols;
+		int32_t stride;
+
+		std::vector <float> weights;
+		std::vector <uint16_t> halves;
+		std::vector <int8_t> quantized;
+		std::vector <float> scales;
+		std::vector <int32_t> sums;
+		std::vector <float> bias;
+	};
+
+	std::vector <Layer> layers;
+
+	QuantizedMLP(const std::vector <torch::Tensor> &, const std::vector <torch::Tensor> &, const std::string &);
+
+	void evaluate(const float *, float *, std::vector <float> &, std::vector <float> &, std::vector <uint8_t> &) const;
+
+	torch::Tensor forward(const torch::Tensor &) const;
+	std::string kernel_name() const;
+	size_t bytes() const;
+	py::bytes stream() const;
+};
@@ -7,6 +7,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/hash.hpp>
 
+#include "util.hpp"
+
 struct ordered_pair {
 	int32_t a, b;
 
@@ -73,22 +75,15 @@ struct geometry {
 		assert(torch_vertices.dtype() == torch::kFloat32);
 		assert(torch_triangles.dtype() == torch::kInt32);
 
-		vertices.resize(torch_vertices.size(0));
-		triangles.resize(torch_triangles.size(0));
-
-		float *vertices_ptr = torch_vertices.data_ptr <float> ();
-		int32_t *triangles_ptr = torch_triangles.data_ptr <int32_t> ();
-
-		memcpy(vertices.data(), vertices_ptr, sizeof(glm::vec3) * vertices.size());
-		memcpy(triangles.data(), triangles_ptr, sizeof(glm::ivec3) * triangles.size());
+		vertices = tensor_to_vector <glm::vec3> (torch_vertices);
+		triangles = tensor_to_vector <glm::ivec3> (torch_triangles);
 
 		// Compute normals vectors
-		normals.resize(torch_vertices.size(0), glm::vec3(0.0f));
-		for (int i = 0; i < torch_triangles.size(0); i++) {
-			glm::uvec3 triangle = *(glm::uvec3 *) (triangles_ptr + i * 3);
-			glm::vec3 v0 = *(glm::vec3 *) (vertices_ptr + triangle[0] * 3);
-			glm::vec3 v1 = *(glm::vec3 *) (vertices_ptr + triangle[1] * 3);
-			glm::vec3 v2 = *(glm::vec3 *) (vertices_ptr + triangle[2] * 3);
+		normals.resize(vertices.size(), glm::vec3(0.0f));
+		for (const glm::ivec3 &triangle : triangles) {
+			glm::vec3 v0 = vertices[triangle[0]];
+			glm::vec3 v1 = vertices[triangle[1]];
+			glm::vec3 v2 = vertices[triangle[2]];
 			glm::vec3 normal = glm::cross(v1 - v0, v2 - v0);
 			normals[triangle[0]] += normal;
 			normals[triangle[1]] += normal;
@@ -118,17 +113,9 @@ struct geometry {
 		assert(torch_normals.dtype() == torch::kFloat32);
 		assert(torch_triangles.dtype() == torch::kInt32);
 
-		vertices.resize(torch_vertices.size(0));
-		normals.resize(torch_normals.size(0));
-		triangles.resize(torch_triangles.size(0));
-
-		float *vertices_ptr = torch_vertices.data_ptr <float> ();
-		float *normals_ptr = torch_normals.data_ptr <float> ();
-		int32_t *triangles_ptr = torch_triangles.data_ptr <int32_t> ();
-
-		memcpy(vertices.data(), vertices_ptr, sizeof(glm::vec3) * vertices.size());
-		memcpy(normals.data(), normals_ptr, sizeof(glm::vec3) * normals.size());
-		memcpy(triangles.data(), triangles_ptr, sizeof(glm::ivec3) * triangles.size());
+		vertices = tensor_to_vector <glm::vec3> (torch_vertices);
+		normals = tensor_to_vector <glm::vec3> (torch_normals);
+		triangles = tensor_to_vector <glm::ivec3> (torch_triangles);
 	}
 
 	geometry deduplicate() const {
@@ -162,20 +149,11 @@ struct geometry {
 	}
 
 	std::tuple <torch::Tensor, torch::Tensor, torch::Tensor> torched() const {
-		// Return torch tensors for vertices, normals, and triangles (on CPU)
-		torch::Tensor torch_vertices = torch::zeros({ (long) vertices.size(), 3 }, torch::kFloat32);
-		torch::Tensor torch_normals = torch::zeros({ (long) normals.size(), 3 }, torch::kFloat32);
-		torch::Tensor torch_triangles = torch::zeros({ (long) triangles.size(), 3 }, torch::kInt32);
-
-		float *vertices_ptr = torch_vertices.data_ptr <float> ();
-		float *normals_ptr = torch_normals.data_ptr <float> ();
-		int32_t *triangles_ptr = torch_triangles.data_ptr <int32_t> ();
-
-		memcpy(vertices_ptr, vertices.data(), sizeof(glm::vec3) * vertices.size());
-		memcpy(normals_ptr, normals.data(), sizeof(glm::vec3) * normals.size());
-		memcpy(triangles_ptr, triangles.data(), sizeof(glm::ivec3) * triangles.size());
-
-		return std::make_tuple(torch_vertices.cuda(), torch_normals.cuda(), torch_triangles.cuda());
+		// Uploaded straight from the vectors, without a staging tensor
+		return std::make_tuple(
+			vector_view <glm::vec3, torch::kFloat32, 3> (vertices).cuda(),
+			vector_view <glm::vec3, torch::kFloat32, 3> (normals).cuda(),
+			vector_view <glm::ivec3, torch::kInt32, 3> (triangles).cuda());
 	}
 
 	// Helper methods
@@ -1,5 +1,24 @@
-#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <glm/glm.hpp>
 
@@ -10,111 +29,1163 @@
 #include "common.hpp"
 #include "util.hpp"
 
+// Parsed geometry, before welding; uvs are either empty or one per position
 struct Mesh {
-	std::vector <glm::vec3> vertices;
-	std::vector <glm::vec3> normals;
+	std::vector <glm::vec3> positions;
 	std::vector <glm::vec2> uvs;
-        std::vector <glm::ivec3> triangles;
+	std::vector <glm::ivec3> triangles;
 };
 
-static Mesh assimp_process_mesh(aiMesh *m, const aiScene *scene, const std::string &dir)
+// Read only mapping of a whole file
+struct MappedFile {
+	const char *data = nullptr;
+	size_t size = 0;
+
+	MappedFile(const std::filesystem::path &path) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void *address = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (address != MAP_FAILED) {
+				madvise(address, st.st_size, MADV_SEQUENTIAL);
+				data = (const char *) address;
+				size = st.st_size;
+			}
+		}
+
+		close(fd);
+	}
+
+	~MappedFile() {
+		if (data)
+			munmap((void *) data, size);
+	}
+};
+
+// Text chunks ending on line boundaries, one per thread
+static std::vector <std::pair <const char *, const char *>> line_chunks(const char *begin, const char *end)
 {
-	std::vector <glm::vec3> vertices;
-	std::vector <glm::vec3> normals;
-	std::vector <glm::vec2> uvs;
-        std::vector <glm::ivec3> triangles;
-
-	// Process all the mesh's vertices
-	for (uint32_t i = 0; i < m->mNumVertices; i++) {
-		vertices.push_back({
-			m->mVertices[i].x,
-			m->mVertices[i].y,
-			m->mVertices[i].z
-		});
-
-		if (m->HasNormals()) {
-			normals.push_back({
-				m->mNormals[i].x,
-				m->mNormals[i].y,
-				m->mNormals[i].z
+	size_t threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::max(size_t(1), std::min(threads, size_t(end - begin) >> 16));
+
+	std::vector <std::pair <const char *, const char *>> chunks;
+
+	const char *start = begin;
+	for (size_t t = 1; t <= threads; t++) {
+		const char *stop = (t == threads) ? end : begin + (end - begin) * t / threads;
+		while (stop < end && *stop != '\n')
+			stop++;
+
+		if (stop > start)
+			chunks.push_back({ start, stop });
+
+		start = stop;
+	}
+
+	return chunks;
+}
+
+static const char *skip_spaces(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		p++;
+
+	return p;
+}
+
+static const char *next_line(const char *p, const char *end)
+{
+	const char *nl = (const char *) memchr(p, '\n', end - p);
+	return nl ? nl + 1 : end;
+}
+
+static bool starts_with(const char *p, const char *end, const char *token)
+{
+	size_t n = strlen(token);
+	return size_t(end - p) >= n && std::memcmp(p, token, n) == 0;
+}
+
+template <typename T>
+static const char *parse(const char *p, const char *end, T &value)
+{
+	p = skip_spaces(p, end);
+	auto result = std::from_chars(p, end, value);
+	return result.ec == std::errc() ? result.ptr : nullptr;
+}
+
+// Whether every corner indexes a position; malformed files are rejected
+// before anything is looked up by these indices
+static bool indices_valid(const Mesh &mesh)
+{
+	std::atomic <bool> valid = true;
+
+	int64_t count = mesh.positions.size();
+	parallel_for(mesh.triangles.size(), 1 << 16, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const glm::ivec3 &t = mesh.triangles[i];
+			for (int32_t k = 0; k < 3; k++) {
+				if (t[k] < 0 || t[k] >= count)
+					valid = false;
+			}
+		}
+	});
+
+	return valid;
+}
+
+// Binary STL, fixed 50 byte records after the header
+static Mesh load_stl_binary(const MappedFile &file, uint32_t count)
+{
+	Mesh mesh;
+	mesh.positions.resize(3 * size_t(count));
+	mesh.triangles.resize(count);
+
+	const char *records = file.data + 84;
+
+	parallel_for(count, 1 << 14, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const char *record = records + 50 * i + 12;
+			std::memcpy(&mesh.positions[3 * i], record, 3 * sizeof(glm::vec3));
+
+			int32_t base = int32_t(3 * i);
+			mesh.triangles[i] = { base, base + 1, base + 2 };
+		}
+	});
+
+	return mesh;
+}
+
+// ASCII STL; chunks count their vertex lines first so that they can be
+// written in place on the second pass
+static std::optional <Mesh> load_stl_ascii(const MappedFile &file)
+{
+	const char *end = file.data + file.size;
+	auto chunks = line_chunks(file.data, end);
+
+	std::vector <size_t> offsets(chunks.size() + 1, 0);
+
+	parallel_for(chunks.size(), 1, [&](size_t, size_t begin, size_t stop) {
+		for (size_t c = begin; c < stop; c++) {
+			auto [p, e] = chunks[c];
+			size_t count = 0;
+			for (; p < e; p = next_line(p, e)) {
+				const char *q = skip_spaces(p, e);
+				count += starts_with(q, e, "vertex");
+			}
+
+			offsets[c + 1] = count;
+		}
+	});
+
+	for (size_t c = 0; c < chunks.size(); c++)
+		offsets[c + 1] += offsets[c];
+
+	Mesh mesh;
+	mesh.positions.resize(offsets.back());
+	mesh.triangles.resize(offsets.back() / 3);
+
+	std::atomic <bool> failed = false;
+
+	parallel_for(chunks.size(), 1, [&](size_t, size_t begin, size_t stop) {
+		for (size_t c = begin; c < stop; c++) {
+			auto [p, e] = chunks[c];
+			size_t index = offsets[c];
+			for (; p < e; p = next_line(p, e)) {
+				const char *q = skip_spaces(p, e);
+				if (!starts_with(q, e, "vertex"))
+					continue;
+
+				glm::vec3 &v = mesh.positions[index++];
+				q += 6;
+				q = parse(q, e, v.x);
+				q = q ? parse(q, e, v.y) : nullptr;
+				q = q ? parse(q, e, v.z) : nullptr;
+				if (!q)
+					failed = true;
+			}
+		}
+	});
+
+	if (failed)
+		return std::nullopt;
+
+	for (size_t i = 0; i < mesh.triangles.size(); i++) {
+		int32_t base = int32_t(3 * i);
+		mesh.triangles[i] = { base, base + 1, base + 2 };
+	}
+
+	return mesh;
+}
+
+// OBJ positions, texture coordinates and polygons (fan triangulated); the
+// uv of a vertex is taken from the last corner referencing it; lines that do
+// not parse and corners out of range reject the file
+static std::optional <Mesh> load_obj(const MappedFile &file)
+{
+	const char *end = file.data + file.size;
+	auto chunks = line_chunks(file.data, end);
+
+	struct Counts {
+		size_t positions = 0;
+		size_t uvs = 0;
+		size_t triangles = 0;
+	};
+
+	std::vector <Counts> counts(chunks.size() + 1);
+
+	auto face_corners = [](const char *p, const char *e) {
+		size_t corners = 0;
+		while (true) {
+			p = skip_spaces(p, e);
+			if (p >= e || *p == '\n' || *p == '#')
+				break;
+
+			corners++;
+			while (p < e && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+				p++;
+		}
+
+		return corners;
+	};
+
+	parallel_for(chunks.size(), 1, [&](size_t, size_t begin, size_t stop) {
+		for (size_t c = begin; c < stop; c++) {
+			auto [p, e] = chunks[c];
+			Counts &local = counts[c + 1];
+			for (; p < e; p = next_line(p, e)) {
+				const char *q = skip_spaces(p, e);
+				if (starts_with(q, e, "v ") || starts_with(q, e, "v\t")) {
+					local.positions++;
+				} else if (starts_with(q, e, "vt ")) {
+					local.uvs++;
+				} else if (starts_with(q, e, "f ")) {
+					size_t corners = face_corners(q + 2, e);
+					local.triangles += corners > 2 ? corners - 2 : 0;
+				}
+			}
+		}
+	});
+
+	for (size_t c = 0; c < chunks.size(); c++) {
+		counts[c + 1].positions += counts[c].positions;
+		counts[c + 1].uvs += counts[c].uvs;
+		counts[c + 1].triangles += counts[c].triangles;
+	}
+
+	const Counts &total = counts.back();
+
+	Mesh mesh;
+	mesh.positions.resize(total.positions);
+	mesh.triangles.resize(total.triangles);
+
+	std::vector <glm::vec2> texcoords(total.uvs);
+	std::vector <glm::ivec3> uv_triangles;
+	if (total.uvs)
+		uv_triangles.resize(total.triangles, glm::ivec3(-1));
+
+	std::atomic <bool> failed = false;
+
+	parallel_for(chunks.size(), 1, [&](size_t, size_t begin, size_t stop) {
+		std::vector <glm::ivec2> corners;
+
+		for (size_t c = begin; c < stop; c++) {
+			auto [p, e] = chunks[c];
+			Counts index = counts[c];
+
+			for (; p < e; p = next_line(p, e)) {
+				const char *q = skip_spaces(p, e);
+				if (starts_with(q, e, "v ") || starts_with(q, e, "v\t")) {
+					glm::vec3 &v = mesh.positions[index.positions++];
+					q = parse(q + 1, e, v.x);
+					q = q ? parse(q, e, v.y) : nullptr;
+					q = q ? parse(q, e, v.z) : nullptr;
+					if (!q)
+						failed = true;
+				} else if (starts_with(q, e, "vt ")) {
+					glm::vec2 &t = texcoords[index.uvs++];
+					q = parse(q + 2, e, t.x);
+					q = q ? parse(q, e, t.y) : nullptr;
+					if (!q)
+						failed = true;
+				} else if (starts_with(q, e, "f ")) {
+					// Corners as (position, uv), with negative indices relative to this line
+					corners.clear();
+					q += 2;
+					while (true) {
+						q = skip_spaces(q, e);
+						if (q >= e || *q == '\n' || *q == '#')
+							break;
+
+						int32_t v = 0;
+						int32_t t = 0;
+						auto result = std::from_chars(q, e, v);
+						if (result.ec != std::errc())
+							failed = true;
+
+						q = result.ptr;
+						if (q < e && *q == '/') {
+							q++;
+							if (q < e && *q != '/') {
+								result = std::from_chars(q, e, t);
+								if (result.ec != std::errc())
+									failed = true;
+
+								q = result.ptr;
+							}
+						}
+
+						while (q < e && *q != ' ' && *q != '\t' && *q != '\r' && *q != '\n')
+							q++;
+
+						v = v < 0 ? int32_t(index.positions) + v : v - 1;
+						t = t < 0 ? int32_t(index.uvs) + t : t - 1;
+						corners.push_back({ v, t });
+					}
+
+					for (size_t k = 2; k < corners.size(); k++) {
+						size_t tri = index.triangles++;
+						mesh.triangles[tri] = { corners[0].x, corners[k - 1].x, corners[k].x };
+						if (total.uvs)
+							uv_triangles[tri] = { corners[0].y, corners[k - 1].y, corners[k].y };
+					}
+				}
+			}
+		}
+	});
+
+	if (failed || !indices_valid(mesh))
+		return std::nullopt;
+
+	if (total.uvs) {
+		mesh.uvs.resize(mesh.positions.size(), glm::vec2(0.0f));
+		for (size_t i = 0; i < mesh.triangles.size(); i++) {
+			for (int32_t k = 0; k < 3; k++) {
+				int32_t t = uv_triangles[i][k];
+				if (t >= 0 && size_t(t) < texcoords.size())
+					mesh.uvs[mesh.triangles[i][k]] = texcoords[t];
+			}
+		}
+	}
+
+	return mesh;
+}
+
+// Binary little endian PLY with float or double positions and a face list;
+// anything else is left to Assimp
+static std::optional <Mesh> load_ply(const MappedFile &file)
+{
+	const char *end = file.data + file.size;
+
+	const char *marker = "end_header\n";
+	const char *body = std::search(file.data, end, marker, marker + strlen(marker));
+	if (body == end)
+		return std::nullopt;
+
+	body += strlen(marker);
+
+	auto type_size = [](const std::string &type) -> size_t {
+		if (type == "char" || type == "uchar" || type == "int8" || type == "uint8")
+			return 1;
+		if (type == "short" || type == "ushort" || type == "int16" || type == "uint16")
+			return 2;
+		if (type == "int" || type == "uint" || type == "int32" || type == "uint32"
+				|| type == "float" || type == "float32")
+			return 4;
+		if (type == "double" || type == "float64")
+			return 8;
+		return 0;
+	};
+
+	struct Property {
+		std::string name;
+		std::string type;
+		std::string count_type;
+		size_t offset = 0;
+		bool list = false;
+	};
+
+	struct Element {
+		std::string name;
+		size_t count = 0;
+		size_t stride = 0;
+		std::vector <Property> properties;
+	};
+
+	std::vector <Element> elements;
+	bool little_endian = false;
+
+	std::istringstream header(std::string(file.data, body));
+	for (std::string line; std::getline(header, line); ) {
+		std::istringstream words(line);
+		std::string keyword;
+		words >> keyword;
+
+		if (keyword == "format") {
+			std::string format;
+			words >> format;
+			little_endian = (format == "binary_little_endian");
+		} else if (keyword == "element") {
+			Element element;
+			words >> element.name >> element.count;
+			elements.push_back(element);
+		} else if (keyword == "property" && !elements.empty()) {
+			Element &element = elements.back();
+
+			Property property;
+			words >> property.type;
+			if (property.type == "list") {
+				property.list = true;
+				words >> property.count_type >> property.type;
+			}
+
+			words >> property.name;
+			property.offset = element.stride;
+
+			if (!type_size(property.type) || (property.list && !type_size(property.count_type)))
+				return std::nullopt;
+
+			if (!property.list)
+				element.stride += type_size(property.type);
+
+			element.properties.push_back(property);
+		}
+	}
+
+	if (!little_endian)
+		return std::nullopt;
+
+	auto read = [](const char *p, const std::string &type) -> double {
+		if (type == "float" || type == "float32") {
+			float f;
+			std::memcpy(&f, p, 4);
+			return f;
+		}
+
+		if (type == "double" || type == "float64") {
+			double d;
+			std::memcpy(&d, p, 8);
+			return d;
+		}
+
+		if (type == "char" || type == "int8")
+			return *(const int8_t *) p;
+		if (type == "uchar" || type == "uint8")
+			return *(const uint8_t *) p;
+
+		if (type == "short" || type == "int16") {
+			int16_t v;
+			std::memcpy(&v, p, 2);
+			return v;
+		}
+
+		if (type == "ushort" || type == "uint16") {
+			uint16_t v;
+			std::memcpy(&v, p, 2);
+			return v;
+		}
+
+		if (type == "int" || type == "int32") {
+			int32_t v;
+			std::memcpy(&v, p, 4);
+			return v;
+		}
+
+		uint32_t v;
+		std::memcpy(&v, p, 4);
+		return v;
+	};
+
+	Mesh mesh;
+
+	const char *p = body;
+	for (const Element &element : elements) {
+		bool has_list = std::any_of(element.properties.begin(), element.properties.end(),
+			[](const Property &property) { return property.list; });
+
+		if (element.name == "vertex") {
+			if (has_list || p + element.count * element.stride > end)
+				return std::nullopt;
+
+			const Property *axes[3] = {};
+			const Property *uv[2] = {};
+			for (const Property &property : element.properties) {
+				const std::string &n = property.name;
+				if (n == "x" || n == "y" || n == "z")
+					axes[n[0] - 'x'] = &property;
+				else if (n == "u" || n == "s" || n == "texture_u")
+					uv[0] = &property;
+				else if (n == "v" || n == "t" || n == "texture_v")
+					uv[1] = &property;
+			}
+
+			if (!axes[0] || !axes[1] || !axes[2])
+				return std::nullopt;
+
+			mesh.positions.resize(element.count);
+			if (uv[0] && uv[1])
+				mesh.uvs.resize(element.count);
+
+			bool packed = axes[0]->type == "float" || axes[0]->type == "float32";
+			packed &= axes[1]->offset == axes[0]->offset + 4 && axes[1]->type == axes[0]->type;
+			packed &= axes[2]->offset == axes[0]->offset + 8 && axes[2]->type == axes[0]->type;
+
+			const char *base = p;
+			parallel_for(element.count, 1 << 14, [&](size_t, size_t begin, size_t stop) {
+				for (size_t i = begin; i < stop; i++) {
+					const char *record = base + i * element.stride;
+					if (packed) {
+						std::memcpy(&mesh.positions[i], record + axes[0]->offset, sizeof(glm::vec3));
+					} else {
+						for (int32_t k = 0; k < 3; k++)
+							mesh.positions[i][k] = read(record + axes[k]->offset, axes[k]->type);
+					}
+
+					if (!mesh.uvs.empty()) {
+						mesh.uvs[i].x = read(record + uv[0]->offset, uv[0]->type);
+						mesh.uvs[i].y = read(record + uv[1]->offset, uv[1]->type);
+					}
+				}
+			});
+
+			p += element.count * element.stride;
+		} else if (element.name == "face") {
+			// Variable sized records, located serially first
+			std::vector <const char *> lists(element.count);
+			std::vector <size_t> firsts(element.count + 1, 0);
+
+			const Property *indices = nullptr;
+			for (const Property &property : element.properties) {
+				if (property.list && (property.name == "vertex_indices" || property.name == "vertex_index"))
+					indices = &property;
+			}
+
+			if (!indices)
+				return std::nullopt;
+
+			size_t item_size = type_size(indices->type);
+
+			// Every field is bounds checked before it is read or skipped
+			for (size_t i = 0; i < element.count; i++) {
+				for (const Property &property : element.properties) {
+					size_t size = type_size(property.list ? property.count_type : property.type);
+					if (size == 0 || size_t(end - p) < size)
+						return std::nullopt;
+
+					if (!property.list) {
+						p += size;
+						continue;
+					}
+
+					size_t n = size_t(read(p, property.count_type));
+					p += size;
+
+					size_t items = type_size(property.type);
+					if (items == 0 || size_t(end - p) / items < n)
+						return std::nullopt;
+
+					if (&property == indices) {
+						lists[i] = p;
+						firsts[i + 1] = n > 2 ? n - 2 : 0;
+					}
+
+					p += n * items;
+				}
+			}
+
+			for (size_t i = 0; i < element.count; i++)
+				firsts[i + 1] += firsts[i];
+
+			mesh.triangles.resize(firsts.back());
+
+			parallel_for(element.count, 1 << 14, [&](size_t, size_t begin, size_t stop) {
+				for (size_t i = begin; i < stop; i++) {
+					const char *list = lists[i];
+					size_t n = firsts[i + 1] - firsts[i] + 2;
+					if (n < 3)
+						continue;
+
+					auto index = [&](size_t k) {
+						return int32_t(read(list + k * item_size, indices->type));
+					};
+
+					int32_t first = index(0);
+					for (size_t k = 2; k < n; k++)
+						mesh.triangles[firsts[i] + k - 2] = { first, index(k - 1), index(k) };
+				}
 			});
+
+		} else if (!has_list) {
+			p += element.count * element.stride;
 		} else {
-			normals.push_back({ 0.0f, 0.0f, 0.0f });
+			break;
 		}
+	}
+
+	if (!indices_valid(mesh))
+		return std::nullopt;
+
+	return mesh;
+}
 
-		if (m->HasTextureCoords(i)) {
-			uvs.push_back({
-				m->mTextureCoords[i]->x,
-				m->mTextureCoords[i]->y,
+// Everything else; every mesh of the scene is merged
+static std::optional <Mesh> load_assimp(const std::filesystem::path &path)
+{
+	Assimp::Importer importer;
+
+	const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate);
+	if (!scene || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) || !scene->mRootNode) {
+		printf("Assimp error: \"%s\"\n", importer.GetErrorString());
+		return std::nullopt;
+	}
+
+	size_t vertices = 0;
+	size_t faces = 0;
+	bool textured = false;
+	for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+		vertices += scene->mMeshes[i]->mNumVertices;
+		faces += scene->mMeshes[i]->mNumFaces;
+		textured |= scene->mMeshes[i]->HasTextureCoords(0);
+	}
+
+	Mesh mesh;
+	mesh.positions.reserve(vertices);
+	mesh.triangles.reserve(faces);
+	if (textured)
+		mesh.uvs.reserve(vertices);
+
+	for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+		const aiMesh *m = scene->mMeshes[i];
+		int32_t base = mesh.positions.size();
+
+		for (uint32_t j = 0; j < m->mNumVertices; j++) {
+			mesh.positions.push_back({ m->mVertices[j].x, m->mVertices[j].y, m->mVertices[j].z });
+			if (textured && m->HasTextureCoords(0))
+				mesh.uvs.push_back({ m->mTextureCoords[0][j].x, m->mTextureCoords[0][j].y });
+			else if (textured)
+				mesh.uvs.push_back({ 0.0f, 0.0f });
+		}
+
+		for (uint32_t j = 0; j < m->mNumFaces; j++) {
+			const aiFace &face = m->mFaces[j];
+			if (face.mNumIndices != 3)
+				continue;
+
+			mesh.triangles.push_back({
+				base + int32_t(face.mIndices[0]),
+				base + int32_t(face.mIndices[1]),
+				base + int32_t(face.mIndices[2])
 			});
-		} else {
-			uvs.push_back({ 0.0f , 0.0f });
 		}
 	}
 
-	// Process all the mesh's triangles
-	for (uint32_t i = 0; i < m->mNumFaces; i++) {
-		aiFace face = m->mFaces[i];
-                triangles.push_back({
-			face.mIndices[0],
-			face.mIndices[1],
-			face.mIndices[2]
-		});
+	if (mesh.positions.empty()) {
+		printf("No meshes found in %s\n", path.c_str());
+		return std::nullopt;
 	}
 
-	return Mesh { vertices, normals, uvs, triangles };
+	return mesh;
+}
+
+// First position with the same coordinates as each position; the hashing is
+// split into shards processed in parallel, each in index order
+static std::vector <int32_t> weld(const std::vector <glm::vec3> &positions)
+{
+	struct Key {
+		uint32_t x, y, z;
+
+		bool operator==(const Key &other) const {
+			return x == other.x && y == other.y && z == other.z;
+		}
+	};
+
+	struct Hash {
+		size_t operator()(const Key &k) const {
+			uint64_t h = k.x * 0x9E3779B97F4A7C15ull;
+			h ^= (h >> 29) ^ (k.y * 0xBF58476D1CE4E5B9ull);
+			h ^= (h >> 31) ^ (k.z * 0x94D049BB133111EBull);
+			return h ^ (h >> 32);
+		}
+	};
+
+	auto key = [](const glm::vec3 &v) {
+		// Adding zero folds -0 into +0
+		glm::vec3 u = v + glm::vec3(0.0f);
+
+		Key k;
+		std::memcpy(&k, &u, sizeof(k));
+		return k;
+	};
+
+	constexpr size_t SHARDS = 64;
+
+	size_t count = positions.size();
+
+	std::vector <uint8_t> shard(count);
+	parallel_for(count, 1 << 16, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			shard[i] = Hash()(key(positions[i])) % SHARDS;
+	});
+
+	// Counting sort by shard, stable so each shard keeps the index order
+	std::vector <size_t> offsets(SHARDS + 1, 0);
+	for (size_t i = 0; i < count; i++)
+		offsets[shard[i] + 1]++;
+
+	for (size_t s = 0; s < SHARDS; s++)
+		offsets[s + 1] += offsets[s];
+
+	std::vector <int32_t> sorted(count);
+	std::vector <size_t> cursor(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < count; i++)
+		sorted[cursor[shard[i]]++] = i;
+
+	std::vector <int32_t> first(count);
+	parallel_for(SHARDS, 1, [&](size_t, size_t begin, size_t end) {
+		for (size_t s = begin; s < end; s++) {
+			std::unordered_map <Key, int32_t, Hash> seen;
+			seen.reserve(offsets[s + 1] - offsets[s]);
+
+			for (size_t j = offsets[s]; j < offsets[s + 1]; j++) {
+				int32_t i = sorted[j];
+				first[i] = seen.try_emplace(key(positions[i]), i).first->second;
+			}
+		}
+	});
+
+	return first;
 }
 
-static std::vector <Mesh> assimp_process_node(aiNode *node, const aiScene *scene, const std::string &directory)
+// Welds (optionally) and writes the final vertices, area weighted normals,
+// uvs and triangles into the output tensors
+static std::tuple <torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor>
+finalize(const Mesh &mesh, bool welding)
 {
-	std::vector <Mesh> meshes;
+	size_t count = mesh.positions.size();
 
-	// Process all the node's meshes (if any)
-	for (uint32_t i = 0; i < node->mNumMeshes; i++) {
-		aiMesh *m = scene->mMeshes[node->mMeshes[i]];
-		Mesh pm = assimp_process_mesh(m, scene, directory);
-		meshes.push_back(pm);
+	// Welded index of each position, in order of first occurrence
+	std::vector <int32_t> first(count);
+	std::vector <int32_t> remap(count);
+	size_t unique = count;
+
+	if (welding) {
+		first = weld(mesh.positions);
+
+		unique = 0;
+		for (size_t i = 0; i < count; i++)
+			remap[i] = (size_t(first[i]) == i) ? int32_t(unique++) : remap[first[i]];
+	} else {
+		for (size_t i = 0; i < count; i++)
+			first[i] = remap[i] = i;
 	}
 
-	// Recusively process all the node's children
-	for (uint32_t i = 0; i < node->mNumChildren; i++) {
-		auto pn = assimp_process_node(node->mChildren[i], scene, directory);
-		meshes.insert(meshes.begin(), pn.begin(), pn.end());
+	auto floats = torch::TensorOptions().dtype(torch::kFloat32);
+	auto ints = torch::TensorOptions().dtype(torch::kInt32);
+
+	torch::Tensor vertices = torch::empty({ (long) unique, 3 }, floats);
+	torch::Tensor normals = torch::zeros({ (long) unique, 3 }, floats);
+	torch::Tensor uvs = torch::zeros({ (long) unique, 2 }, floats);
+	torch::Tensor triangles = torch::empty({ (long) mesh.triangles.size(), 3 }, ints);
+
+	glm::vec3 *V = (glm::vec3 *) vertices.data_ptr <float> ();
+	glm::vec3 *N = (glm::vec3 *) normals.data_ptr <float> ();
+	glm::vec2 *UV = (glm::vec2 *) uvs.data_ptr <float> ();
+	glm::ivec3 *T = (glm::ivec3 *) triangles.data_ptr <int32_t> ();
+
+	parallel_for(count, 1 << 16, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			if (size_t(first[i]) != i)
+				continue;
+
+			V[remap[i]] = mesh.positions[i];
+			if (!mesh.uvs.empty())
+				UV[remap[i]] = mesh.uvs[i];
+		}
+	});
+
+	parallel_for(mesh.triangles.size(), 1 << 16, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const glm::ivec3 &t = mesh.triangles[i];
+			T[i] = { remap[t.x], remap[t.y], remap[t.z] };
+		}
+	});
+
+	for (size_t i = 0; i < mesh.triangles.size(); i++) {
+		const glm::ivec3 &t = T[i];
+		glm::vec3 n = glm::cross(V[t.y] - V[t.x], V[t.z] - V[t.x]);
+		N[t.x] += n;
+		N[t.y] += n;
+		N[t.z] += n;
 	}
 
-	return meshes;
+	parallel_for(unique, 1 << 16, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			float length = glm::length(N[i]);
+			N[i] = length > 0.0f ? N[i] / length : glm::vec3(0.0f);
+		}
+	});
+
+	return std::make_tuple(vertices, normals, uvs, triangles);
 }
 
+// Native loaders for STL, OBJ and binary PLY, with Assimp for the rest (or
+// when native is disabled, for comparison); positions are welded on request
 std::tuple <torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor>
-load_mesh(const std::string &s)
+load_mesh(const std::string &s, bool welding, bool native)
 {
-	Assimp::Importer importer;
 	std::filesystem::path path = s;
 
-        // Read scene
-	const aiScene *scene;
-	scene = importer.ReadFile(path, aiProcess_GenNormals | aiProcess_Triangulate);
+	std::string extension = path.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
 
-	// Check if the scene was loaded
-	if ((!scene | (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE)) || !scene->mRootNode) {
-		printf("Assimp error: \"%s\"\n", importer.GetErrorString());
+	std::optional <Mesh> mesh;
+	if (native) {
+		MappedFile file(path);
+		if (!file.data) {
+			printf("Could not open %s\n", path.c_str());
+			return {};
+		}
+
+		if (extension == ".stl") {
+			uint32_t count = 0;
+			if (file.size >= 84)
+				std::memcpy(&count, file.data + 80, sizeof(count));
+
+			// Binary headers can start with "solid" as well, so ASCII is
+			// only kept when it parses and yields triangles
+			const char *data_end = file.data + file.size;
+			if (starts_with(skip_spaces(file.data, data_end), data_end, "solid")) {
+				mesh = load_stl_ascii(file);
+				if (mesh && mesh->triangles.empty())
+					mesh.reset();
+			}
+
+			if (!mesh && file.size >= 84 && (file.size - 84) / 50 >= count)
+				mesh = load_stl_binary(file, count);
+		} else if (extension == ".obj") {
+			mesh = load_obj(file);
+		} else if (extension == ".ply") {
+			mesh = load_ply(file);
+		}
+
+		bool supported = extension == ".stl" || extension == ".obj" || extension == ".ply";
+		if (supported && !mesh)
+			printf("Native loader rejected %s, falling back to Assimp\n", path.c_str());
+	}
+
+	if (!mesh)
+		mesh = load_assimp(path);
+
+	if (!mesh)
 		return {};
+
+	return finalize(*mesh, welding);
+}
+
+// Cached meshes are a fixed header followed by the vertices, normals and
+// triangles, so that a hit is a single mapping shared by the tensors
+struct CachedMeshHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint64_t vertices;
+	uint64_t triangles;
+	float center[3];
+	float extent;
+	float milliseconds;
+	uint32_t padding[3];
+};
+
+static_assert(sizeof(CachedMeshHeader) == 64);
+
+static constexpr char CACHE_MAGIC[8] = "NGFMESH";
+static constexpr uint32_t CACHE_VERSION = 1;
+
+// Entries beyond this many bytes are evicted, least recently used first
+static constexpr uintmax_t CACHE_CAPACITY = uintmax_t(4) << 30;
+
+static struct {
+	std::mutex lock;
+	size_t hits = 0;
+	size_t misses = 0;
+	double saved = 0;
+} cache_stats;
+
+// Non cryptographic hash of the file contents; 1 MB blocks are hashed in
+// parallel, eight bytes at a time, and then combined in order
+static uint64_t content_hash(const char *data, size_t size)
+{
+	constexpr size_t BLOCK = 1 << 20;
+
+	auto mix = [](uint64_t h) {
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDull;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53ull;
+		return h ^ (h >> 33);
+	};
+
+	size_t blocks = (size + BLOCK - 1) / BLOCK;
+
+	std::vector <uint64_t> hashes(blocks);
+	parallel_for(blocks, 4, [&](size_t, size_t begin, size_t end) {
+		for (size_t b = begin; b < end; b++) {
+			const char *p = data + b * BLOCK;
+			size_t n = std::min(BLOCK, size - b * BLOCK);
+
+			uint64_t h = 0x9E3779B97F4A7C15ull ^ n;
+
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				uint64_t word;
+				std::memcpy(&word, p + i, sizeof(word));
+				h = (h ^ mix(word)) * 0x100000001B3ull;
+			}
+
+			uint64_t tail = 0;
+			std::memcpy(&tail, p + i, n - i);
+			hashes[b] = mix(h ^ mix(tail));
+		}
+	});
+
+	uint64_t h = mix(size);
+	for (uint64_t block : hashes)
+		h = mix(h ^ block) * 0x100000001B3ull;
+
+	return h;
+}
+
+static std::filesystem::path cache_directory(const std::string &directory)
+{
+	if (!directory.empty())
+		return directory;
+
+	// Same location as the shader cache of the rasterizer
+	if (const char *xdg = std::getenv("XDG_CACHE_HOME"))
+		return std::filesystem::path(xdg) / "ngf" / "meshes";
+	else if (const char *home = std::getenv("HOME"))
+		return std::filesystem::path(home) / ".cache" / "ngf" / "meshes";
+
+	return std::filesystem::path(".ngf-cache") / "meshes";
+}
+
+// Maps a cache entry; the tensors share the (copy on write) mapping, which is
+// released along with the last of them
+static std::optional <std::tuple <torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor, float>>
+map_cached(const std::filesystem::path &path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return std::nullopt;
+
+	struct stat st;
+	void *address = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(CachedMeshHeader))
+		address = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (address == MAP_FAILED)
+		return std::nullopt;
+
+	size_t size = st.st_size;
+	std::shared_ptr <void> mapping(address, [size](void *p) { munmap(p, size); });
+
+	const CachedMeshHeader &header = *(const CachedMeshHeader *) address;
+
+	size_t expected = sizeof(CachedMeshHeader)
+		+ 2 * header.vertices * sizeof(glm::vec3)
+		+ header.triangles * sizeof(glm::ivec3);
+
+	if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC))
+			|| header.version != CACHE_VERSION
+			|| size != expected)
+		return std::nullopt;
+
+	char *base = (char *) address + sizeof(CachedMeshHeader);
+	char *normals = base + header.vertices * sizeof(glm::vec3);
+	char *triangles = normals + header.vertices * sizeof(glm::vec3);
+
+	auto keep = [mapping](void *) {};
+
+	auto floats = torch::TensorOptions().dtype(torch::kFloat32);
+	auto ints = torch::TensorOptions().dtype(torch::kInt32);
+
+	long V = header.vertices;
+	long T = header.triangles;
+
+	torch::Tensor transform = torch::tensor({
+		header.center[0], header.center[1], header.center[2], header.extent
+	}, floats);
+
+	return std::make_tuple(
+		torch::from_blob(base, { V, 3 }, keep, floats),
+		torch::from_blob(normals, { V, 3 }, keep, floats),
+		torch::from_blob(triangles, { T, 3 }, keep, ints),
+		transform,
+		header.milliseconds
+	);
+}
+
+// Written to a temporary file first, so that concurrent runs never map a
+// partially written entry
+static void store_cached(const std::filesystem::path &path, CachedMeshHeader header,
+		const torch::Tensor &vertices, const torch::Tensor &normals, const torch::Tensor &triangles)
+{
+	std::error_code error;
+	std::filesystem::create_directories(path.parent_path(), error);
+
+	std::filesystem::path temporary = path;
+	temporary += "." + std::to_string(getpid()) + ".tmp";
+
+	{
+		std::ofstream file(temporary, std::ios::binary);
+		if (!file)
+			return;
+
+		file.write((const char *) &header, sizeof(header));
+		file.write((const char *) vertices.data_ptr <float> (), vertices.numel() * sizeof(float));
+		file.write((const char *) normals.data_ptr <float> (), normals.numel() * sizeof(float));
+		file.write((const char *) triangles.data_ptr <int32_t> (), triangles.numel() * sizeof(int32_t));
+
+		if (!file) {
+			file.close();
+			std::filesystem::remove(temporary, error);
+			return;
+		}
 	}
 
-	std::vector <Mesh> meshes = assimp_process_node(scene->mRootNode, scene, path.parent_path());
-	if (meshes.size() == 0) {
-		printf("NO MESHES FOUND!\n");
+	std::filesystem::rename(temporary, path, error);
+	if (error)
+		std::filesystem::remove(temporary, error);
+}
+
+// Hits refresh the modification time, so the oldest entries are the least
+// recently used ones; the entry just written is always kept
+static void evict_cached(const std::filesystem::path &keep)
+{
+	using Entry = std::tuple <std::filesystem::file_time_type, uintmax_t, std::filesystem::path>;
+
+	std::error_code error;
+	std::vector <Entry> entries;
+	uintmax_t total = 0;
+
+	for (const auto &entry : std::filesystem::directory_iterator(keep.parent_path(), error)) {
+		if (entry.path().extension() != ".mesh")
+			continue;
+
+		uintmax_t size = entry.file_size(error);
+		if (error)
+			continue;
+
+		auto time = entry.last_write_time(error);
+		if (error)
+			continue;
+
+		total += size;
+		if (entry.path() != keep)
+			entries.emplace_back(time, size, entry.path());
+	}
+
+	std::sort(entries.begin(), entries.end());
+
+	for (const auto &[time, size, path] : entries) {
+		if (total <= CACHE_CAPACITY)
+			break;
+
+		if (std::filesystem::remove(path, error))
+			total -= size;
+	}
+}
+
+// Loads through the cache, keyed by the file contents and the load options;
+// returns the (unnormalized) vertices, normals and triangles, along with the
+// bounding box center and largest extent used for normalization
+std::tuple <torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor>
+load_mesh_cached(const std::string &s, bool welding, bool native, const std::string &directory)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	auto elapsed = [&]() {
+		auto now = std::chrono::steady_clock::now();
+		return std::chrono::duration <double, std::milli> (now - start).count();
+	};
+
+	std::filesystem::path path = cache_directory(directory);
+
+	{
+		MappedFile file(s);
+		if (!file.data) {
+			printf("Could not open %s\n", s.c_str());
+			return {};
+		}
+
+		char name[64];
+		snprintf(name, sizeof(name), "%016lx-w%d-n%d.mesh",
+			(unsigned long) content_hash(file.data, file.size), welding, native);
+
+		path /= name;
+	}
+
+	if (auto cached = map_cached(path)) {
+		auto [vertices, normals, triangles, transform, original] = *cached;
+
+		std::error_code error;
+		std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+
+		std::lock_guard guard(cache_stats.lock);
+		cache_stats.hits++;
+		cache_stats.saved += std::max(0.0, original - elapsed());
+
+		return std::make_tuple(vertices, normals, triangles, transform);
+	}
+
+	auto [vertices, normals, uvs, triangles] = load_mesh(s, welding, native);
+	if (!vertices.defined())
 		return {};
+
+	const glm::vec3 *V = (const glm::vec3 *) vertices.data_ptr <float> ();
+
+	glm::vec3 min(std::numeric_limits <float> ::max());
+	glm::vec3 max(-std::numeric_limits <float> ::max());
+	for (long i = 0; i < vertices.size(0); i++) {
+		min = glm::min(min, V[i]);
+		max = glm::max(max, V[i]);
 	}
 
-	Mesh m = meshes.front();
-	return std::make_tuple
-	(
-		vector_to_tensor <glm::vec3, torch::kFloat32, 3> (m.vertices),
-		vector_to_tensor <glm::vec3, torch::kFloat32, 3> (m.normals),
-		vector_to_tensor <glm::vec2, torch::kFloat32, 2> (m.uvs),
-		vector_to_tensor <glm::ivec3, torch::kInt32, 3> (m.triangles)
-	);
+	glm::vec3 center = (min + max) / 2.0f;
+	glm::vec3 size = max - min;
+
+	CachedMeshHeader header {};
+	std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.flags = uint32_t(welding) | (uint32_t(native) << 1);
+	header.vertices = vertices.size(0);
+	header.triangles = triangles.size(0);
+	header.center[0] = center.x;
+	header.center[1] = center.y;
+	header.center[2] = center.z;
+	header.extent = std::max(size.x, std::max(size.y, size.z));
+	header.milliseconds = elapsed();
+
+	store_cached(path, header, vertices, normals, triangles);
+	evict_cached(path);
+
+	{
+		std::lock_guard guard(cache_stats.lock);
+		cache_stats.misses++;
+	}
 
-	// return assimp_process_node(scene->mRootNode, scene, path.parent_path());
+	torch::Tensor transform = torch::tensor({ center.x, center.y, center.z, header.extent },
+		torch::TensorOptions().dtype(torch::kFloat32));
+
+	return std::make_tuple(vertices, normals, triangles, transform);
+}
+
+std::tuple <size_t, size_t, double> mesh_cache_stats()
+{
+	std::lock_guard guard(cache_stats.lock);
+	return { cache_stats.hits, cache_stats.misses, cache_stats.saved };
 }
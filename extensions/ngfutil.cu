@@ -146,10 +146,7 @@ remapper generate_remapper(const torch::Tensor &complexes,
 	assert(complexes.dtype() == torch::kInt32);
 	assert(complexes.dim() == 2 && complexes.size(1) == 4);
 
-	std::vector <glm::ivec4> cs(complexes.size(0));
-	// printf("cs: %lu\n", cs.size());
-	int32_t *ptr = complexes.data_ptr <int32_t> ();
-	std::memcpy(cs.data(), ptr, complexes.size(0) * sizeof(glm::ivec4));
+	std::vector <glm::ivec4> cs = tensor_to_vector <glm::ivec4> (complexes);
 
 	// Mappings
 	std::unordered_map <int32_t, int32_t> rcmap;
@@ -288,20 +285,10 @@ std::tuple <torch::Tensor, torch::Tensor> deduplicate(const torch::Tensor &verti
 		new_indices.push_back(hashed[vertex]);
 	}
 
-	auto options = torch::TensorOptions()
-		.dtype(torch::kFloat32)
-		.device(torch::kCPU, 0);
-
-	torch::Tensor tch_new_vertices = torch::zeros({ (long) new_vertices.size(), 3 }, options);
-	torch::Tensor tch_new_triangles = torch::zeros_like(triangles);
-
-	float *new_vertices_raw = tch_new_vertices.data_ptr <float> ();
-	int32_t *new_indices_raw = tch_new_triangles.data_ptr <int32_t> ();
-
-	std::memcpy(new_vertices_raw, new_vertices.data(), sizeof(glm::vec3) * new_vertices.size());
-	std::memcpy(new_indices_raw, new_indices.data(), sizeof(int32_t) * new_indices.size());
-
-	return { tch_new_vertices, tch_new_triangles };
+	return {
+		vector_to_tensor <glm::vec3, torch::kFloat32, 3> (std::move(new_vertices)),
+		vector_to_tensor <int32_t, torch::kInt32> (std::move(new_indices)).view({ triangles.size(0), 3 })
+	};
 }
 
 __forceinline__ __device__
@@ -322,6 +309,34 @@ float3 operator*(float k, float3 v)
 	return make_float3(k * v.x, k * v.y, k * v.z);
 }
 
+// Corners of the bilinear footprint of a sample in a (complexes, resx, resy)
+// map, as texel indices and weights; samples are clamped to the map
+__forceinline__ __device__
+void ngf_texel_footprint(float u, float v, int32_t ci, int32_t resx, int32_t resy, int32_t indices[4], float weights[4])
+{
+	float su = fminf(fmaxf(u, 0.0f), 1.0f) * (resx - 1);
+	float sv = fminf(fmaxf(v, 0.0f), 1.0f) * (resy - 1);
+
+	int32_t iu0 = min(int32_t(floorf(su)), resx - 1);
+	int32_t iv0 = min(int32_t(floorf(sv)), resy - 1);
+	int32_t iu1 = min(iu0 + 1, resx - 1);
+	int32_t iv1 = min(iv0 + 1, resy - 1);
+
+	su -= iu0;
+	sv -= iv0;
+
+	int32_t base = ci * resx * resy;
+	indices[0] = base + iu0 * resy + iv0;
+	indices[1] = base + iu1 * resy + iv0;
+	indices[2] = base + iu0 * resy + iv1;
+	indices[3] = base + iu1 * resy + iv1;
+
+	weights[0] = (1 - su) * (1 - sv);
+	weights[1] = su * (1 - sv);
+	weights[2] = (1 - su) * sv;
+	weights[3] = su * sv;
+}
+
 // TODO: pass the complex indices
 __global__
 void kernel_ngf_texture_fetch_forward
@@ -344,44 +359,20 @@ void kernel_ngf_texture_fetch_forward
 
 	int32_t limit = complexes * rate * rate;
 	for (int32_t i = tid; i < limit; i += stride) {
-		float su = (resx - 1) * u[i];
-		float sv = (resy - 1) * v[i];
+		int32_t indices[4];
+		float weights[4];
+		ngf_texel_footprint(u[i], v[i], i / (rate * rate), resx, resy, indices, weights);
 
-		int32_t iu0 = floor(su);
-		int32_t iu1 = floor(su);
+		float3 color = make_float3(0, 0, 0);
+		for (int32_t k = 0; k < 4; k++)
+			color = color + map[indices[k]] * weights[k];
 
-		int32_t iv0 = ceil(sv);
-		int32_t iv1 = ceil(sv);
-
-		su -= iu0;
-		sv -= iv0;
-
-		int32_t ci = i / (rate * rate);
-
-		int32_t i0 = ci * resx * resy + iu0 * resx + iv0;
-		int32_t i1 = ci * resx * resy + iu1 * resx + iv0;
-		int32_t i2 = ci * resx * resy + iu0 * resx + iv1;
-		int32_t i3 = ci * resx * resy + iu1 * resx + iv1;
-
-		float3 f00 = map[i0] * (1 - su) * (1 - sv);
-		float3 f01 = map[i1] * su * (1 - sv);
-		float3 f10 = map[i2] * (1 - su) * sv;
-		float3 f11 = map[i3] * su * sv;
-
-		result[i] = f00 + f01 + f10 + f11;
+		result[i] = color;
 	}
 }
 
-__forceinline__ __device__
-float3 atomicAdd(float3 *addr, float3 val)
-{
-	float3 old;
-	old.x = atomicAdd(&addr->x, val.x);
-	old.y = atomicAdd(&addr->y, val.y);
-	old.z = atomicAdd(&addr->z, val.z);
-	return old;
-}
-
+// Each complex only touches its own texels, so one thread per complex sums
+// its samples in order, without atomics and with deterministic gradients
 __global__
 void kernel_ngf_texture_fetch_backward
 (
@@ -395,49 +386,23 @@ void kernel_ngf_texture_fetch_backward
 	int32_t rate
 )
 {
-	// NOTE: map is (complexes, res x, res y)
-	// uvs are (complexes, rate * rate)
-
 	int32_t tid = threadIdx.x + blockIdx.x * blockDim.x;
 	int32_t stride = blockDim.x * gridDim.x;
 
-	int32_t limit = complexes * rate * rate;
-	for (int32_t i = tid; i < limit; i += stride) {
-		float su = (resx - 1) * u[i];
-		float sv = (resy - 1) * v[i];
-
-		int32_t iu0 = floor(su);
-		int32_t iu1 = floor(su);
-
-		int32_t iv0 = ceil(sv);
-		int32_t iv1 = ceil(sv);
-
-		su -= iu0;
-		sv -= iv0;
-
-		int32_t ci = i / (rate * rate);
-		int32_t i0 = ci * resx * resy + iu0 * resx + iv0;
-		int32_t i1 = ci * resx * resy + iu1 * resx + iv0;
-		int32_t i2 = ci * resx * resy + iu0 * resx + iv1;
-		int32_t i3 = ci * resx * resy + iu1 * resx + iv1;
-
-		float3 d0 = (1 - su) * (1 - sv) * grad_result[i];
-		float3 d1 = su * (1 - sv) * grad_result[i];
-		float3 d2 = (1 - su) * sv * grad_result[i];
-		float3 d3 = su * sv * grad_result[i];
-
-		atomicAdd(&dmap[i0], d0);
-		atomicAdd(&dmap[i1], d1);
-		atomicAdd(&dmap[i2], d2);
-		atomicAdd(&dmap[i3], d3);
-
-//		dmap[i0] = (1 - su) * (1 - sv) * grad_result[i];
-//		dmap[i1] = su * (1 - sv) * grad_result[i];
-//		dmap[i2] = (1 - su) * sv * grad_result[i];
-//		dmap[i3] = su * sv * grad_result[i];
+	int32_t samples = rate * rate;
+	for (int32_t ci = tid; ci < complexes; ci += stride) {
+		for (int32_t i = ci * samples; i < (ci + 1) * samples; i++) {
+			int32_t indices[4];
+			float weights[4];
+			ngf_texel_footprint(u[i], v[i], ci, resx, resy, indices, weights);
+
+			for (int32_t k = 0; k < 4; k++)
+				dmap[indices[k]] = dmap[indices[k]] + grad_result[i] * weights[k];
+		}
 	}
 }
 
+// Dispatched on the device of the map, or of the gradients
 torch::Tensor ngf_texture_fetch_forward
 (
 	const torch::Tensor &map,
@@ -449,6 +414,9 @@ torch::Tensor ngf_texture_fetch_forward
 	int32_t rate
 )
 {
+	if (map.is_cpu())
+		return ngf_texture_fetch_forward_cpu(map, u, v, complexes, resx, resy, rate);
+
 	assert(map.is_cuda());
 	assert(u.is_cuda());
 	assert(v.is_cuda());
@@ -461,17 +429,24 @@ torch::Tensor ngf_texture_fetch_forward
 	assert(u.dim() == 2);
 	assert(v.dim() == 2);
 
+	torch::Tensor cmap = map.contiguous();
+	torch::Tensor cu = u.contiguous();
+	torch::Tensor cv = v.contiguous();
+
 	auto options = torch::TensorOptions()
 		.dtype(torch::kFloat32)
-		.device(torch::kCUDA, 0);
+		.device(map.device());
 
 	torch::Tensor result = torch::zeros({ u.numel(), 3 }, options);
 
-	kernel_ngf_texture_fetch_forward <<< 64, 64 >>>
+	int32_t limit = complexes * rate * rate;
+	int32_t blocks = std::max((limit + 255) / 256, 1);
+
+	kernel_ngf_texture_fetch_forward <<< blocks, 256 >>>
 	(
-		(float3 *) map.data_ptr <float> (),
-		u.data_ptr <float> (),
-		v.data_ptr <float> (),
+		(float3 *) cmap.data_ptr <float> (),
+		cu.data_ptr <float> (),
+		cv.data_ptr <float> (),
 		(float3 *) result.mutable_data_ptr <float> (),
 		complexes,
 		resx, resy, rate
@@ -493,6 +468,9 @@ torch::Tensor ngf_texture_fetch_backward
 	int32_t rate
 )
 {
+	if (d_color.is_cpu())
+		return ngf_texture_fetch_backward_cpu(d_color, u, v, complexes, resx, resy, rate);
+
 	assert(d_color.is_cuda());
 	assert(u.is_cuda());
 	assert(v.is_cuda());
@@ -505,17 +483,23 @@ torch::Tensor ngf_texture_fetch_backward
 	assert(u.dim() == 2);
 	assert(v.dim() == 2);
 
+	torch::Tensor cd = d_color.contiguous();
+	torch::Tensor cu = u.contiguous();
+	torch::Tensor cv = v.contiguous();
+
 	auto options = torch::TensorOptions()
 		.dtype(torch::kFloat32)
-		.device(torch::kCUDA, 0);
+		.device(d_color.device());
 
 	torch::Tensor result = torch::zeros({ complexes, resx, resy, 3 }, options);
 
-	kernel_ngf_texture_fetch_backward <<< 64, 64 >>>
+	int32_t blocks = std::max((complexes + 63) / 64, 1);
+
+	kernel_ngf_texture_fetch_backward <<< blocks, 64 >>>
 	(
-		(float3 *) d_color.data_ptr <float> (),
-		u.data_ptr <float> (),
-		v.data_ptr <float> (),
+		(float3 *) cd.data_ptr <float> (),
+		cu.data_ptr <float> (),
+		cv.data_ptr <float> (),
 		(float3 *) result.mutable_data_ptr <float> (),
 		complexes,
 		resx, resy, rate
@@ -526,6 +510,22 @@ torch::Tensor ngf_texture_fetch_backward
 	return result;
 }
 
+// View into a vector of a Python owned object; the deleter holds a reference
+// to the owner, so slices and views of the tensor keep it alive as well
+template <typename T, torch::Dtype type, size_t components>
+static torch::Tensor owned_view(const std::vector <T> &data, py::object owner)
+{
+	py::object *reference = new py::object(std::move(owner));
+	auto release = [reference](void *) {
+		// Storage may be freed from any thread
+		py::gil_scoped_acquire gil;
+		delete reference;
+	};
+
+	auto options = torch::TensorOptions().dtype(type).device(torch::kCPU, 0);
+	return torch::from_blob((void *) data.data(), { (long) data.size(), (long) components }, release, options);
+}
+
 PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
 {
         py::class_ <geometry> (m, "geometry")
@@ -533,9 +533,19 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
                 .def(py::init <const torch::Tensor &, const torch::Tensor &, const torch::Tensor &> ())
 		.def("deduplicate", &geometry::deduplicate)
 		.def("torched", &geometry::torched)
-		.def_readonly("vertices", &geometry::vertices)
-		.def_readonly("normals", &geometry::normals)
-		.def_readonly("triangles", &geometry::triangles)
+		// Views into the geometry, which they keep alive
+		.def_property_readonly("vertices", [](py::object self) {
+			const geometry &g = self.cast <const geometry &> ();
+			return owned_view <glm::vec3, torch::kFloat32, 3> (g.vertices, self);
+		})
+		.def_property_readonly("normals", [](py::object self) {
+			const geometry &g = self.cast <const geometry &> ();
+			return owned_view <glm::vec3, torch::kFloat32, 3> (g.normals, self);
+		})
+		.def_property_readonly("triangles", [](py::object self) {
+			const geometry &g = self.cast <const geometry &> ();
+			return owned_view <glm::ivec3, torch::kInt32, 3> (g.triangles, self);
+		})
 		.def("__repr__", [](const geometry &g) {
 			return "geometry(vertices=" + std::to_string(g.vertices.size())
 				+ ", triangles=" + std::to_string(g.triangles.size()) + ")";
@@ -545,19 +555,48 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
 		.def(py::init <const torch::Tensor &, size_t> ())
 		.def("smooth", &Graph::smooth);
 
+	py::class_ <QuantizedMLP> (m, "QuantizedMLP")
+		.def(py::init <const std::vector <torch::Tensor> &, const std::vector <torch::Tensor> &, const std::string &> ())
+		.def("forward", &QuantizedMLP::forward, "Evaluate the MLP on the CPU")
+		.def("kernel", &QuantizedMLP::kernel_name, "Name of the selected CPU kernel")
+		.def("bytes", &QuantizedMLP::bytes, "Size of the weights and biases in bytes")
+		.def("stream", &QuantizedMLP::stream, "Serialize the quantized weights and biases");
+
+	py::class_ <ProgressiveMesh> (m, "ProgressiveMesh")
+		.def(py::init <const torch::Tensor &, const torch::Tensor &> ())
+		.def("extract", &ProgressiveMesh::extract_triangles, "Vertices and triangles with at most the given triangle count")
+		.def("extract_bytes", &ProgressiveMesh::extract_bytes, "Vertices and triangles within the given size in bytes")
+		.def("__len__", [](const ProgressiveMesh &pm) { return pm.collapses.size(); });
+
 	py::class_ <remapper> (m, "remapper")
 		.def("remap", &remapper::remap, "Remap indices")
 		.def("remap_device", &remapper::remap_device, "Remap indices")
 		.def("scatter", &remapper::scatter, "Scatter vertex data")
 		.def("scatter_device", &remapper::scatter_device, "Scatter vertex data");
 
-	m.def("cluster_geometry", &cluster_geometry);
+	m.def("cluster_geometry", &cluster_geometry_csr, "Cluster a geometry into charts; returns offsets and face indices (CSR)",
+		py::arg("geometry"), py::arg("seeds"), py::arg("iterations") = 3, py::arg("metric") = "uniform");
+	m.def("arrange_views", &arrange_views, "Cameras facing the clusters of a geometry; returns view matrices and eyes",
+		py::arg("geometry"), py::arg("seeds"), py::arg("iterations") = 3, py::arg("metric") = "uniform", py::arg("radius") = 1.0f);
 	m.def("triangulate_shorted", &triangulate_shorted);
 	m.def("generate_remapper", &generate_remapper, "Generate remapper");
 	m.def("deduplicate", &deduplicate, "Deduplicate mesh vertices and reindex the mesh");
 	m.def("parametrize_chart", &parametrize, "Parametrize a chart with disk topology");
 	m.def("parametrize_multicharts", &parametrize_parallel, "Parametrize multiple charts with disk topology in parallel");
-	m.def("load_mesh", &load_mesh);
+	m.def("parametrize_multicharts_packed", &parametrize_multicharts_packed,
+		"Cluster a geometry into charts and parametrize them; returns packed vertices, faces, uvs, vertex and face offsets, and disk flags",
+		py::arg("geometry"), py::arg("seeds"), py::arg("iterations") = 3, py::arg("metric") = "uniform");
+	m.def("pack_atlas", &pack_atlas,
+		"Pack chart uv bounds into an atlas; returns uv transforms, texel rectangles, width, height and utilization",
+		py::arg("bounds"), py::arg("density"), py::arg("gutter") = 2, py::arg("rotate") = false, py::arg("candidates") = 8);
+	m.def("load_mesh", &load_mesh, "Load vertices, normals, uvs and triangles of a mesh",
+		py::arg("path"), py::arg("weld") = true, py::arg("native") = true);
+	m.def("load_mesh_cached", &load_mesh_cached, "Load vertices, normals, triangles and normalization through the mesh cache",
+		py::arg("path"), py::arg("weld") = true, py::arg("native") = true, py::arg("directory") = "");
+	m.def("mesh_cache_stats", &mesh_cache_stats, "Mesh cache hits, misses and milliseconds saved");
+	m.def("quadrangulate", &quadrangulate, "Quad patch layout with about the given number of patches; returns points and complexes",
+		py::arg("vertices"), py::arg("triangles"), py::arg("patches"));
+	m.def("spatial_order", &spatial_order, "Order patches along a space filling curve and renumber vertices by first touch");
 
 	m.def("ngf_texture_fetch_forward", &ngf_texture_fetch_forward);
 	m.def("ngf_texture_fetch_backward", &ngf_texture_fetch_backward);
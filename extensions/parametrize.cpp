@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <cmath>
+#include <mutex>
 #include <optional>
 #include <thread>
 
@@ -447,29 +448,14 @@ static std::vector <glm::vec2> geometric_stretch_optimization
 	return new_uvs;
 }
 
-torch::Tensor parametrize
+// Harmonic disk parametrization of a chart, refined by stretch optimization
+static std::vector <glm::vec2> parametrize_disk
 (
-	const torch::Tensor &tch_vertices,
-	const torch::Tensor &tch_faces,
+	const VertexList &vertices,
+	const FaceList &faces,
 	const std::vector <int32_t> &boundary
 )
 {
-	tensor_check <torch::kCPU, torch::kFloat32, 3> (tch_vertices);
-	tensor_check <torch::kCPU, torch::kInt32, 3>   (tch_faces);
-
-	// Localizing buffers
-	std::vector <glm::vec3> vertices;
-	std::vector <glm::ivec3> faces;
-
-	vertices.resize(tch_vertices.size(0));
-	faces.resize(tch_faces.size(0));
-
-	const float *vertices_raw = tch_vertices.data_ptr <float> ();
-	const int32_t *faces_raw = tch_faces.data_ptr <int32_t> ();
-
-	std::memcpy(vertices.data(), vertices_raw, vertices.size() * sizeof(glm::vec3));
-	std::memcpy(faces.data(), faces_raw, faces.size() * sizeof(glm::ivec3));
-
 	// Chart triangle topology
 	Connectivity conn = Connectivity::from(vertices, faces);
 
@@ -480,10 +466,26 @@ torch::Tensor parametrize
 
 	// Parametrize
 	std::vector <glm::vec2> huvs = harmonic_disk_parametrization(vertices, conn, boundary, bset);
-	std::vector <glm::vec2> uvs = geometric_stretch_optimization(conn, vertices, faces, huvs, boundary, bset);
+	return geometric_stretch_optimization(conn, vertices, faces, huvs, boundary, bset);
+}
+
+torch::Tensor parametrize
+(
+	const torch::Tensor &tch_vertices,
+	const torch::Tensor &tch_faces,
+	const std::vector <int32_t> &boundary
+)
+{
+	tensor_check <torch::kCPU, torch::kFloat32, 3> (tch_vertices);
+	tensor_check <torch::kCPU, torch::kInt32, 3>   (tch_faces);
+
+	// Localizing buffers
+	std::vector <glm::vec3> vertices = tensor_to_vector <glm::vec3> (tch_vertices);
+	std::vector <glm::ivec3> faces = tensor_to_vector <glm::ivec3> (tch_faces);
+
+	std::vector <glm::vec2> uvs = parametrize_disk(vertices, faces, boundary);
 
-//	return vector_to_tensor <glm::vec2, torch::kFloat32, 2> (huvs);
-	return vector_to_tensor <glm::vec2, torch::kFloat32, 2> (uvs);
+	return vector_to_tensor <glm::vec2, torch::kFloat32, 2> (std::move(uvs));
 }
 
 std::vector <torch::Tensor> parametrize_parallel
@@ -541,3 +543,187 @@ std::vector <torch::Tensor> parametrize_parallel
 
 	return parametrizations;
 }
+
+// Chart of a multichart parametrization, in local indices
+struct Chart {
+	VertexList vertices;
+	FaceList faces;
+	std::vector <int32_t> boundary;
+	std::vector <glm::vec2> uvs;
+	bool disk = false;
+};
+
+// Local vertices and faces of a cluster, along with its boundary loop ordered
+// by the face orientation; the chart is a disk if it is manifold, the loop
+// covers every boundary edge and the Euler characteristic is one
+static Chart extract_chart(const geometry &g, std::vector <int32_t> cluster)
+{
+	Chart chart;
+
+	// Sorted for results independent of the clustering set order
+	std::sort(cluster.begin(), cluster.end());
+
+	std::unordered_map <int32_t, int32_t> local;
+	chart.faces.reserve(cluster.size());
+	for (int32_t f : cluster) {
+		const glm::ivec3 &t = g.triangles[f];
+
+		glm::ivec3 lt;
+		for (int32_t k = 0; k < 3; k++) {
+			auto [it, inserted] = local.try_emplace(t[k], chart.vertices.size());
+			if (inserted)
+				chart.vertices.push_back(g.vertices[t[k]]);
+
+			lt[k] = it->second;
+		}
+
+		chart.faces.push_back(lt);
+	}
+
+	std::unordered_map <ordered_pair, int32_t, ordered_pair::hash> edges;
+	for (const glm::ivec3 &t : chart.faces) {
+		for (int32_t k = 0; k < 3; k++)
+			edges[ordered_pair(t[k], t[(k + 1) % 3])]++;
+	}
+
+	// Directed edges without a twin are on the boundary
+	std::unordered_map <int32_t, int32_t> next;
+	for (const glm::ivec3 &t : chart.faces) {
+		for (int32_t k = 0; k < 3; k++) {
+			int32_t a = t[k];
+			int32_t b = t[(k + 1) % 3];
+
+			int32_t count = edges[ordered_pair(a, b)];
+			if (count > 2)
+				return chart;
+
+			if (count == 1 && !next.emplace(a, b).second)
+				return chart;
+		}
+	}
+
+	if (next.empty())
+		return chart;
+
+	int32_t start = next.begin()->first;
+	for (const auto &[a, _] : next)
+		start = std::min(start, a);
+
+	int32_t v = start;
+	do {
+		chart.boundary.push_back(v);
+
+		auto it = next.find(v);
+		if (it == next.end())
+			break;
+
+		v = it->second;
+	} while (v != start && chart.boundary.size() <= next.size());
+
+	int64_t euler = int64_t(chart.vertices.size()) - int64_t(edges.size()) + int64_t(chart.faces.size());
+
+	// At least four boundary vertices, one for each side of the square
+	chart.disk = (v == start)
+		&& (chart.boundary.size() == next.size())
+		&& (chart.boundary.size() >= 4)
+		&& (euler == 1);
+
+	return chart;
+}
+
+// Clusters the geometry into charts and parametrizes each disk shaped chart,
+// all on worker threads; the results are packed into single tensors, with
+// faces indexing the packed vertices and offsets delimiting the charts
+std::tuple <torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor>
+parametrize_multicharts_packed
+(
+	const geometry &g,
+	const std::vector <int32_t> &seeds,
+	int32_t iterations,
+	const std::string &metric
+)
+{
+	std::vector <std::vector <int32_t>> clusters = cluster_geometry(g, seeds, iterations, metric);
+
+	std::vector <Chart> charts;
+	charts.resize(clusters.size());
+
+	int32_t threads = std::thread::hardware_concurrency();
+
+	// Job counter (index)
+	std::mutex jobber;
+
+	int32_t next = 0;
+
+	// Worker pool
+	std::vector <std::thread> workers;
+	for (int32_t i = 0; i < threads; i++) {
+		workers.emplace_back
+		(
+			[&]() {
+				while (true) {
+					int32_t index = -1;
+					{
+						std::lock_guard lock { jobber };
+						index = next++;
+					}
+
+					if (index >= (int32_t) clusters.size())
+						break;
+
+					Chart &chart = charts[index];
+					chart = extract_chart(g, std::move(clusters[index]));
+					if (chart.disk)
+						chart.uvs = parametrize_disk(chart.vertices, chart.faces, chart.boundary);
+					else
+						chart.uvs.resize(chart.vertices.size(), glm::vec2(0.0f));
+				}
+			}
+		);
+	}
+
+	// Wait to finish
+	for (int32_t i = 0; i < threads; i++)
+		workers[i].join();
+
+	// Packing
+	auto int64s = torch::TensorOptions().dtype(torch::kInt64);
+
+	torch::Tensor vertex_offsets = torch::zeros({ (long) charts.size() + 1 }, int64s);
+	torch::Tensor face_offsets = torch::zeros({ (long) charts.size() + 1 }, int64s);
+	torch::Tensor disks = torch::zeros({ (long) charts.size() }, torch::TensorOptions().dtype(torch::kBool));
+
+	int64_t *voffsets = vertex_offsets.data_ptr <int64_t> ();
+	int64_t *foffsets = face_offsets.data_ptr <int64_t> ();
+	bool *disks_raw = disks.data_ptr <bool> ();
+
+	for (size_t i = 0; i < charts.size(); i++) {
+		voffsets[i + 1] = voffsets[i] + charts[i].vertices.size();
+		foffsets[i + 1] = foffsets[i] + charts[i].faces.size();
+		disks_raw[i] = charts[i].disk;
+	}
+
+	auto floats = torch::TensorOptions().dtype(torch::kFloat32);
+	auto ints = torch::TensorOptions().dtype(torch::kInt32);
+
+	torch::Tensor vertices = torch::empty({ (long) voffsets[charts.size()], 3 }, floats);
+	torch::Tensor faces = torch::empty({ (long) foffsets[charts.size()], 3 }, ints);
+	torch::Tensor uvs = torch::empty({ (long) voffsets[charts.size()], 2 }, floats);
+
+	glm::vec3 *vertices_raw = (glm::vec3 *) vertices.data_ptr <float> ();
+	glm::ivec3 *faces_raw = (glm::ivec3 *) faces.data_ptr <int32_t> ();
+	glm::vec2 *uvs_raw = (glm::vec2 *) uvs.data_ptr <float> ();
+
+	for (size_t i = 0; i < charts.size(); i++) {
+		const Chart &chart = charts[i];
+
+		std::memcpy(vertices_raw + voffsets[i], chart.vertices.data(), chart.vertices.size() * sizeof(glm::vec3));
+		std::memcpy(uvs_raw + voffsets[i], chart.uvs.data(), chart.uvs.size() * sizeof(glm::vec2));
+
+		glm::ivec3 base(voffsets[i]);
+		for (size_t j = 0; j < chart.faces.size(); j++)
+			faces_raw[foffsets[i] + j] = chart.faces[j] + base;
+	}
+
+	return { vertices, faces, uvs, vertex_offsets, face_offsets, disks };
+}
@@ -0,0 +1,452 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#include <glm/gtc/packing.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NGF_X86
+#include <immintrin.h>
+#endif
+
+#include "common.hpp"
+
+// Rows are padded so that the vectorized kernels never need a tail loop;
+// 32 bytes covers a full AVX2 register of int8 (and two of fp16)
+static constexpr int32_t PADDING = 32;
+
+static int32_t padded(int32_t cols)
+{
+	return PADDING * ((cols + PADDING - 1) / PADDING);
+}
+
+static float leaky_relu(float x)
+{
+	return std::max(x, 0.01f * x);
+}
+
+// Reference kernels
+static void gemv_fp32(const QuantizedMLP::Layer &layer, const float *x, float *y)
+{
+	for (int32_t r = 0; r < layer.rows; r++) {
+		const float *w = layer.weights.data() + r * layer.stride;
+
+		float sum = 0.0f;
+		for (int32_t c = 0; c < layer.cols; c++)
+			sum += w[c] * x[c];
+
+		y[r] = sum + layer.bias[r];
+	}
+}
+
+static void gemv_fp16(const QuantizedMLP::Layer &layer, const float *x, float *y)
+{
+	for (int32_t r = 0; r < layer.rows; r++) {
+		const uint16_t *w = layer.halves.data() + r * layer.stride;
+
+		float sum = 0.0f;
+		for (int32_t c = 0; c < layer.cols; c++)
+			sum += glm::unpackHalf1x16(w[c]) * x[c];
+
+		y[r] = sum + layer.bias[r];
+	}
+}
+
+static void gemv_int8(const QuantizedMLP::Layer &layer, const uint8_t *x, float sx, float *y)
+{
+	for (int32_t r = 0; r < layer.rows; r++) {
+		const int8_t *w = layer.quantized.data() + r * layer.stride;
+
+		int32_t sum = 0;
+		for (int32_t c = 0; c < layer.cols; c++)
+			sum += int32_t(x[c]) * int32_t(w[c]);
+
+		sum -= 128 * layer.sums[r];
+		y[r] = float(sum) * sx * layer.scales[r] + layer.bias[r];
+	}
+}
+
+#ifdef NGF_X86
+
+// F16C conversions with FMA accumulation (Haswell and later)
+__attribute__((target("avx2,fma,f16c")))
+static void gemv_fp16_f16c(const QuantizedMLP::Layer &layer, const float *x, float *y)
+{
+	for (int32_t r = 0; r < layer.rows; r++) {
+		const uint16_t *w = layer.halves.data() + r * layer.stride;
+
+		__m256 acc = _mm256_setzero_ps();
+		for (int32_t c = 0; c < layer.stride; c += 8) {
+			__m256 wv = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (w + c)));
+			__m256 xv = _mm256_loadu_ps(x + c);
+			acc = _mm256_fmadd_ps(wv, xv, acc);
+		}
+
+		__m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+		s = _mm_hadd_ps(s, s);
+		s = _mm_hadd_ps(s, s);
+
+		y[r] = _mm_cvtss_f32(s) + layer.bias[r];
+	}
+}
+
+// Same accumulation order as the F16C kernel, for the fp32 reference
+__attribute__((target("avx2,fma")))
+static void gemv_fp32_avx2(const QuantizedMLP::Layer &layer, const float *x, float *y)
+{
+	for (int32_t r = 0; r < layer.rows; r++) {
+		const float *w = layer.weights.data() + r * layer.stride;
+
+		__m256 acc = _mm256_setzero_ps();
+		for (int32_t c = 0; c < layer.stride; c += 8) {
+			__m256 wv = _mm256_loadu_ps(w + c);
+			__m256 xv = _mm256_loadu_ps(x + c);
+			acc = _mm256_fmadd_ps(wv, xv, acc);
+		}
+
+		__m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+		s = _mm_hadd_ps(s, s);
+		s = _mm_hadd_ps(s, s);
+
+		y[r] = _mm_cvtss_f32(s) + layer.bias[r];
+	}
+}
+
+__attribute__((target("avx2")))
+static int32_t hsum_epi32(__m256i v)
+{
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(s);
+}
+
+// Unsigned activations times signed weights; VPDBUSD accumulates four
+// products per 32-bit lane without the int16 saturation of VPMADDUBSW
+__attribute__((target("avx2,avx512f,avx512vl,avx512vnni")))
+static void gemv_int8_vnni(const QuantizedMLP::Layer &layer, const uint8_t *x, float sx, float *y)
+{
+	for (int32_t r = 0; r < layer.rows; r++) {
+		const int8_t *w = layer.quantized.data() + r * layer.stride;
+
+		__m256i acc = _mm256_setzero_si256();
+		for (int32_t c = 0; c < layer.stride; c += 32) {
+			__m256i xv = _mm256_loadu_si256((const __m256i *) (x + c));
+			__m256i wv = _mm256_loadu_si256((const __m256i *) (w + c));
+			acc = _mm256_dpbusd_epi32(acc, xv, wv);
+		}
+
+		int32_t sum = hsum_epi32(acc) - 128 * layer.sums[r];
+		y[r] = float(sum) * sx * layer.scales[r] + layer.bias[r];
+	}
+}
+
+#if defined(__GNUC__) && (__GNUC__ >= 11) && !defined(__clang__)
+
+// The VEX encoded variant on client cores without AVX-512 (Alder Lake and later)
+__attribute__((target("avx2,avxvnni")))
+static void gemv_int8_avxvnni(const QuantizedMLP::Layer &layer, const uint8_t *x, float sx, float *y)
+{
+	for (int32_t r = 0; r < layer.rows; r++) {
+		const int8_t *w = layer.quantized.data() + r * layer.stride;
+
+		__m256i acc = _mm256_setzero_si256();
+		for (int32_t c = 0; c < layer.stride; c += 32) {
+			__m256i xv = _mm256_loadu_si256((const __m256i *) (x + c));
+			__m256i wv = _mm256_loadu_si256((const __m256i *) (w + c));
+			acc = _mm256_dpbusd_avx_epi32(acc, xv, wv);
+		}
+
+		int32_t sum = hsum_epi32(acc) - 128 * layer.sums[r];
+		y[r] = float(sum) * sx * layer.scales[r] + layer.bias[r];
+	}
+}
+
+#define NGF_AVXVNNI
+
+#endif
+
+#endif
+
+// Construction
+QuantizedMLP::QuantizedMLP(const std::vector <torch::Tensor> &weights,
+		const std::vector <torch::Tensor> &biases,
+		const std::string &precision_)
+{
+	assert(weights.size() == biases.size());
+
+	if (precision_ == "fp32")
+		precision = eFloat32;
+	else if (precision_ == "fp16")
+		precision = eFloat16;
+	else if (precision_ == "int8")
+		precision = eInt8;
+	else
+		throw std::invalid_argument("unknown precision " + precision_ + " (expected fp32, fp16 or int8)");
+
+	for (size_t i = 0; i < weights.size(); i++) {
+		torch::Tensor W = weights[i].detach().cpu().to(torch::kFloat32).contiguous();
+		torch::Tensor b = biases[i].detach().cpu().to(torch::kFloat32).contiguous();
+
+		assert(W.dim() == 2);
+		assert(b.dim() == 1 && b.size(0) == W.size(0));
+
+		Layer layer;
+		layer.rows = W.size(0);
+		layer.cols = W.size(1);
+		layer.stride = padded(layer.cols);
+
+		// Consecutive layers must agree on their sizes
+		if (i > 0)
+			assert(layer.cols == layers.back().rows);
+
+		const float *W_ptr = W.data_ptr <float> ();
+		const float *b_ptr = b.data_ptr <float> ();
+
+		layer.bias.assign(b_ptr, b_ptr + layer.rows);
+		layer.weights.resize(layer.rows * layer.stride, 0.0f);
+		for (int32_t r = 0; r < layer.rows; r++)
+			std::memcpy(&layer.weights[r * layer.stride], W_ptr + r * layer.cols, layer.cols * sizeof(float));
+
+		if (precision == eFloat16) {
+			layer.halves.resize(layer.weights.size(), 0);
+			for (size_t k = 0; k < layer.weights.size(); k++)
+				layer.halves[k] = glm::packHalf1x16(layer.weights[k]);
+		}
+
+		// Symmetric quantization with one scale per output channel
+		if (precision == eInt8) {
+			layer.quantized.resize(layer.weights.size(), 0);
+			layer.scales.resize(layer.rows);
+			layer.sums.resize(layer.rows);
+
+			for (int32_t r = 0; r < layer.rows; r++) {
+				const float *w = &layer.weights[r * layer.stride];
+
+				float max = 0.0f;
+				for (int32_t c = 0; c < layer.cols; c++)
+					max = std::max(max, std::fabs(w[c]));
+
+				float scale = (max > 0.0f) ? max/127.0f : 1.0f;
+
+				int32_t sum = 0;
+				for (int32_t c = 0; c < layer.cols; c++) {
+					float q = std::nearbyint(w[c]/scale);
+					int8_t qi = (int8_t) std::clamp(q, -127.0f, 127.0f);
+					layer.quantized[r * layer.stride + c] = qi;
+					sum += qi;
+				}
+
+				layer.scales[r] = scale;
+				layer.sums[r] = sum;
+			}
+		}
+
+		layers.push_back(layer);
+	}
+
+	// Pick the kernels once for the host
+	kernel = eScalar;
+
+#ifdef NGF_X86
+	bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+	if (precision == eInt8) {
+		if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl"))
+			kernel = eVNNI;
+#ifdef NGF_AVXVNNI
+		else if (__builtin_cpu_supports("avxvnni"))
+			kernel = eAVXVNNI;
+#endif
+	} else if (avx2) {
+		// Every AVX2 capable processor also implements F16C
+		kernel = (precision == eFloat16) ? eF16C : eAVX2;
+	}
+#endif
+}
+
+// Evaluation of a single input vector
+void QuantizedMLP::evaluate(const float *input, float *output, std::vector <float> &a, std::vector <float> &b, std::vector <uint8_t> &q) const
+{
+	std::memcpy(a.data(), input, layers[0].cols * sizeof(float));
+	std::fill(a.begin() + layers[0].cols, a.end(), 0.0f);
+
+	for (size_t i = 0; i < layers.size(); i++) {
+		const Layer &layer = layers[i];
+
+		if (precision == eInt8) {
+			// Dynamic per-vector activation scale, offset to unsigned for VPDBUSD
+			float max = 0.0f;
+			for (int32_t c = 0; c < layer.cols; c++)
+				max = std::max(max, std::fabs(a[c]));
+
+			float sx = (max > 0.0f) ? max/127.0f : 1.0f;
+			for (int32_t c = 0; c < layer.stride; c++) {
+				float v = std::clamp(std::nearbyint(a[c]/sx), -127.0f, 127.0f);
+				q[c] = uint8_t(int32_t(v) + 128);
+			}
+
+			switch (kernel) {
+#ifdef NGF_X86
+			case eVNNI:
+				gemv_int8_vnni(layer, q.data(), sx, b.data());
+				break;
+#ifdef NGF_AVXVNNI
+			case eAVXVNNI:
+				gemv_int8_avxvnni(layer, q.data(), sx, b.data());
+				break;
+#endif
+#endif
+			default:
+				gemv_int8(layer, q.data(), sx, b.data());
+				break;
+			}
+		} else if (precision == eFloat16) {
+#ifdef NGF_X86
+			if (kernel == eF16C)
+				gemv_fp16_f16c(layer, a.data(), b.data());
+			else
+#endif
+				gemv_fp16(layer, a.data(), b.data());
+		} else {
+#ifdef NGF_X86
+			if (kernel == eAVX2)
+				gemv_fp32_avx2(layer, a.data(), b.data());
+			else
+#endif
+				gemv_fp32(layer, a.data(), b.data());
+		}
+
+		// Hidden layers are activated, the last one is linear
+		if (i + 1 < layers.size()) {
+			for (int32_t r = 0; r < layer.rows; r++)
+				b[r] = leaky_relu(b[r]);
+		}
+
+		std::fill(b.begin() + layer.rows, b.end(), 0.0f);
+		std::swap(a, b);
+	}
+
+	std::memcpy(output, a.data(), layers.back().rows * sizeof(float));
+}
+
+torch::Tensor QuantizedMLP::forward(const torch::Tensor &input) const
+{
+	assert(input.dim() == 2 && input.size(1) == layers[0].cols);
+
+	torch::Tensor X = input.detach().cpu().to(torch::kFloat32).contiguous();
+
+	int64_t count = X.size(0);
+	int32_t fin = layers[0].cols;
+	int32_t fout = layers.back().rows;
+
+	torch::Tensor Y = torch::zeros({ count, fout }, torch::kFloat32);
+
+	const float *X_ptr = X.data_ptr <float> ();
+	float *Y_ptr = Y.data_ptr <float> ();
+
+	int32_t width = 0;
+	for (const Layer &layer : layers)
+		width = std::max({ width, layer.stride, padded(layer.rows) });
+
+	int32_t threads = std::max(1u, std::thread::hardware_concurrency());
+	int64_t chunk = (count + threads - 1)/threads;
+
+	std::vector <std::thread> workers;
+	for (int32_t t = 0; t < threads; t++) {
+		int64_t start = t * chunk;
+		int64_t end = std::min(count, start + chunk);
+		if (start >= end)
+			break;
+
+		workers.emplace_back
+		(
+			[&, start, end]() {
+				std::vector <float> a(width);
+				std::vector <float> b(width);
+				std::vector <uint8_t> q(width, 128);
+
+				for (int64_t i = start; i < end; i++)
+					evaluate(X_ptr + i * fin, Y_ptr + i * fout, a, b, q);
+			}
+		);
+	}
+
+	for (auto &worker : workers)
+		worker.join();
+
+	return Y;
+}
+
+std::string QuantizedMLP::kernel_name() const
+{
+	switch (kernel) {
+	case eAVX2:
+		return "avx2";
+	case eF16C:
+		return "f16c";
+	case eVNNI:
+		return "avx512-vnni";
+	case eAVXVNNI:
+		return "avx-vnni";
+	default:
+		break;
+	}
+
+	return "scalar";
+}
+
+size_t QuantizedMLP::bytes() const
+{
+	size_t size = 0;
+	for (const Layer &layer : layers) {
+		size_t elements = layer.rows * layer.cols;
+		if (precision == eFloat32)
+			size += 4 * elements;
+		else if (precision == eFloat16)
+			size += 2 * elements;
+		else
+			size += elements + 4 * layer.rows;
+
+		size += 4 * layer.rows;
+	}
+
+	return size;
+}
+
+// Same layout as MLP.stream() in ngf.py, except that every matrix carries
+// its precision tag, followed by the scales (int8 only) and the unpadded data
+py::bytes QuantizedMLP::stream() const
+{
+	std::string bytes;
+
+	auto write = [&](const void *data, size_t size) {
+		bytes.append((const char *) data, size);
+	};
+
+	for (const Layer &layer : layers) {
+		int32_t header[3] = { layer.rows, layer.cols, (int32_t) precision };
+		write(header, sizeof(header));
+
+		if (precision == eInt8)
+			write(layer.scales.data(), layer.rows * sizeof(float));
+
+		for (int32_t r = 0; r < layer.rows; r++) {
+			size_t offset = r * layer.stride;
+			if (precision == eFloat32)
+				write(&layer.weights[offset], layer.cols * sizeof(float));
+			else if (precision == eFloat16)
+				write(&layer.halves[offset], layer.cols * sizeof(uint16_t));
+			else
+				write(&layer.quantized[offset], layer.cols * sizeof(int8_t));
+		}
+	}
+
+	for (const Layer &layer : layers) {
+		write(&layer.rows, sizeof(int32_t));
+		write(layer.bias.data(), layer.rows * sizeof(float));
+	}
+
+	return py::bytes(bytes);
+}
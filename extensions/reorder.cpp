@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cfloat>
+#include <numeric>
+#include <stdexcept>
+
+#include <glm/glm.hpp>
+
+#include "common.hpp"
+
+// Bits per axis of the quantized patch centroids
+static constexpr uint32_t BITS = 10;
+
+static uint64_t morton(glm::uvec3 p)
+{
+	uint64_t key = 0;
+	for (int32_t b = BITS - 1; b >= 0; b--) {
+		for (int32_t i = 0; i < 3; i++)
+			key = (key << 1) | ((p[i] >> b) & 1);
+	}
+
+	return key;
+}
+
+// Skilling's transform of coordinates into the transposed Hilbert index,
+// whose bits are then interleaved like the Morton code
+static uint64_t hilbert(glm::uvec3 p)
+{
+	uint32_t M = 1u << (BITS - 1);
+
+	for (uint32_t Q = M; Q > 1; Q >>= 1) {
+		uint32_t P = Q - 1;
+		for (int32_t i = 0; i < 3; i++) {
+			if (p[i] & Q) {
+				p[0] ^= P;
+			} else {
+				uint32_t t = (p[0] ^ p[i]) & P;
+				p[0] ^= t;
+				p[i] ^= t;
+			}
+		}
+	}
+
+	// Gray encoding
+	for (int32_t i = 1; i < 3; i++)
+		p[i] ^= p[i - 1];
+
+	uint32_t t = 0;
+	for (uint32_t Q = M; Q > 1; Q >>= 1) {
+		if (p[2] & Q)
+			t ^= Q - 1;
+	}
+
+	for (int32_t i = 0; i < 3; i++)
+		p[i] ^= t;
+
+	return morton(p);
+}
+
+// Patch order along a space filling curve through the patch centroids, and
+// the new index of each vertex in the order the sorted patches first touch
+// them (unreferenced vertices go last, in their original order); applying
+// both only permutes the samples, so evaluations are otherwise unchanged
+std::tuple <torch::Tensor, torch::Tensor> spatial_order
+(const torch::Tensor &points, const torch::Tensor &complexes, const std::string &curve)
+{
+	if (curve != "morton" && curve != "hilbert")
+		throw std::invalid_argument("unknown curve " + curve + " (expected morton or hilbert)");
+
+	torch::Tensor P = points.detach().cpu().to(torch::kFloat32).contiguous();
+	torch::Tensor C = complexes.cpu().to(torch::kInt32).contiguous();
+
+	int64_t vertex_count = P.size(0);
+	int64_t patch_count = C.size(0);
+
+	const glm::vec3 *vertices = (const glm::vec3 *) P.data_ptr <float> ();
+	const glm::ivec4 *quads = (const glm::ivec4 *) C.data_ptr <int32_t> ();
+
+	std::vector <glm::vec3> centroids(patch_count);
+	glm::vec3 lo(FLT_MAX);
+	glm::vec3 hi(-FLT_MAX);
+
+	for (int64_t i = 0; i < patch_count; i++) {
+		const glm::ivec4 &q = quads[i];
+		centroids[i] = 0.25f * (vertices[q.x] + vertices[q.y] + vertices[q.z] + vertices[q.w]);
+		lo = glm::min(lo, centroids[i]);
+		hi = glm::max(hi, centroids[i]);
+	}
+
+	// Quantized over the longest side, so the curve cells stay cubes
+	glm::vec3 extent = hi - lo;
+	float scale = float((1u << BITS) - 1) / std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-12f));
+
+	std::vector <uint64_t> keys(patch_count);
+	for (int64_t i = 0; i < patch_count; i++) {
+		glm::uvec3 p = glm::uvec3((centroids[i] - lo) * scale + 0.5f);
+		keys[i] = (curve == "hilbert") ? hilbert(p) : morton(p);
+	}
+
+	std::vector <int64_t> order(patch_count);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(),
+		[&](int64_t a, int64_t b) {
+			return keys[a] < keys[b];
+		}
+	);
+
+	std::vector <int64_t> remap(vertex_count, -1);
+
+	int64_t next = 0;
+	for (int64_t i : order) {
+		const glm::ivec4 &q = quads[i];
+		for (int32_t k = 0; k < 4; k++) {
+			if (remap[q[k]] < 0)
+				remap[q[k]] = next++;
+		}
+	}
+
+	for (int64_t v = 0; v < vertex_count; v++) {
+		if (remap[v] < 0)
+			remap[v] = next++;
+	}
+
+	return {
+		vector_to_tensor <int64_t, torch::kInt64> (std::move(order)),
+		vector_to_tensor <int64_t, torch::kInt64> (std::move(remap))
+	};
+}
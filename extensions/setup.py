@@ -2,11 +2,16 @@ from setuptools import setup
 from torch.utils.cpp_extension import BuildExtension, CUDAExtension
 
 sources = [
+    'atlas.cpp',
     'cluster.cpp',
     'mesh.cpp',
     'ngfutil.cu',
     'parametrize.cpp',
+    'quantize.cpp',
+    'reorder.cpp',
+    'simplify.cpp',
     'smoothing.cu',
+    'texture.cpp',
     'triangulate.cu',
 ]
 
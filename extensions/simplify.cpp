@@ -0,0 +1,959 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <iterator>
+
+#include "common.hpp"
+#include "util.hpp"
+
+// Symmetric 4x4 quadric, stored as its upper triangle
+struct Quadric {
+	std::array <double, 10> q {};
+
+	static Quadric plane(const glm::dvec3 &n, double d, double w) {
+		Quadric Q;
+		Q.q = {
+			w * n.x * n.x, w * n.x * n.y, w * n.x * n.z, w * n.x * d,
+			w * n.y * n.y, w * n.y * n.z, w * n.y * d,
+			w * n.z * n.z, w * n.z * d,
+			w * d * d
+		};
+
+		return Q;
+	}
+
+	Quadric &operator+=(const Quadric &other) {
+		for (size_t i = 0; i < q.size(); i++)
+			q[i] += other.q[i];
+
+		return *this;
+	}
+
+	Quadric operator+(const Quadric &other) const {
+		Quadric result = *this;
+		return result += other;
+	}
+
+	double error(const glm::dvec3 &v) const {
+		double e = q[0] * v.x * v.x + 2 * q[1] * v.x * v.y + 2 * q[2] * v.x * v.z + 2 * q[3] * v.x
+			+ q[4] * v.y * v.y + 2 * q[5] * v.y * v.z + 2 * q[6] * v.y
+			+ q[7] * v.z * v.z + 2 * q[8] * v.z
+			+ q[9];
+
+		return std::max(e, 0.0);
+	}
+
+	// Minimizer of the error, unless the system is close to singular
+	bool optimum(glm::dvec3 &v) const {
+		glm::dmat3 A {
+			q[0], q[1], q[2],
+			q[1], q[4], q[5],
+			q[2], q[5], q[7]
+		};
+
+		double det = glm::determinant(A);
+		if (std::abs(det) < 1e-10)
+			return false;
+
+		v = -(glm::inverse(A) * glm::dvec3(q[3], q[6], q[8]));
+		return true;
+	}
+};
+
+// Candidate collapse of an edge, kept small since the heap is the bulk of the
+// memory traffic; stamps only grow, so their sum changes exactly when either
+// vertex has changed and the candidate is stale
+struct CollapseCandidate {
+	float cost;
+	int32_t u;
+	int32_t v;
+	uint32_t stamp;
+
+	bool operator<(const CollapseCandidate &other) const {
+		// Inverted for a min heap with the std heap functions
+		return cost > other.cost;
+	}
+};
+
+// Undirected edges as sorted keys with their face counts; sorting avoids the
+// collisions of hashing nearby index pairs
+static uint64_t edge_key(int32_t a, int32_t b)
+{
+	return (uint64_t(std::min(a, b)) << 32) | uint32_t(std::max(a, b));
+}
+
+static void sorted_edges(const std::vector <glm::ivec3> &triangles, std::vector <uint64_t> &edges, std::vector <int32_t> &counts)
+{
+	size_t nt = triangles.size();
+
+	std::vector <uint64_t> keys(3 * nt);
+	parallel_for(nt, 1 << 14, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const glm::ivec3 &t = triangles[i];
+			for (int32_t k = 0; k < 3; k++)
+				keys[3 * i + k] = edge_key(t[k], t[(k + 1) % 3]);
+		}
+	});
+
+	std::sort(keys.begin(), keys.end());
+
+	edges.clear();
+	counts.clear();
+	edges.reserve(keys.size() / 2);
+	counts.reserve(keys.size() / 2);
+	for (size_t i = 0; i < keys.size(); i++) {
+		if (edges.empty() || edges.back() != keys[i]) {
+			edges.push_back(keys[i]);
+			counts.push_back(0);
+		}
+
+		counts.back()++;
+	}
+}
+
+// Corner lists of each vertex, as offsets into a flat array of faces
+static void corner_lists(size_t nv, const std::vector <glm::ivec3> &triangles, std::vector <int32_t> &offsets, std::vector <int32_t> &corners)
+{
+	offsets.assign(nv + 1, 0);
+	for (const glm::ivec3 &t : triangles) {
+		for (int32_t k = 0; k < 3; k++)
+			offsets[t[k] + 1]++;
+	}
+
+	for (size_t i = 0; i < nv; i++)
+		offsets[i + 1] += offsets[i];
+
+	corners.resize(offsets.back());
+
+	std::vector <int32_t> cursor(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < triangles.size(); i++) {
+		for (int32_t k = 0; k < 3; k++)
+			corners[cursor[triangles[i][k]]++] = i;
+	}
+}
+
+// Mesh under greedy quadric error collapses; faces are only marked dead, and
+// edges at locked vertices are never collapsed, since their links may extend
+// past the mesh
+struct CollapseState {
+	std::vector <glm::dvec3> positions;
+	std::vector <glm::ivec3> triangles;
+	std::vector <Quadric> quadrics;
+	std::vector <uint8_t> boundary;
+	std::vector <uint8_t> locked;
+	std::vector <uint8_t> alive_face;
+	std::vector <uint8_t> alive_vertex;
+
+	// Face planes summed into vertex quadrics; boundary edges get
+	// perpendicular planes to hold the outline in place
+	void initialize() {
+		size_t nv = positions.size();
+		size_t nt = triangles.size();
+
+		std::vector <Quadric> planes(nt);
+		parallel_for(nt, 1 << 14, [&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				const glm::ivec3 &t = triangles[i];
+				const glm::dvec3 &p0 = positions[t.x];
+				glm::dvec3 n = glm::cross(positions[t.y] - p0, positions[t.z] - p0);
+
+				double length = glm::length(n);
+				if (length > 0.0) {
+					n /= length;
+					planes[i] = Quadric::plane(n, -glm::dot(n, p0), 1.0);
+				}
+			}
+		});
+
+		std::vector <int32_t> offsets;
+		std::vector <int32_t> corners;
+		corner_lists(nv, triangles, offsets, corners);
+
+		quadrics.assign(nv, Quadric());
+		parallel_for(nv, 1 << 14, [&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				for (int32_t c = offsets[i]; c < offsets[i + 1]; c++)
+					quadrics[i] += planes[corners[c]];
+			}
+		});
+
+		std::vector <uint64_t> edges;
+		std::vector <int32_t> counts;
+		sorted_edges(triangles, edges, counts);
+
+		boundary.assign(nv, false);
+		for (size_t i = 0; i < nt; i++) {
+			const glm::ivec3 &t = triangles[i];
+			for (int32_t k = 0; k < 3; k++) {
+				int32_t a = t[k];
+				int32_t b = t[(k + 1) % 3];
+
+				auto it = std::lower_bound(edges.begin(), edges.end(), edge_key(a, b));
+				if (counts[it - edges.begin()] != 1)
+					continue;
+
+				const glm::dvec3 &pa = positions[a];
+				const glm::dvec3 &pb = positions[b];
+				const glm::dvec3 &pc = positions[t[(k + 2) % 3]];
+
+				glm::dvec3 e = pb - pa;
+				glm::dvec3 fn = glm::cross(e, pc - pa);
+				glm::dvec3 n = glm::cross(e, fn);
+
+				double length = glm::length(n);
+				if (length <= 0.0)
+					continue;
+
+				n /= length;
+
+				Quadric Q = Quadric::plane(n, -glm::dot(n, pa), 10.0);
+				quadrics[a] += Q;
+				quadrics[b] += Q;
+				boundary[a] = true;
+				boundary[b] = true;
+			}
+		}
+
+		locked.assign(nv, false);
+	}
+
+	// Collapses the cheapest edges until at most the target number of
+	// triangles remain, or no collapse is valid; each one is reported as
+	// (kept, removed, position, live triangles, live vertices)
+	void collapse(int64_t target, const std::function <void (int32_t, int32_t, const glm::dvec3 &, int64_t, int64_t)> &record = nullptr) {
+		size_t nv = positions.size();
+		size_t nt = triangles.size();
+
+		std::vector <int32_t> offsets;
+		std::vector <int32_t> corners;
+		corner_lists(nv, triangles, offsets, corners);
+
+		std::vector <std::vector <int32_t>> faces(nv);
+		for (size_t i = 0; i < nv; i++)
+			faces[i].assign(corners.begin() + offsets[i], corners.begin() + offsets[i + 1]);
+
+		alive_face.assign(nt, true);
+		alive_vertex.assign(nv, false);
+
+		int64_t live_vertices = 0;
+		for (size_t i = 0; i < nv; i++) {
+			alive_vertex[i] = offsets[i + 1] > offsets[i];
+			live_vertices += alive_vertex[i];
+		}
+
+		int64_t live_triangles = nt;
+
+		std::vector <uint32_t> stamps(nv, 0);
+
+		// Live neighbors of a vertex, dropping dead faces from its list
+		auto neighbors = [&](int32_t v, std::vector <int32_t> &result) {
+			result.clear();
+
+			auto &list = faces[v];
+			list.erase(std::remove_if(list.begin(), list.end(),
+				[&](int32_t f) { return !alive_face[f]; }), list.end());
+
+			for (int32_t f : list) {
+				for (int32_t k = 0; k < 3; k++) {
+					if (triangles[f][k] != v)
+						result.push_back(triangles[f][k]);
+				}
+			}
+
+			std::sort(result.begin(), result.end());
+			result.erase(std::unique(result.begin(), result.end()), result.end());
+		};
+
+		auto placement = [&](int32_t u, int32_t v) {
+			Quadric Q = quadrics[u] + quadrics[v];
+
+			glm::dvec3 target;
+			if (!Q.optimum(target)) {
+				// Best of the endpoints and the midpoint
+				glm::dvec3 options[3] = { positions[u], positions[v], (positions[u] + positions[v]) / 2.0 };
+
+				target = options[0];
+				for (const glm::dvec3 &o : options) {
+					if (Q.error(o) < Q.error(target))
+						target = o;
+				}
+			}
+
+			return std::make_pair(target, Q.error(target));
+		};
+
+		auto candidate = [&](int32_t u, int32_t v) {
+			auto [_, cost] = placement(u, v);
+			return CollapseCandidate { float(cost), u, v, stamps[u] + stamps[v] };
+		};
+
+		std::vector <uint64_t> edges;
+		std::vector <int32_t> counts;
+		sorted_edges(triangles, edges, counts);
+
+		edges.erase(std::remove_if(edges.begin(), edges.end(), [&](uint64_t e) {
+			return locked[e >> 32] || locked[e & 0xFFFFFFFFu];
+		}), edges.end());
+
+		// Flat binary heap with lazy deletion; initial costs in parallel
+		std::vector <CollapseCandidate> heap(edges.size());
+		parallel_for(edges.size(), 1 << 14, [&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				heap[i] = candidate(edges[i] >> 32, edges[i] & 0xFFFFFFFFu);
+		});
+
+		std::make_heap(heap.begin(), heap.end());
+
+		// Moving v onto u must keep the link manifold and flip no faces
+		std::vector <int32_t> ring_u;
+		std::vector <int32_t> ring_v;
+		std::vector <int32_t> common;
+
+		auto valid = [&](const CollapseCandidate &c, const glm::dvec3 &target) {
+			int32_t u = c.u;
+			int32_t v = c.v;
+
+			neighbors(u, ring_u);
+			neighbors(v, ring_v);
+
+			common.clear();
+			std::set_intersection(ring_u.begin(), ring_u.end(), ring_v.begin(), ring_v.end(), std::back_inserter(common));
+
+			int32_t shared = 0;
+			for (int32_t f : faces[v]) {
+				const glm::ivec3 &t = triangles[f];
+				shared += (t.x == u || t.y == u || t.z == u);
+			}
+
+			if (shared == 0 || int32_t(common.size()) != shared)
+				return false;
+
+			// An interior edge between two boundary vertices would pinch the mesh
+			if (shared == 2 && boundary[u] && boundary[v])
+				return false;
+
+			for (int32_t w : { u, v }) {
+				for (int32_t f : faces[w]) {
+					const glm::ivec3 &t = triangles[f];
+					if ((t.x == u || t.y == u || t.z == u) && (t.x == v || t.y == v || t.z == v))
+						continue;
+
+					glm::dvec3 p[3] = { positions[t.x], positions[t.y], positions[t.z] };
+					glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+
+					for (int32_t k = 0; k < 3; k++) {
+						if (t[k] == w)
+							p[k] = target;
+					}
+
+					glm::dvec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+					if (glm::dot(before, after) <= 0.0)
+						return false;
+				}
+			}
+
+			return true;
+		};
+
+		while (!heap.empty() && live_triangles > target) {
+			std::pop_heap(heap.begin(), heap.end());
+			CollapseCandidate c = heap.back();
+			heap.pop_back();
+
+			if (!alive_vertex[c.u] || !alive_vertex[c.v])
+				continue;
+
+			if (stamps[c.u] + stamps[c.v] != c.stamp)
+				continue;
+
+			glm::dvec3 target = placement(c.u, c.v).first;
+			if (!valid(c, target))
+				continue;
+
+			int32_t u = c.u;
+			int32_t v = c.v;
+
+			// Faces on the edge disappear, the others move over to u
+			for (int32_t f : faces[v]) {
+				glm::ivec3 &t = triangles[f];
+				if (t.x == u || t.y == u || t.z == u) {
+					alive_face[f] = false;
+					live_triangles--;
+				} else {
+					for (int32_t k = 0; k < 3; k++) {
+						if (t[k] == v)
+							t[k] = u;
+					}
+
+					faces[u].push_back(f);
+				}
+			}
+
+			faces[v].clear();
+			faces[v].shrink_to_fit();
+
+			positions[u] = target;
+			quadrics[u] += quadrics[v];
+			boundary[u] = boundary[u] || boundary[v];
+			alive_vertex[v] = false;
+			stamps[u]++;
+			live_vertices--;
+
+			if (record)
+				record(u, v, target, live_triangles, live_vertices);
+
+			neighbors(u, ring_u);
+			for (int32_t w : ring_u) {
+				if (locked[w])
+					continue;
+
+				heap.push_back(candidate(u, w));
+				std::push_heap(heap.begin(), heap.end());
+			}
+		}
+	}
+};
+
+ProgressiveMesh::ProgressiveMesh(const torch::Tensor &tch_vertices, const torch::Tensor &tch_triangles)
+{
+	tensor_check <torch::kCPU, torch::kFloat32, 3> (tch_vertices);
+	tensor_check <torch::kCPU, torch::kInt32, 3>   (tch_triangles);
+
+	vertices = tensor_to_vector <glm::vec3> (tch_vertices);
+	triangles = tensor_to_vector <glm::ivec3> (tch_triangles);
+
+	std::vector <uint8_t> used(vertices.size(), false);
+	for (const glm::ivec3 &t : triangles)
+		used[t.x] = used[t.y] = used[t.z] = true;
+
+	triangle_counts.push_back(triangles.size());
+	vertex_counts.push_back(std::count(used.begin(), used.end(), true));
+
+	CollapseState state;
+	state.positions.assign(vertices.begin(), vertices.end());
+	state.triangles = triangles;
+	state.initialize();
+
+	state.collapse(0, [&](int32_t u, int32_t v, const glm::dvec3 &target, int64_t live_triangles, int64_t live_vertices) {
+		collapses.push_back({ u, v, glm::vec3(target) });
+		triangle_counts.push_back(live_triangles);
+		vertex_counts.push_back(live_vertices);
+	});
+}
+
+// Fewest collapses reaching at most the given number of triangles
+size_t ProgressiveMesh::steps_for_triangles(int64_t count) const
+{
+	auto it = std::lower_bound(triangle_counts.begin(), triangle_counts.end(), count, std::greater <int64_t> ());
+	return std::min(size_t(it - triangle_counts.begin()), collapses.size());
+}
+
+// Fewest collapses reaching at most the given size, with fp32 vertices and
+// int32 triangles as mesh_size counts them
+size_t ProgressiveMesh::steps_for_bytes(int64_t bytes) const
+{
+	auto size = [&](size_t i) {
+		return int64_t(sizeof(glm::vec3)) * vertex_counts[i] + int64_t(sizeof(glm::ivec3)) * triangle_counts[i];
+	};
+
+	size_t low = 0;
+	size_t high = collapses.size();
+	while (low < high) {
+		size_t mid = (low + high) / 2;
+		if (size(mid) <= bytes)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+
+	return low;
+}
+
+// Applies the first steps of the collapse sequence in a single pass
+std::tuple <torch::Tensor, torch::Tensor> ProgressiveMesh::extract(size_t steps) const
+{
+	steps = std::min(steps, collapses.size());
+
+	std::vector <glm::vec3> positions = vertices;
+	for (size_t i = 0; i < steps; i++)
+		positions[collapses[i].kept] = collapses[i].position;
+
+	// In reverse, the survivor of a kept vertex is already final
+	std::vector <int32_t> survivor(vertices.size());
+	for (size_t i = 0; i < survivor.size(); i++)
+		survivor[i] = i;
+
+	for (size_t i = steps; i-- > 0; )
+		survivor[collapses[i].removed] = survivor[collapses[i].kept];
+
+	// Remapped triangles, dropping the collapsed ones, counted per chunk so
+	// that the chunks can be written in order
+	size_t nt = triangles.size();
+	size_t chunks = std::max(1u, std::thread::hardware_concurrency());
+
+	std::vector <glm::ivec3> remapped(nt);
+	std::vector <uint8_t> keep(nt);
+	std::vector <size_t> counts(chunks + 1, 0);
+
+	parallel_for(chunks, 1, [&](size_t, size_t begin, size_t end) {
+		for (size_t c = begin; c < end; c++) {
+			for (size_t i = nt * c / chunks; i < nt * (c + 1) / chunks; i++) {
+				const glm::ivec3 &t = triangles[i];
+				glm::ivec3 r { survivor[t.x], survivor[t.y], survivor[t.z] };
+				remapped[i] = r;
+				keep[i] = (r.x != r.y && r.y != r.z && r.z != r.x);
+				counts[c + 1] += keep[i];
+			}
+		}
+	});
+
+	for (size_t c = 0; c < chunks; c++)
+		counts[c + 1] += counts[c];
+
+	std::vector <int32_t> index(vertices.size(), -1);
+	for (size_t i = 0; i < nt; i++) {
+		if (!keep[i])
+			continue;
+
+		for (int32_t k = 0; k < 3; k++)
+			index[remapped[i][k]] = 0;
+	}
+
+	int32_t used = 0;
+	for (int32_t &i : index) {
+		if (i == 0)
+			i = used++;
+	}
+
+	auto floats = torch::TensorOptions().dtype(torch::kFloat32);
+	auto ints = torch::TensorOptions().dtype(torch::kInt32);
+
+	torch::Tensor tch_vertices = torch::empty({ (long) used, 3 }, floats);
+	torch::Tensor tch_triangles = torch::empty({ (long) counts[chunks], 3 }, ints);
+
+	glm::vec3 *V = (glm::vec3 *) tch_vertices.data_ptr <float> ();
+	glm::ivec3 *T = (glm::ivec3 *) tch_triangles.data_ptr <int32_t> ();
+
+	parallel_for(vertices.size(), 1 << 16, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			if (index[i] >= 0)
+				V[index[i]] = positions[i];
+		}
+	});
+
+	parallel_for(chunks, 1, [&](size_t, size_t begin, size_t end) {
+		for (size_t c = begin; c < end; c++) {
+			size_t out = counts[c];
+			for (size_t i = nt * c / chunks; i < nt * (c + 1) / chunks; i++) {
+				if (keep[i]) {
+					const glm::ivec3 &r = remapped[i];
+					T[out++] = { index[r.x], index[r.y], index[r.z] };
+				}
+			}
+		}
+	});
+
+	return { tch_vertices, tch_triangles };
+}
+
+std::tuple <torch::Tensor, torch::Tensor> ProgressiveMesh::extract_triangles(int64_t count) const
+{
+	return extract(steps_for_triangles(count));
+}
+
+std::tuple <torch::Tensor, torch::Tensor> ProgressiveMesh::extract_bytes(int64_t bytes) const
+{
+	return extract(steps_for_bytes(bytes));
+}
+
+// Keeps the vertices referenced by the triangles, renumbered in order of
+// their original indices; returns the original index of each kept vertex
+static std::vector <int32_t> compact(std::vector <glm::ivec3> &triangles, size_t nv)
+{
+	std::vector <int32_t> index(nv, -1);
+	for (const glm::ivec3 &t : triangles)
+		index[t.x] = index[t.y] = index[t.z] = 0;
+
+	std::vector <int32_t> kept;
+	for (size_t i = 0; i < nv; i++) {
+		if (index[i] == 0) {
+			index[i] = kept.size();
+			kept.push_back(i);
+		}
+	}
+
+	for (glm::ivec3 &t : triangles)
+		t = { index[t.x], index[t.y], index[t.z] };
+
+	return kept;
+}
+
+// Collapses within spatial charts in parallel, down to about the target
+// number of triangles overall. Charts are balanced median splits of the face
+// centroids; vertices shared by several charts are locked so that the charts
+// stay stitched, and left for a later pass over the whole mesh. Returns the
+// surviving triangles, with the positions, quadrics and boundary flags of the
+// state updated in place
+static std::vector <glm::ivec3> collapse_charts(CollapseState &state, int64_t target, size_t chart_size)
+{
+	size_t nv = state.positions.size();
+	size_t nt = state.triangles.size();
+
+	std::vector <glm::dvec3> centroids(nt);
+	parallel_for(nt, 1 << 14, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const glm::ivec3 &t = state.triangles[i];
+			centroids[i] = (state.positions[t.x] + state.positions[t.y] + state.positions[t.z]) / 3.0;
+		}
+	});
+
+	std::vector <int32_t> order(nt);
+	for (size_t i = 0; i < nt; i++)
+		order[i] = i;
+
+	std::vector <std::pair <size_t, size_t>> charts;
+
+	std::function <void (size_t, size_t)> split = [&](size_t begin, size_t end) {
+		if (end - begin <= chart_size) {
+			charts.emplace_back(begin, end);
+			return;
+		}
+
+		glm::dvec3 min = centroids[order[begin]];
+		glm::dvec3 max = min;
+		for (size_t i = begin; i < end; i++) {
+			min = glm::min(min, centroids[order[i]]);
+			max = glm::max(max, centroids[order[i]]);
+		}
+
+		glm::dvec3 extent = max - min;
+
+		int32_t axis = 0;
+		if (extent.y > extent[axis])
+			axis = 1;
+		if (extent.z > extent[axis])
+			axis = 2;
+
+		size_t mid = (begin + end) / 2;
+		std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+			[&](int32_t a, int32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+		split(begin, mid);
+		split(mid, end);
+	};
+
+	split(0, nt);
+
+	std::vector <int32_t> chart_of(nt);
+	for (size_t c = 0; c < charts.size(); c++) {
+		for (size_t i = charts[c].first; i < charts[c].second; i++)
+			chart_of[order[i]] = c;
+	}
+
+	std::vector <int32_t> owner(nv, -1);
+	std::vector <uint8_t> locked(nv, false);
+	for (size_t i = 0; i < nt; i++) {
+		for (int32_t k = 0; k < 3; k++) {
+			int32_t v = state.triangles[i][k];
+			if (owner[v] == -1)
+				owner[v] = chart_of[i];
+			else if (owner[v] != chart_of[i])
+				locked[v] = true;
+		}
+	}
+
+	// Unlocked vertices belong to a single chart and are only written by its
+	// worker, while locked ones are left untouched
+	std::vector <std::vector <glm::ivec3>> survivors(charts.size());
+
+	parallel_for(charts.size(), 1, [&](size_t, size_t begin, size_t end) {
+		for (size_t c = begin; c < end; c++) {
+			auto [first, last] = charts[c];
+
+			std::vector <glm::ivec3> triangles(last - first);
+			for (size_t i = first; i < last; i++)
+				triangles[i - first] = state.triangles[order[i]];
+
+			std::vector <int32_t> globals = compact(triangles, nv);
+
+			CollapseState local;
+			local.triangles = std::move(triangles);
+			for (int32_t g : globals) {
+				local.positions.push_back(state.positions[g]);
+				local.quadrics.push_back(state.quadrics[g]);
+				local.boundary.push_back(state.boundary[g]);
+				local.locked.push_back(locked[g]);
+			}
+
+			local.collapse(int64_t(last - first) * target / int64_t(nt));
+
+			for (size_t i = 0; i < globals.size(); i++) {
+				if (!local.alive_vertex[i])
+					continue;
+
+				int32_t g = globals[i];
+				if (!locked[g]) {
+					state.positions[g] = local.positions[i];
+					state.quadrics[g] = local.quadrics[i];
+					state.boundary[g] = local.boundary[i];
+				}
+			}
+
+			for (size_t i = 0; i < local.triangles.size(); i++) {
+				if (!local.alive_face[i])
+					continue;
+
+				const glm::ivec3 &t = local.triangles[i];
+				survivors[c].push_back({ globals[t.x], globals[t.y], globals[t.z] });
+			}
+		}
+	});
+
+	std::vector <glm::ivec3> result;
+	for (size_t c = 0; c < charts.size(); c++)
+		result.insert(result.end(), survivors[c].begin(), survivors[c].end());
+
+	return result;
+}
+
+// Greedy matching of adjacent triangles into convex quads, best shaped and
+// flattest first; returns the quads, in the orientation of the triangles, and
+// the unmatched triangles
+static void pair_triangles(const std::vector <glm::dvec3> &positions, const std::vector <glm::ivec3> &triangles,
+		std::vector <glm::ivec4> &quads, std::vector <glm::ivec3> &singles)
+{
+	size_t nt = triangles.size();
+
+	struct HalfEdge {
+		uint64_t key;
+		int32_t face;
+		int32_t corner;
+
+		bool operator<(const HalfEdge &other) const {
+			return key < other.key;
+		}
+	};
+
+	std::vector <HalfEdge> halfedges(3 * nt);
+	for (size_t i = 0; i < nt; i++) {
+		for (int32_t k = 0; k < 3; k++)
+			halfedges[3 * i + k] = { edge_key(triangles[i][k], triangles[i][(k + 1) % 3]), int32_t(i), k };
+	}
+
+	std::sort(halfedges.begin(), halfedges.end());
+
+	auto normal = [&](const glm::ivec3 &t) {
+		glm::dvec3 n = glm::cross(positions[t.y] - positions[t.x], positions[t.z] - positions[t.x]);
+		double length = glm::length(n);
+		return length > 0.0 ? n / length : n;
+	};
+
+	struct Pairing {
+		double score;
+		glm::ivec4 quad;
+		int32_t f0;
+		int32_t f1;
+	};
+
+	std::vector <Pairing> pairings;
+	for (size_t i = 0; i + 1 < halfedges.size(); ) {
+		size_t j = i;
+		while (j < halfedges.size() && halfedges[j].key == halfedges[i].key)
+			j++;
+
+		// Manifold interior edges only, consistently oriented
+		if (j - i == 2) {
+			const HalfEdge &h0 = halfedges[i];
+			const HalfEdge &h1 = halfedges[i + 1];
+
+			const glm::ivec3 &t0 = triangles[h0.face];
+			const glm::ivec3 &t1 = triangles[h1.face];
+
+			int32_t a = t0[h0.corner];
+			int32_t b = t0[(h0.corner + 1) % 3];
+			int32_t c = t0[(h0.corner + 2) % 3];
+			int32_t d = t1[(h1.corner + 2) % 3];
+
+			if (t1[h1.corner] == b && t1[(h1.corner + 1) % 3] == a) {
+				glm::dvec3 n0 = normal(t0);
+				glm::dvec3 n1 = normal(t1);
+				double flatness = glm::dot(n0, n1);
+
+				glm::ivec4 quad { b, c, a, d };
+				glm::dvec3 n = n0 + n1;
+
+				bool convex = true;
+				double skew = 0.0;
+				for (int32_t k = 0; k < 4; k++) {
+					glm::dvec3 p = positions[quad[k]];
+					glm::dvec3 e0 = positions[quad[(k + 1) % 4]] - p;
+					glm::dvec3 e1 = positions[quad[(k + 3) % 4]] - p;
+
+					double l0 = glm::length(e0);
+					double l1 = glm::length(e1);
+					if (l0 <= 0.0 || l1 <= 0.0 || glm::dot(glm::cross(e0, e1), n) <= 0.0) {
+						convex = false;
+						break;
+					}
+
+					skew += std::abs(glm::dot(e0, e1)) / (l0 * l1);
+				}
+
+				// Folds sharper than 60 degrees stay as triangles
+				if (convex && flatness > 0.5)
+					pairings.push_back({ skew / 4.0 + (1.0 - flatness), quad, h0.face, h1.face });
+			}
+		}
+
+		i = j;
+	}
+
+	std::sort(pairings.begin(), pairings.end(), [](const Pairing &a, const Pairing &b) {
+		return a.score < b.score;
+	});
+
+	std::vector <uint8_t> matched(nt, false);
+	for (const Pairing &p : pairings) {
+		if (matched[p.f0] || matched[p.f1])
+			continue;
+
+		matched[p.f0] = matched[p.f1] = true;
+		quads.push_back(p.quad);
+	}
+
+	for (size_t i = 0; i < nt; i++) {
+		if (!matched[i])
+			singles.push_back(triangles[i]);
+	}
+}
+
+// Quad patch layout of a triangle mesh with about the given number of
+// patches. The mesh is collapsed to half as many triangles, first within
+// charts in parallel and then as a whole; adjacent triangles are paired into
+// quads and one step of midpoint subdivision turns each quad into four patches
+// and each unpaired triangle into three, so that the layout is all quads and
+// as manifold as the input. Returns the points and complexes (Q x 4)
+std::tuple <torch::Tensor, torch::Tensor> quadrangulate(const torch::Tensor &tch_vertices, const torch::Tensor &tch_triangles, int64_t patches)
+{
+	tensor_check <torch::kCPU, torch::kFloat32, 3> (tch_vertices);
+	tensor_check <torch::kCPU, torch::kInt32, 3>   (tch_triangles);
+
+	torch::Tensor cv = tch_vertices.contiguous();
+	torch::Tensor ct = tch_triangles.contiguous();
+
+	const glm::vec3 *V = (const glm::vec3 *) cv.data_ptr <float> ();
+	const glm::ivec3 *F = (const glm::ivec3 *) ct.data_ptr <int32_t> ();
+
+	CollapseState state;
+	state.positions.assign(V, V + cv.size(0));
+	state.triangles.assign(F, F + ct.size(0));
+	state.initialize();
+
+	int64_t target = std::max(patches / 2, int64_t(1));
+
+	// Charts stop well short of the target, since their budgets are spread by
+	// area rather than by error, and only pay off when they leave the final
+	// pass a fraction of the work
+	constexpr size_t chart_size = 1 << 15;
+
+	std::vector <glm::ivec3> remaining = state.triangles;
+	if (remaining.size() > 2 * chart_size && int64_t(remaining.size()) > 128 * target)
+		remaining = collapse_charts(state, 32 * target, chart_size);
+
+	std::vector <int32_t> kept = compact(remaining, state.positions.size());
+
+	CollapseState whole;
+	whole.triangles = std::move(remaining);
+	for (int32_t i : kept) {
+		whole.positions.push_back(state.positions[i]);
+		whole.quadrics.push_back(state.quadrics[i]);
+		whole.boundary.push_back(state.boundary[i]);
+	}
+
+	whole.locked.assign(kept.size(), false);
+	whole.collapse(target);
+
+	std::vector <glm::ivec3> triangles;
+	for (size_t i = 0; i < whole.triangles.size(); i++) {
+		if (whole.alive_face[i])
+			triangles.push_back(whole.triangles[i]);
+	}
+
+	kept = compact(triangles, whole.positions.size());
+
+	std::vector <glm::dvec3> positions;
+	for (int32_t i : kept)
+		positions.push_back(whole.positions[i]);
+
+	std::vector <glm::ivec4> quads;
+	std::vector <glm::ivec3> singles;
+	pair_triangles(positions, triangles, quads, singles);
+
+	// Midpoints of the polygon edges, then the polygon centers
+	std::vector <uint64_t> edges;
+	for (const glm::ivec4 &q : quads) {
+		for (int32_t k = 0; k < 4; k++)
+			edges.push_back(edge_key(q[k], q[(k + 1) % 4]));
+	}
+
+	for (const glm::ivec3 &t : singles) {
+		for (int32_t k = 0; k < 3; k++)
+			edges.push_back(edge_key(t[k], t[(k + 1) % 3]));
+	}
+
+	std::sort(edges.begin(), edges.end());
+	edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+	size_t nv = positions.size();
+	size_t ne = edges.size();
+	size_t np = quads.size() + singles.size();
+	size_t patch_count = 4 * quads.size() + 3 * singles.size();
+
+	auto floats = torch::TensorOptions().dtype(torch::kFloat32);
+	auto ints = torch::TensorOptions().dtype(torch::kInt32);
+
+	torch::Tensor points = torch::empty({ (long) (nv + ne + np), 3 }, floats);
+	torch::Tensor complexes = torch::empty({ (long) patch_count, 4 }, ints);
+
+	glm::vec3 *P = (glm::vec3 *) points.data_ptr <float> ();
+	glm::ivec4 *C = (glm::ivec4 *) complexes.data_ptr <int32_t> ();
+
+	for (size_t i = 0; i < nv; i++)
+		P[i] = positions[i];
+
+	for (size_t i = 0; i < ne; i++)
+		P[nv + i] = (positions[edges[i] >> 32] + positions[edges[i] & 0xFFFFFFFFu]) / 2.0;
+
+	auto midpoint = [&](int32_t a, int32_t b) {
+		return int32_t(nv + (std::lower_bound(edges.begin(), edges.end(), edge_key(a, b)) - edges.begin()));
+	};
+
+	// Corner i of a polygon becomes the patch (i, i + 1/2, center, i - 1/2)
+	size_t polygon = 0;
+	size_t patch = 0;
+
+	auto subdivide = [&](const int32_t *corners, int32_t n) {
+		int32_t center = nv + ne + polygon++;
+
+		glm::dvec3 sum(0.0);
+		for (int32_t k = 0; k < n; k++)
+			sum += positions[corners[k]];
+
+		P[center] = sum / double(n);
+
+		for (int32_t k = 0; k < n; k++) {
+			int32_t prev = corners[(k + n - 1) % n];
+			int32_t next = corners[(k + 1) % n];
+			C[patch++] = { corners[k], midpoint(corners[k], next), center, midpoint(prev, corners[k]) };
+		}
+	};
+
+	for (const glm::ivec4 &q : quads)
+		subdivide(&q[0], 4);
+
+	for (const glm::ivec3 &t : singles)
+		subdivide(&t[0], 3);
+
+	return { points, complexes };
+}
@@ -0,0 +1,199 @@
+#include <algorithm>
+
+#include "common.hpp"
+
+// Bilinear footprints of a run of samples, with indices relative to the
+// texels of their complex; restricted output streams let the loop vectorize
+static void bilinear_footprints
+(
+	const float *__restrict__ u,
+	const float *__restrict__ v,
+	int32_t samples,
+	int32_t resx,
+	int32_t resy,
+	int32_t *__restrict__ i00,
+	int32_t *__restrict__ i10,
+	int32_t *__restrict__ i01,
+	int32_t *__restrict__ i11,
+	float *__restrict__ w00,
+	float *__restrict__ w10,
+	float *__restrict__ w01,
+	float *__restrict__ w11
+)
+{
+	for (int32_t i = 0; i < samples; i++) {
+		float su = std::min(std::max(u[i], 0.0f), 1.0f) * (resx - 1);
+		float sv = std::min(std::max(v[i], 0.0f), 1.0f) * (resy - 1);
+
+		int32_t iu0 = std::min(int32_t(su), resx - 1);
+		int32_t iv0 = std::min(int32_t(sv), resy - 1);
+		int32_t iu1 = std::min(iu0 + 1, resx - 1);
+		int32_t iv1 = std::min(iv0 + 1, resy - 1);
+
+		su -= iu0;
+		sv -= iv0;
+
+		i00[i] = iu0 * resy + iv0;
+		i10[i] = iu1 * resy + iv0;
+		i01[i] = iu0 * resy + iv1;
+		i11[i] = iu1 * resy + iv1;
+
+		w00[i] = (1 - su) * (1 - sv);
+		w10[i] = su * (1 - sv);
+		w01[i] = (1 - su) * sv;
+		w11[i] = su * sv;
+	}
+}
+
+// Footprints of the samples of one complex, as structure of arrays
+struct TexelFootprints {
+	std::vector <int32_t> i00;
+	std::vector <int32_t> i10;
+	std::vector <int32_t> i01;
+	std::vector <int32_t> i11;
+
+	std::vector <float> w00;
+	std::vector <float> w10;
+	std::vector <float> w01;
+	std::vector <float> w11;
+
+	TexelFootprints(int32_t samples)
+		: i00(samples), i10(samples), i01(samples), i11(samples),
+		w00(samples), w10(samples), w01(samples), w11(samples) {}
+
+	void compute(const float *u, const float *v, int32_t samples, int32_t resx, int32_t resy) {
+		bilinear_footprints(u, v, samples, resx, resy,
+			i00.data(), i10.data(), i01.data(), i11.data(),
+			w00.data(), w10.data(), w01.data(), w11.data());
+	}
+};
+
+torch::Tensor ngf_texture_fetch_forward_cpu
+(
+	const torch::Tensor &map,
+	const torch::Tensor &u,
+	const torch::Tensor &v,
+	int32_t complexes,
+	int32_t resx,
+	int32_t resy,
+	int32_t rate
+)
+{
+	assert(map.is_cpu() && u.is_cpu() && v.is_cpu());
+
+	assert(map.dtype() == torch::kFloat32);
+	assert(u.dtype() == torch::kFloat32);
+	assert(v.dtype() == torch::kFloat32);
+
+	assert(map.dim() == 4);
+	assert(u.dim() == 2);
+	assert(v.dim() == 2);
+
+	torch::Tensor cmap = map.contiguous();
+	torch::Tensor cu = u.contiguous();
+	torch::Tensor cv = v.contiguous();
+
+	torch::Tensor result = torch::zeros({ u.numel(), 3 }, torch::kFloat32);
+
+	const float *pmap = cmap.data_ptr <float> ();
+	const float *pu = cu.data_ptr <float> ();
+	const float *pv = cv.data_ptr <float> ();
+	float *presult = result.data_ptr <float> ();
+
+	int32_t samples = rate * rate;
+	int32_t texels = resx * resy;
+
+	parallel_for(complexes, 16, [&](size_t, size_t begin, size_t end) {
+		TexelFootprints footprints(samples);
+
+		for (size_t ci = begin; ci < end; ci++) {
+			footprints.compute(pu + ci * samples, pv + ci * samples, samples, resx, resy);
+
+			const float *texture = pmap + 3 * ci * texels;
+			float *colors = presult + 3 * ci * samples;
+
+			for (int32_t i = 0; i < samples; i++) {
+				const float *t00 = texture + 3 * footprints.i00[i];
+				const float *t10 = texture + 3 * footprints.i10[i];
+				const float *t01 = texture + 3 * footprints.i01[i];
+				const float *t11 = texture + 3 * footprints.i11[i];
+
+				for (int32_t c = 0; c < 3; c++) {
+					colors[3 * i + c] = t00[c] * footprints.w00[i]
+						+ t10[c] * footprints.w10[i]
+						+ t01[c] * footprints.w01[i]
+						+ t11[c] * footprints.w11[i];
+				}
+			}
+		}
+	});
+
+	return result;
+}
+
+// Samples are grouped by complex and only touch the texels of their complex,
+// so the gradient reduces over one segment per complex; each segment is
+// summed in sample order, which keeps the result independent of threading
+torch::Tensor ngf_texture_fetch_backward_cpu
+(
+	const torch::Tensor &d_color,
+	const torch::Tensor &u,
+	const torch::Tensor &v,
+	int32_t complexes,
+	int32_t resx,
+	int32_t resy,
+	int32_t rate
+)
+{
+	assert(d_color.is_cpu() && u.is_cpu() && v.is_cpu());
+
+	assert(d_color.dtype() == torch::kFloat32);
+	assert(u.dtype() == torch::kFloat32);
+	assert(v.dtype() == torch::kFloat32);
+
+	assert(d_color.dim() == 2);
+	assert(u.dim() == 2);
+	assert(v.dim() == 2);
+
+	torch::Tensor cd = d_color.contiguous();
+	torch::Tensor cu = u.contiguous();
+	torch::Tensor cv = v.contiguous();
+
+	torch::Tensor result = torch::zeros({ complexes, resx, resy, 3 }, torch::kFloat32);
+
+	const float *pd = cd.data_ptr <float> ();
+	const float *pu = cu.data_ptr <float> ();
+	const float *pv = cv.data_ptr <float> ();
+	float *presult = result.data_ptr <float> ();
+
+	int32_t samples = rate * rate;
+	int32_t texels = resx * resy;
+
+	parallel_for(complexes, 16, [&](size_t, size_t begin, size_t end) {
+		TexelFootprints footprints(samples);
+
+		for (size_t ci = begin; ci < end; ci++) {
+			footprints.compute(pu + ci * samples, pv + ci * samples, samples, resx, resy);
+
+			const float *grads = pd + 3 * ci * samples;
+			float *texture = presult + 3 * ci * texels;
+
+			for (int32_t i = 0; i < samples; i++) {
+				float *t00 = texture + 3 * footprints.i00[i];
+				float *t10 = texture + 3 * footprints.i10[i];
+				float *t01 = texture + 3 * footprints.i01[i];
+				float *t11 = texture + 3 * footprints.i11[i];
+
+				for (int32_t c = 0; c < 3; c++) {
+					float g = grads[3 * i + c];
+					t00[c] += g * footprints.w00[i];
+					t10[c] += g * footprints.w10[i];
+					t01[c] += g * footprints.w01[i];
+					t11[c] += g * footprints.w11[i];
+				}
+			}
+		}
+	});
+
+	return result;
+}
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
 #include <torch/extension.h>
 
 template <torch::DeviceType device, torch::ScalarType type, size_t components>
@@ -11,15 +17,70 @@ inline void tensor_check(const torch::Tensor &tensor)
 	assert(tensor.size(1) == components);
 }
 
+// Conversions between glm containers and tensors, which share the same layout
+// of packed rows; vectors are moved into or viewed by tensors rather than
+// copied, and copying a tensor into a vector is the only copy
+
+// Tensor taking over the storage of a vector, released with the tensor
 template <typename T, torch::ScalarType type, size_t components>
-torch::Tensor vector_to_tensor(const std::vector <T> &data)
+torch::Tensor vector_to_tensor(std::vector <T> &&data)
 {
+	auto owner = new std::vector <T> (std::move(data));
 	auto options = torch::TensorOptions().dtype(type).device(torch::kCPU, 0);
 
-	torch::Tensor tch = torch::zeros({ (long) data.size(), components }, options);
+	return torch::from_blob(owner->data(),
+		{ (long) owner->size(), (long) components },
+		[owner](void *) { delete owner; },
+		options);
+}
+
+template <typename T, torch::ScalarType type>
+torch::Tensor vector_to_tensor(std::vector <T> &&data)
+{
+	auto owner = new std::vector <T> (std::move(data));
+	auto options = torch::TensorOptions().dtype(type).device(torch::kCPU, 0);
+
+	return torch::from_blob(owner->data(),
+		{ (long) owner->size() },
+		[owner](void *) { delete owner; },
+		options);
+}
+
+// Tensor aliasing a vector, which must outlive it and not be resized
+template <typename T, torch::ScalarType type, size_t components>
+torch::Tensor vector_view(const std::vector <T> &data)
+{
+	auto options = torch::TensorOptions().dtype(type).device(torch::kCPU, 0);
+	return torch::from_blob((void *) data.data(), { (long) data.size(), (long) components }, options);
+}
+
+template <typename T>
+std::vector <T> tensor_to_vector(const torch::Tensor &tensor)
+{
+	torch::Tensor contiguous = tensor.contiguous();
+
+	size_t bytes = contiguous.numel() * contiguous.element_size();
+	assert(bytes % sizeof(T) == 0);
+
+	std::vector <T> data(bytes / sizeof(T));
+	std::memcpy(data.data(), contiguous.data_ptr(), bytes);
+
+	return data;
+}
+
+// Splits [0, count) over the hardware threads, with at least grain items each
+inline void parallel_for(size_t count, size_t grain, const std::function <void (size_t, size_t, size_t)> &body)
+{
+	size_t threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::max(size_t(1), std::min(threads, count / std::max(grain, size_t(1))));
 
-	void *raw = tch.data_ptr();
-	std::memcpy(raw, data.data(), sizeof(T) * data.size());
+	std::vector <std::thread> workers;
+	for (size_t t = 0; t < threads; t++) {
+		size_t begin = count * t / threads;
+		size_t end = count * (t + 1) / threads;
+		workers.emplace_back(body, t, begin, end);
+	}
 
-	return tch;
+	for (auto &worker : workers)
+		worker.join();
 }
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+#include "bounds.hpp"
+#include "microlog.h"
+
+// Single threaded evaluation of the network, in the same input order as
+// ngf.mesh; the weights are transposed so that each input scales a
+// contiguous column, which the compiler vectorizes
+struct CPUEvaluator {
+	const NGF &ngf;
+	uint32_t levels;
+
+	std::array <std::vector <float>, LAYERS> columns;
+
+	std::vector <float> input;
+	std::vector <float> hidden;
+	std::vector <float> output;
+
+	CPUEvaluator(const NGF &ngf_) : ngf(ngf_) {
+		uint32_t ffin = ngf.weights[0].height;
+		levels = (ffin - ngf.feature_size) / 6;
+
+		for (int32_t l = 0; l < LAYERS; l++) {
+			const Tensor &W = ngf.weights[l];
+
+			columns[l].resize(W.width * W.height);
+			for (int32_t i = 0; i < W.width; i++) {
+				for (int32_t j = 0; j < W.height; j++)
+					columns[l][j * W.width + i] = W[i * W.height + j];
+			}
+		}
+
+		input.resize(ffin);
+		hidden.resize(64);
+		output.resize(64);
+	}
+
+	void dense(int32_t l, const std::vector <float> &x, std::vector <float> &y, bool activate) const {
+		const Tensor &W = ngf.weights[l];
+		const Tensor &b = ngf.biases[l];
+
+		std::copy(b.begin(), b.end(), y.begin());
+		for (int32_t j = 0; j < W.height; j++) {
+			const float *column = columns[l].data() + j * W.width;
+
+			float xj = x[j];
+			for (int32_t i = 0; i < W.width; i++)
+				y[i] += column[i] * xj;
+		}
+
+		if (activate) {
+			for (int32_t i = 0; i < W.width; i++)
+				y[i] = std::max(y[i], 0.01f * y[i]);
+		}
+	}
+
+	glm::vec3 eval(const glm::ivec4 &complex, float u, float v) {
+		glm::vec3 v0 = ngf.vertices[complex.x];
+		glm::vec3 v1 = ngf.vertices[complex.y];
+		glm::vec3 v2 = ngf.vertices[complex.z];
+		glm::vec3 v3 = ngf.vertices[complex.w];
+
+		glm::vec3 vertex = glm::mix(glm::mix(v0, v1, v), glm::mix(v3, v2, v), u);
+
+		uint32_t F = ngf.feature_size;
+		for (uint32_t i = 0; i < F; i++) {
+			float f0 = ngf.features[complex.x * F + i];
+			float f1 = ngf.features[complex.y * F + i];
+			float f2 = ngf.features[complex.z * F + i];
+			float f3 = ngf.features[complex.w * F + i];
+			input[i] = glm::mix(glm::mix(f0, f1, v), glm::mix(f3, f2, v), u);
+		}
+
+		uint32_t k = F;
+		for (uint32_t i = 0; i < levels; i++) {
+			glm::vec3 p = float(1 << i) * vertex;
+			glm::vec3 s = glm::sin(p);
+			glm::vec3 c = glm::cos(p);
+
+			input[k++] = s.x;
+			input[k++] = s.y;
+			input[k++] = s.z;
+			input[k++] = c.x;
+			input[k++] = c.y;
+			input[k++] = c.z;
+		}
+
+		dense(0, input, hidden, true);
+		dense(1, hidden, output, true);
+		dense(2, output, hidden, true);
+		dense(3, hidden, output, false);
+
+		return vertex + glm::vec3(output[0], output[1], output[2]);
+	}
+};
+
+std::vector <glm::vec4> patch_bounds(const NGF &ngf, uint32_t rate)
+{
+	std::vector <glm::vec4> bounds(2 * ngf.patch_count);
+
+	auto process = [&](uint32_t start, uint32_t end) {
+		CPUEvaluator evaluator(ngf);
+
+		std::vector <glm::vec3> samples(rate * rate);
+		for (uint32_t p = start; p < end; p++) {
+			glm::ivec4 complex = ngf.patches[p];
+
+			glm::vec3 lo(std::numeric_limits <float> ::max());
+			glm::vec3 hi(-std::numeric_limits <float> ::max());
+
+			for (uint32_t i = 0; i < rate; i++) {
+				for (uint32_t j = 0; j < rate; j++) {
+					float u = i/float(rate - 1);
+					float v = j/float(rate - 1);
+
+					glm::vec3 s = evaluator.eval(complex, u, v);
+					samples[i * rate + j] = s;
+
+					lo = glm::min(lo, s);
+					hi = glm::max(hi, s);
+				}
+			}
+
+			// Largest distance between neighboring samples
+			float spacing = 0.0f;
+			for (uint32_t i = 0; i < rate; i++) {
+				for (uint32_t j = 0; j < rate; j++) {
+					const glm::vec3 &s = samples[i * rate + j];
+					if (i + 1 < rate)
+						spacing = std::max(spacing, glm::length(s - samples[(i + 1) * rate + j]));
+					if (j + 1 < rate)
+						spacing = std::max(spacing, glm::length(s - samples[i * rate + j + 1]));
+				}
+			}
+
+			glm::vec3 pad(0.5f * spacing);
+			bounds[2 * p + 0] = glm::vec4(lo - pad, 0.0f);
+			bounds[2 * p + 1] = glm::vec4(hi + pad, 0.0f);
+		}
+	};
+
+	uint32_t threads = std::max(1u, std::thread::hardware_concurrency());
+	uint32_t chunk = (ngf.patch_count + threads - 1) / threads;
+
+	std::vector <std::thread> workers;
+	for (uint32_t start = 0; start < ngf.patch_count; start += chunk)
+		workers.emplace_back(process, start, std::min(start + chunk, ngf.patch_count));
+
+	for (auto &worker : workers)
+		worker.join();
+
+	return bounds;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "io.hpp"
+
+// Per-patch axis aligned bounds of the displaced surface, as (min, max)
+// pairs; the network is evaluated on the CPU over a grid of samples per
+// patch, and the boxes are padded by half the largest sample spacing to
+// cover the surface between the samples
+std::vector <glm::vec4> patch_bounds(const NGF &, uint32_t = 9);
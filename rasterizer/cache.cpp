@@ -0,0 +1,97 @@
+#include <algorithm>
+
+#include "cache.hpp"
+#include "context.hpp"
+#include "loader.hpp"
+
+static void memory_barrier(const vk::CommandBuffer &cmd,
+		vk::PipelineStageFlags src_stage, vk::AccessFlags src_access,
+		vk::PipelineStageFlags dst_stage, vk::AccessFlags dst_access)
+{
+	vk::MemoryBarrier barrier { src_access, dst_access };
+	cmd.pipelineBarrier(src_stage, dst_stage, {}, barrier, {}, {});
+}
+
+// Evaluates the misses of the last frame and resets the list; must be outside of a render pass
+void VertexCache::update(const vk::CommandBuffer &cmd, const NGFResources *model, const vk::DescriptorSet &dset)
+{
+	frame++;
+
+	if (!model)
+		return;
+
+	const vk::Buffer &state = model->buffers[4].buffer;
+
+	// The miss list and dispatch size were written by the task shader, and the
+	// last frame may still be reading the slots
+	memory_barrier(cmd,
+		vk::PipelineStageFlagBits::eTaskShaderEXT | vk::PipelineStageFlagBits::eMeshShaderEXT,
+		vk::AccessFlagBits::eShaderWrite,
+		vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eComputeShader,
+		vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+
+	cmd.bindPipeline(vk::PipelineBindPoint::eCompute, evaluation.handle);
+	cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, evaluation.layout, 0, { dset }, nullptr);
+	cmd.pushConstants <uint32_t> (evaluation.layout, vk::ShaderStageFlagBits::eCompute, 0, frame);
+	cmd.dispatchIndirect(state, 0);
+
+	memory_barrier(cmd,
+		vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect,
+		vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eIndirectCommandRead,
+		vk::PipelineStageFlagBits::eTransfer,
+		vk::AccessFlagBits::eTransferWrite);
+
+	cmd.fillBuffer(state, 0, sizeof(uint32_t), 0);
+
+	memory_barrier(cmd,
+		vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+		vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite,
+		vk::PipelineStageFlagBits::eTaskShaderEXT | vk::PipelineStageFlagBits::eMeshShaderEXT,
+		vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+}
+
+uint32_t VertexCache::slots(uint32_t patch_count)
+{
+	uint32_t limit = BUDGET / (STRIDE * sizeof(glm::vec4));
+	return std::max(std::min(patch_count, limit), 1u);
+}
+
+vk::DeviceSize VertexCache::cache_size(uint32_t patch_count)
+{
+	return vk::DeviceSize(slots(patch_count)) * STRIDE * sizeof(glm::vec4);
+}
+
+// Indirect dispatch, followed by the entry of each slot and the miss list
+vk::DeviceSize VertexCache::state_size(uint32_t patch_count)
+{
+	return (1 + 2 * vk::DeviceSize(slots(patch_count))) * sizeof(glm::uvec4);
+}
+
+// Replaces the evaluation pipeline, sharing the layout of the NGF pipelines
+void VertexCache::specialize(DeviceRenderContext &engine, const vk::SpecializationInfo &specialization)
+{
+	if (evaluation.handle)
+		engine.device.destroyPipeline(evaluation.handle);
+
+	vk::PipelineShaderStageCreateInfo stage {
+		{}, vk::ShaderStageFlagBits::eCompute,
+		engine.shader_cache.module(SHADERS_DIRECTORY "/cache.comp", vk::ShaderStageFlagBits::eCompute, engine.defines),
+		"main", &specialization
+	};
+
+	vk::ComputePipelineCreateInfo pipeline_info { {}, stage, evaluation.layout };
+
+	evaluation.handle = engine.device.createComputePipeline(engine.shader_cache.pipeline_cache, pipeline_info).value;
+}
+
+VertexCache VertexCache::from(DeviceRenderContext &engine)
+{
+	VertexCache cache;
+
+	vk::PushConstantRange push_constant { vk::ShaderStageFlagBits::eCompute, 0, sizeof(uint32_t) };
+
+	cache.evaluation.layout = engine.device.createPipelineLayout({ {}, engine.meshlet_dsl, push_constant });
+	cache.evaluation.dsl = engine.meshlet_dsl;
+
+	return cache;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <littlevk/littlevk.hpp>
+
+struct DeviceRenderContext;
+struct NGFResources;
+
+// Evaluated vertices of recently drawn patches, so that the network is only
+// run again when the resolution of a patch or the model changes; the task
+// shader records the patches that missed, and the next frame evaluates them
+// into their slots before drawing. Slots are direct mapped by patch index,
+// and only entries that were not used in the last frame are evicted
+struct VertexCache {
+	// Vertices per slot, matching CACHE_STRIDE in payload.h
+	static constexpr uint32_t STRIDE = 15 * 15;
+
+	// Upper limit on the evaluated vertices of a model
+	static constexpr vk::DeviceSize BUDGET = 64 << 20;
+
+	littlevk::Pipeline evaluation;
+
+	// Frame number for the age of the entries, starting at one
+	uint32_t frame = 0;
+
+	void update(const vk::CommandBuffer &, const NGFResources *, const vk::DescriptorSet &);
+	void specialize(DeviceRenderContext &, const vk::SpecializationInfo &);
+
+	static uint32_t slots(uint32_t);
+	static vk::DeviceSize cache_size(uint32_t);
+	static vk::DeviceSize state_size(uint32_t);
+
+	static VertexCache from(DeviceRenderContext &);
+};
@@ -7,8 +7,11 @@
 #include "context.hpp"
 #include "glio.hpp"
 
+// The network bindings are shared with the vertex cache evaluation
+constexpr vk::ShaderStageFlags NETWORK_STAGES = vk::ShaderStageFlagBits::eMeshEXT | vk::ShaderStageFlagBits::eCompute;
+
 constexpr vk::DescriptorSetLayoutBinding texture_at(uint32_t binding,
-	vk::ShaderStageFlagBits extra = vk::ShaderStageFlagBits::eMeshEXT)
+	vk::ShaderStageFlags extra = vk::ShaderStageFlagBits::eMeshEXT)
 {
 	return vk::DescriptorSetLayoutBinding {
 		binding, vk::DescriptorType::eCombinedImageSampler,
@@ -16,24 +19,46 @@ constexpr vk::DescriptorSetLayoutBinding texture_at(uint32_t binding,
 	};
 }
 
-const std::array <vk::DescriptorSetLayoutBinding, 8> meshlet_dslbs {
+constexpr vk::DescriptorSetLayoutBinding buffer_at(uint32_t binding,
+	vk::ShaderStageFlags stages = NETWORK_STAGES)
+{
+	return vk::DescriptorSetLayoutBinding {
+		binding, vk::DescriptorType::eStorageBuffer,
+		1, stages
+	};
+}
+
+const std::array <vk::DescriptorSetLayoutBinding, 11> meshlet_dslbs {
 	// Complexes
-	texture_at(0, vk::ShaderStageFlagBits::eTaskEXT),
+	buffer_at(0, vk::ShaderStageFlagBits::eTaskEXT | NETWORK_STAGES),
 
 	// Vertices
-	texture_at(1, vk::ShaderStageFlagBits::eTaskEXT),
+	buffer_at(1, vk::ShaderStageFlagBits::eTaskEXT | NETWORK_STAGES),
 
 	// Features
-	texture_at(2),
+	buffer_at(2),
+
+	// Network parameters, layer by layer (see HomogenizedNGF)
+	buffer_at(3),
+
+	// Patch bounds
+	buffer_at(4, vk::ShaderStageFlagBits::eTaskEXT),
+
+	// Visibility of each instance and patch, and the culling counters
+	buffer_at(5, vk::ShaderStageFlagBits::eTaskEXT),
+
+	// Depth pyramid
+	texture_at(6, vk::ShaderStageFlagBits::eTaskEXT),
+
+	// Vertex cache slots and state
+	buffer_at(7),
+	buffer_at(8, vk::ShaderStageFlagBits::eTaskEXT | vk::ShaderStageFlagBits::eCompute),
 
-	// Bias vectors
-	texture_at(3),
+	// Instance transforms and assets
+	buffer_at(9, vk::ShaderStageFlagBits::eTaskEXT | vk::ShaderStageFlagBits::eMeshEXT),
 
-	// Layer weights
-	texture_at(4),
-	texture_at(5),
-	texture_at(6),
-	texture_at(7),
+	// Patch range of each asset
+	buffer_at(10, vk::ShaderStageFlagBits::eTaskEXT),
 };
 
 const std::array <vk::DescriptorSetLayoutBinding, 1> environment_dslbs {
@@ -44,10 +69,10 @@ const std::array <vk::DescriptorSetLayoutBinding, 1> environment_dslbs {
 };
 
 const std::unordered_map <std::string, FragmentShaderInfo> fragment_shaders {
-	{ "Shaded", { SHADERS_DIRECTORY "/shaded.frag" } },
-	{ "Patches", { SHADERS_DIRECTORY "/patches.frag" } },
-	{ "Normals", { SHADERS_DIRECTORY "/normals.frag" } },
-	{ "Depth", { SHADERS_DIRECTORY "/depth.frag" } },
+	{ "Shaded", { SHADERS_DIRECTORY "/shaded.frag", vk::CullModeFlagBits::eBack, vk::PolygonMode::eFill, 0 } },
+	{ "Patches", { SHADERS_DIRECTORY "/patches.frag", vk::CullModeFlagBits::eBack, vk::PolygonMode::eFill, 1 } },
+	{ "Normals", { SHADERS_DIRECTORY "/normals.frag", vk::CullModeFlagBits::eBack, vk::PolygonMode::eFill, 2 } },
+	{ "Depth", { SHADERS_DIRECTORY "/depth.frag", vk::CullModeFlagBits::eBack, vk::PolygonMode::eFill, 3 } },
 	{ "Wireframe", {
 		SHADERS_DIRECTORY "/fill.frag",
 		vk::CullModeFlagBits::eNone,
@@ -75,7 +100,8 @@ void DeviceRenderContext::resize()
 		littlevk::Image depth_buffer = bind(device, memory_properties, dal)
 			.image(window.extent,
 				vk::Format::eD32Sfloat,
-				vk::ImageUsageFlagBits::eDepthStencilAttachment,
+				vk::ImageUsageFlagBits::eDepthStencilAttachment
+					| vk::ImageUsageFlagBits::eSampled,
 				vk::ImageAspectFlagBits::eDepth);
 
 		depth.push_back(depth_buffer);
@@ -87,38 +113,56 @@ void DeviceRenderContext::resize()
 		generator.add(swapchain.image_views[i], depth[i].view);
 
 	framebuffers = generator.unpack();
+
+	// The depth pyramid and visibility buffer follow the framebuffer size
+	if (culling.pyramid)
+		culling.resize(*this);
+
+	if (visibility.render_pass)
+		visibility.resize(*this);
+}
+
+// Single color and depth target, in place of the swapchain
+void DeviceRenderContext::allocate_offscreen()
+{
+	offscreen = bind(device, memory_properties, dal)
+		.image(window.extent,
+			vk::Format::eB8G8R8A8Unorm,
+			vk::ImageUsageFlagBits::eColorAttachment
+				| vk::ImageUsageFlagBits::eTransferSrc,
+			vk::ImageAspectFlagBits::eColor);
+
+	littlevk::Image depth_buffer = bind(device, memory_properties, dal)
+		.image(window.extent,
+			vk::Format::eD32Sfloat,
+			vk::ImageUsageFlagBits::eDepthStencilAttachment
+				| vk::ImageUsageFlagBits::eSampled,
+			vk::ImageAspectFlagBits::eDepth);
+
+	depth = { depth_buffer };
+
+	littlevk::FramebufferGenerator generator(device, render_pass, window.extent, dal);
+	generator.add(offscreen.view, depth_buffer.view);
+
+	framebuffers = generator.unpack();
 }
 
 // Allocating images
 littlevk::Image DeviceRenderContext::upload_texture(const Texture &tex)
 {
-	littlevk::Image image;
-	littlevk::Buffer staging;
+	vk::Extent2D extent { (uint32_t) tex.width, (uint32_t) tex.height };
 
-	std::tie(image, staging) = bind(device, memory_properties, dal)
-		.image((uint32_t) tex.width, (uint32_t) tex.height,
+	littlevk::Image image = bind(device, memory_properties, dal)
+		.image(extent,
 			vk::Format::eR8G8B8A8Unorm,
 			vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst,
-			vk::ImageAspectFlagBits::eColor)
-		.buffer(tex.pixels, vk::BufferUsageFlagBits::eTransferSrc);
+			vk::ImageAspectFlagBits::eColor);
 
-	littlevk::submit_now(device, command_pool, graphics_queue,
-		[&](const vk::CommandBuffer &cmd) {
-			littlevk::transition(cmd, image,
-					vk::ImageLayout::eUndefined,
-					vk::ImageLayout::eTransferDstOptimal);
-
-			littlevk::copy_buffer_to_image(cmd, image, staging,
-					vk::ImageLayout::eTransferDstOptimal);
-
-			littlevk::transition(cmd, image,
-					vk::ImageLayout::eTransferDstOptimal,
-					vk::ImageLayout::eShaderReadOnlyOptimal);
-		}
-	);
-
-	// Free interim data
-	littlevk::destroy_buffer(device, staging);
+	uploader.reserve(tex.pixels.size());
+	uploader.begin();
+	uploader.upload(image, extent, std::span <const uint8_t> (tex.pixels));
+	uploader.submit(graphics_queue);
+	uploader.wait();
 
 	return image;
 }
@@ -154,7 +198,7 @@ void DeviceRenderContext::configure_imgui(DeviceRenderContext &engine)
 	init_info.Device = engine.device;
 	init_info.QueueFamily = littlevk::find_graphics_queue_family(engine.phdev);
 	init_info.Queue = engine.graphics_queue;
-	init_info.PipelineCache = nullptr;
+	init_info.PipelineCache = engine.shader_cache.pipeline_cache;
 	init_info.DescriptorPool = engine.imgui_descriptor_pool;
 	init_info.Allocator = nullptr;
 	init_info.MinImageCount = 2;
@@ -172,7 +216,115 @@ void DeviceRenderContext::configure_imgui(DeviceRenderContext &engine)
 	ImPlot::CreateContext();
 }
 
-DeviceRenderContext DeviceRenderContext::from(const vk::PhysicalDevice &phdev, const std::vector <const char *> &extensions, size_t fsize)
+// NGF pipelines are created directly rather than through the assembler, to
+// go through the pipeline cache and specialize the feature size
+static littlevk::Pipeline ngf_pipeline(DeviceRenderContext &engine, const FragmentShaderInfo &info,
+		const vk::SpecializationInfo &specialization, const vk::RenderPass &render_pass)
+{
+	ShaderCache &cache = engine.shader_cache;
+
+	std::array <vk::PipelineShaderStageCreateInfo, 3> stages {
+		vk::PipelineShaderStageCreateInfo {
+			{}, vk::ShaderStageFlagBits::eTaskEXT,
+			cache.module(SHADERS_DIRECTORY "/ngf.task", vk::ShaderStageFlagBits::eTaskEXT, engine.defines),
+			"main", &specialization
+		},
+		vk::PipelineShaderStageCreateInfo {
+			{}, vk::ShaderStageFlagBits::eMeshEXT,
+			cache.module(SHADERS_DIRECTORY "/ngf.mesh", vk::ShaderStageFlagBits::eMeshEXT, engine.defines),
+			"main", &specialization
+		},
+		vk::PipelineShaderStageCreateInfo {
+			{}, vk::ShaderStageFlagBits::eFragment,
+			cache.module(info.path, vk::ShaderStageFlagBits::eFragment, engine.defines),
+			"main", &specialization
+		},
+	};
+
+	// Set per frame (see new_frame), so that the pipelines survive resizes
+	vk::PipelineViewportStateCreateInfo viewport_state { {}, 1, nullptr, 1, nullptr };
+
+	std::array <vk::DynamicState, 2> dynamic_states {
+		vk::DynamicState::eViewport,
+		vk::DynamicState::eScissor,
+	};
+
+	vk::PipelineDynamicStateCreateInfo dynamic_state { {}, dynamic_states };
+
+	vk::PipelineRasterizationStateCreateInfo rasterization {
+		{}, false, false,
+		info.fill, info.culling,
+		vk::FrontFace::eClockwise,
+		false, 0, 0, 0, 1
+	};
+
+	vk::PipelineMultisampleStateCreateInfo multisample { {}, vk::SampleCountFlagBits::e1 };
+
+	vk::PipelineDepthStencilStateCreateInfo depth_stencil { {}, true, true, vk::CompareOp::eLess };
+
+	vk::PipelineColorBlendAttachmentState attachment {};
+	attachment.colorWriteMask = vk::ColorComponentFlagBits::eR
+		| vk::ColorComponentFlagBits::eG
+		| vk::ColorComponentFlagBits::eB
+		| vk::ColorComponentFlagBits::eA;
+
+	vk::PipelineColorBlendStateCreateInfo blending { {}, false, vk::LogicOp::eCopy, attachment };
+
+	vk::GraphicsPipelineCreateInfo pipeline_info {};
+	pipeline_info.setStages(stages);
+	pipeline_info.pViewportState = &viewport_state;
+	pipeline_info.pRasterizationState = &rasterization;
+	pipeline_info.pMultisampleState = &multisample;
+	pipeline_info.pDepthStencilState = &depth_stencil;
+	pipeline_info.pColorBlendState = &blending;
+	pipeline_info.pDynamicState = &dynamic_state;
+	pipeline_info.layout = engine.meshlet_layout;
+	pipeline_info.renderPass = render_pass;
+	pipeline_info.subpass = 0;
+
+	littlevk::Pipeline pipeline;
+	pipeline.handle = engine.device.createGraphicsPipeline(cache.pipeline_cache, pipeline_info).value;
+	pipeline.layout = engine.meshlet_layout;
+	pipeline.dsl = engine.meshlet_dsl;
+
+	return pipeline;
+}
+
+// (Re)creates the pipelines which evaluate the network for a feature size
+void DeviceRenderContext::specialize(uint32_t fsize)
+{
+	if (fsize == feature_size)
+		return;
+
+	device.waitIdle();
+
+	for (auto &[_, ppl] : primaries)
+		device.destroyPipeline(ppl.handle);
+
+	if (visibility.geometry.handle)
+		device.destroyPipeline(visibility.geometry.handle);
+
+	vk::SpecializationMapEntry entry { 0, 0, sizeof(uint32_t) };
+	vk::SpecializationInfo specialization { 1, &entry, sizeof(uint32_t), &fsize };
+
+	for (const auto &[key, info] : fragment_shaders)
+		primaries[key] = ngf_pipeline(*this, info, specialization, render_pass);
+
+	FragmentShaderInfo identifiers { SHADERS_DIRECTORY "/visibility.frag" };
+	visibility.geometry = ngf_pipeline(*this, identifiers, specialization, visibility.render_pass);
+
+	vertex_cache.specialize(*this, specialization);
+
+	if (feature_size)
+		ulog_info("vulkan", "specialized pipelines for feature size %d (was %d)\n", fsize, feature_size);
+
+	feature_size = fsize;
+}
+
+DeviceRenderContext DeviceRenderContext::from(const vk::PhysicalDevice &phdev,
+		const std::vector <const char *> &extensions,
+		size_t fsize, bool half,
+		const std::optional <vk::Extent2D> &offscreen)
 {
 	DeviceRenderContext engine;
 
@@ -193,12 +345,19 @@ DeviceRenderContext DeviceRenderContext::from(const vk::PhysicalDevice &phdev, c
 	ulog_info("vulkan", "  max output vertices: %d\n", ms_properties.maxMeshOutputVertices);
 	ulog_info("vulkan", "  max output primitives: %d\n", ms_properties.maxMeshOutputPrimitives);
 	ulog_info("vulkan", "  max work group invocations: %d\n", ms_properties.maxMeshWorkGroupInvocations);
+	ulog_info("vulkan", "  max task work groups: %d\n", ms_properties.maxTaskWorkGroupTotalCount);
+
+	for (uint32_t i = 0; i < 3; i++)
+		engine.task_group_count[i] = ms_properties.maxTaskWorkGroupCount[i];
+
+	engine.task_group_total = ms_properties.maxTaskWorkGroupTotalCount;
 
 	// Configure the features
 	vk::PhysicalDeviceMeshShaderFeaturesEXT ms_ft = {};
 	vk::PhysicalDeviceMaintenance4FeaturesKHR m4_ft = {};
 	vk::PhysicalDeviceSeparateDepthStencilLayoutsFeaturesKHR separation = {};
 	vk::PhysicalDeviceRobustness2FeaturesEXT robustness = {};
+	vk::PhysicalDeviceShaderFloat16Int8FeaturesKHR float16 = {};
 	vk::PhysicalDeviceFeatures2KHR ft = {};
 
 	ft.features.independentBlend = true;
@@ -210,6 +369,7 @@ DeviceRenderContext DeviceRenderContext::from(const vk::PhysicalDevice &phdev, c
 	ms_ft.pNext = &m4_ft;
 	m4_ft.pNext = &separation;
 	separation.pNext = &robustness;
+	robustness.pNext = &float16;
 
 	phdev.getFeatures2(&ft);
 
@@ -218,6 +378,17 @@ DeviceRenderContext DeviceRenderContext::from(const vk::PhysicalDevice &phdev, c
 	ulog_info("vulkan", "  mesh shaders: %s\n", ms_ft.meshShader ? "true" : "false");
 	ulog_info("vulkan", "  multiview: %s\n", ms_ft.multiviewMeshShader ? "true" : "false");
 	ulog_info("vulkan", "  m4: %s\n", m4_ft.maintenance4 ? "true" : "false");
+	ulog_info("vulkan", "  float16 arithmetic: %s\n", float16.shaderFloat16 ? "true" : "false");
+	ulog_info("vulkan", "  mesh shader queries: %s\n", ms_ft.meshShaderQueries ? "true" : "false");
+
+	engine.pipeline_statistics = ft.features.pipelineStatisticsQuery && ms_ft.meshShaderQueries;
+
+	if (half && !float16.shaderFloat16)
+		ulog_warning("vulkan", "half precision arithmetic is not supported, falling back to full precision\n");
+
+	engine.half_precision = half && float16.shaderFloat16;
+
+	float16.shaderInt8 = vk::False;
 
 	ms_ft.multiviewMeshShader = vk::False;
 	ms_ft.primitiveFragmentShadingRateMeshShader = vk::False;
@@ -226,21 +397,82 @@ DeviceRenderContext DeviceRenderContext::from(const vk::PhysicalDevice &phdev, c
 
 	robustness.nullDescriptor = vk::True;
 
-	// Initialize the device and surface
-	engine.skeletonize(phdev, { 1920, 1080 }, "Neural Geometry Fields Testbed",
-			extensions, ft, vk::PresentModeKHR::eImmediate);
+	// Initialize the device and surface; headless contexts only need the
+	// device and a graphics queue, the window is never created
+	engine.headless = offscreen.has_value();
+
+	if (engine.headless) {
+		uint32_t family = littlevk::find_graphics_queue_family(phdev);
+		float priority = 1.0f;
+
+		vk::DeviceQueueCreateInfo queue_info { {}, family, 1, &priority };
+
+		vk::DeviceCreateInfo device_info { {}, queue_info, {}, extensions };
+		device_info.pNext = &ft;
+
+		engine.device = phdev.createDevice(device_info);
+		engine.graphics_queue = engine.device.getQueue(family, 0);
+		engine.window.extent = *offscreen;
+	} else {
+		engine.skeletonize(phdev, { 1920, 1080 }, "Neural Geometry Fields Testbed",
+				extensions, ft, vk::PresentModeKHR::eImmediate);
+	}
+
+	// Offscreen frames are read back instead of presented
+	vk::AttachmentDescription color_attachment;
+	if (engine.headless) {
+		color_attachment = littlevk::default_color_attachment(vk::Format::eB8G8R8A8Unorm);
+		color_attachment.finalLayout = vk::ImageLayout::eTransferSrcOptimal;
+	} else {
+		color_attachment = littlevk::default_color_attachment(engine.swapchain.format);
+	}
+
+	vk::AttachmentDescription depth_attachment = littlevk::default_depth_attachment();
+
+	// Frames are split in two passes around the depth pyramid reduction; the
+	// first keeps both attachments and the second continues from them
+	vk::AttachmentDescription color_first = color_attachment;
+	color_first.storeOp = vk::AttachmentStoreOp::eStore;
+	color_first.finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
+
+	vk::AttachmentDescription depth_first = depth_attachment;
+	depth_first.storeOp = vk::AttachmentStoreOp::eStore;
+	depth_first.finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
 
-	// Create the render pass
+	vk::AttachmentDescription color_resume = color_attachment;
+	color_resume.loadOp = vk::AttachmentLoadOp::eLoad;
+	color_resume.initialLayout = vk::ImageLayout::eColorAttachmentOptimal;
+
+	vk::AttachmentDescription depth_resume = depth_attachment;
+	depth_resume.loadOp = vk::AttachmentLoadOp::eLoad;
+	depth_resume.initialLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
+	// Create the render passes
 	engine.render_pass = littlevk::RenderPassAssembler(engine.device, engine.dal)
-		.add_attachment(littlevk::default_color_attachment(engine.swapchain.format))
-		.add_attachment(littlevk::default_depth_attachment())
+		.add_attachment(color_first)
+		.add_attachment(depth_first)
+		.add_subpass(vk::PipelineBindPoint::eGraphics)
+			.color_attachment(0, vk::ImageLayout::eColorAttachmentOptimal)
+			.depth_attachment(1, vk::ImageLayout::eDepthStencilAttachmentOptimal)
+			.done();
+
+	engine.resume_pass = littlevk::RenderPassAssembler(engine.device, engine.dal)
+		.add_attachment(color_resume)
+		.add_attachment(depth_resume)
 		.add_subpass(vk::PipelineBindPoint::eGraphics)
 			.color_attachment(0, vk::ImageLayout::eColorAttachmentOptimal)
 			.depth_attachment(1, vk::ImageLayout::eDepthStencilAttachmentOptimal)
 			.done();
 
 	// Get everything to the correct size
-	engine.resize();
+	if (engine.headless)
+		engine.allocate_offscreen();
+	else
+		engine.resize();
+
+	// Staging arena, reset per batch and grown on demand by the uploads
+	engine.uploader = Uploader::from(engine.device, engine.memory_properties,
+			littlevk::find_graphics_queue_family(phdev), 1 << 22);
 
 	// Allocate command buffers
 	engine.command_pool = littlevk::command_pool(engine.device,
@@ -258,6 +490,8 @@ DeviceRenderContext DeviceRenderContext::from(const vk::PhysicalDevice &phdev, c
 	// Allocate descriptor pool
 	vk::DescriptorPoolSize pool_sizes[] = {
 		{ vk::DescriptorType::eStorageBuffer, 1 << 10 },
+		{ vk::DescriptorType::eCombinedImageSampler, 1 << 10 },
+		{ vk::DescriptorType::eStorageImage, 1 << 10 },
 	};
 
 	vk::DescriptorPoolCreateInfo pool_info = {};
@@ -275,33 +509,37 @@ DeviceRenderContext DeviceRenderContext::from(const vk::PhysicalDevice &phdev, c
 	engine.sync = littlevk::present_syncronization(engine.device, 2).unwrap(engine.dal);
 
 	// Configure pipelines
-	configure_imgui(engine);
+	engine.shader_cache = ShaderCache::from(engine.device);
+
+	if (!engine.headless)
+		configure_imgui(engine);
+
+	// Shared by every NGF pipeline
+	engine.meshlet_dsl = engine.device.createDescriptorSetLayout({ {}, meshlet_dslbs });
+
+	std::array <vk::PushConstantRange, 2> push_constants {
+		vk::PushConstantRange {
+			vk::ShaderStageFlagBits::eMeshEXT | vk::ShaderStageFlagBits::eTaskEXT,
+			0, sizeof(TaskData)
+		},
+		vk::PushConstantRange {
+			vk::ShaderStageFlagBits::eFragment,
+			sizeof(TaskData), sizeof(ShadingData)
+		},
+	};
 
-	using standalone::readfile;
+	engine.meshlet_layout = engine.device.createPipelineLayout({ {}, engine.meshlet_dsl, push_constants });
 
-	const std::string entry = "main";
-	const std::filesystem::path mesh_shader = SHADERS_DIRECTORY "/ngf.mesh";
-	const std::filesystem::path task_shader = SHADERS_DIRECTORY "/ngf.task";
+	if (engine.half_precision)
+		engine.defines["NGF_FP16"] = "1";
 
-	const littlevk::shader::Defines defines {
-		{ "FEATURE_SIZE", std::to_string(fsize) }
-	};
+	engine.vertex_cache = VertexCache::from(engine);
 
-	for (const auto &[key, info] : fragment_shaders) {
-		auto bundle = littlevk::ShaderStageBundle(engine.device, engine.dal)
-			.file(mesh_shader, vk::ShaderStageFlagBits::eMeshEXT, entry, {}, defines)
-			.file(task_shader, vk::ShaderStageFlagBits::eTaskEXT, entry, {}, defines)
-			.file(info.path, vk::ShaderStageFlagBits::eFragment, entry, {}, defines);
-
-		engine.primaries[key] = littlevk::PipelineAssembler <littlevk::eGraphics> (engine.device, engine.window, engine.dal)
-			.with_render_pass(engine.render_pass, 0)
-			.with_shader_bundle(bundle)
-			.with_dsl_bindings(meshlet_dslbs)
-			.polygon_mode(info.fill)
-			.cull_mode(info.culling)
-			.with_push_constant <TaskData> (vk::ShaderStageFlagBits::eMeshEXT | vk::ShaderStageFlagBits::eTaskEXT)
-			.with_push_constant <ShadingData> (vk::ShaderStageFlagBits::eFragment, sizeof(TaskData));
-	}
+	// Targets of the deferred path, for its NGF pipeline
+	engine.visibility = VisibilityBuffer::from(engine);
+
+	engine.feature_size = 0;
+	engine.specialize(fsize);
 
 	auto environment_bundle = littlevk::ShaderStageBundle(engine.device, engine.dal)
 		.file(SHADERS_DIRECTORY "/quad.vert", vk::ShaderStageFlagBits::eVertex)
@@ -315,9 +553,17 @@ DeviceRenderContext DeviceRenderContext::from(const vk::PhysicalDevice &phdev, c
 		.with_dsl_bindings(environment_dslbs)
 		.with_push_constant <RayFrame> (vk::ShaderStageFlagBits::eFragment);
 
+	// Depth pyramid for occlusion culling
+	engine.culling = OcclusionCulling::from(engine);
+
+	engine.instances = Instances::from(engine);
+
 	// Other configurations
 	engine.camera.from(engine.aspect_ratio());
 
+	if (engine.headless)
+		return engine;
+
 	// Configure callbacks
 	GLFWwindow *win = engine.window.handle;
 
@@ -1,11 +1,19 @@
 #pragma once
 
+#include <optional>
+
 #include <glm/glm.hpp>
 
 #include <littlevk/littlevk.hpp>
 
 #include "io.hpp"
+#include "cache.hpp"
 #include "common.hpp"
+#include "culling.hpp"
+#include "instances.hpp"
+#include "shaders.hpp"
+#include "uploader.hpp"
+#include "visibility.hpp"
 
 struct alignas(16) TaskData {
 	glm::mat4 model;
@@ -15,6 +23,13 @@ struct alignas(16) TaskData {
 	// TODO: procedural texture synthesis?
 	int flags;
 	int resolution;
+
+	// Segments per NDC unit along the viewport height for adaptive
+	// tessellation, or zero for a fixed resolution
+	float detail;
+
+	// Frame number of the vertex cache
+	uint32_t frame;
 	alignas(16) glm::vec3 viewing;
 	float time;
 };
@@ -24,13 +39,40 @@ struct alignas(16) ShadingData {
 	alignas(16) glm::vec3 color;
 };
 
+// Rendering options shared by the interface and the benchmarks
+struct Options {
+	bool backface_culling = false;
+	bool occlusion_culling = true;
+	int resolution = 15;
+
+	// Picks the resolution of each patch from its size on screen, with the
+	// resolution above as the upper limit
+	bool adaptive_tessellation = true;
+	float edge_pixels = 8.0f;
+
+	// Reuses the evaluated vertices of patches across frames
+	bool vertex_cache = true;
+
+	// Shades once per pixel from a visibility buffer, where the mode allows
+	bool visibility = false;
+
+	// Copies of the model, in a grid
+	int instances = 1;
+	float spacing = 2.5f;
+
+	std::string key = "Shaded";
+};
+
 struct FragmentShaderInfo {
 	std::filesystem::path path;
 	vk::CullModeFlags culling = vk::CullModeFlagBits::eBack;
 	vk::PolygonMode fill = vk::PolygonMode::eFill;
+
+	// Mode of the visibility buffer resolve, or -1 to always shade forward
+	int resolve = -1;
 };
 
-extern const std::array <vk::DescriptorSetLayoutBinding, 8> meshlet_dslbs;
+extern const std::array <vk::DescriptorSetLayoutBinding, 11> meshlet_dslbs;
 extern const std::array <vk::DescriptorSetLayoutBinding, 1> environment_dslbs;
 extern const std::unordered_map <std::string, FragmentShaderInfo> fragment_shaders;
 
@@ -41,6 +83,7 @@ struct DeviceRenderContext : littlevk::Skeleton {
 	littlevk::Deallocator dal;
 
 	vk::RenderPass render_pass;
+	vk::RenderPass resume_pass;
 	vk::CommandPool command_pool;
 	vk::DescriptorPool descriptor_pool;
 
@@ -51,11 +94,50 @@ struct DeviceRenderContext : littlevk::Skeleton {
 
 	littlevk::PresentSyncronization sync;
 
-	// Pipelines
+	// Staging for all texture uploads
+	Uploader uploader;
+
+	// Compiled shaders and pipelines from previous runs
+	ShaderCache shader_cache;
+
+	// Pipelines; the NGF pipelines share one layout, so that descriptor sets
+	// outlive the pipelines when they are specialized for another feature size
 	std::unordered_map <std::string, littlevk::Pipeline> primaries;
+	vk::DescriptorSetLayout meshlet_dsl;
+	vk::PipelineLayout meshlet_layout;
+	littlevk::shader::Defines defines;
 
 	littlevk::Pipeline environment;
 
+	// Whether the network is evaluated in half precision
+	bool half_precision = false;
+
+	// Feature size the pipelines were specialized for
+	uint32_t feature_size = 0;
+
+	// Depth pyramid and culling counters
+	OcclusionCulling culling;
+
+	// Evaluated vertices of recently drawn patches
+	VertexCache vertex_cache;
+
+	// Instances of the model and their visibility
+	Instances instances;
+
+	// Identifier and depth targets of the deferred path
+	VisibilityBuffer visibility;
+
+	// Task workgroups of a single draw, per dimension and in total
+	std::array <uint32_t, 3> task_group_count {};
+	uint32_t task_group_total = 0;
+
+	// Whether task/mesh invocations can be counted by pipeline statistics queries
+	bool pipeline_statistics = false;
+
+	// Rendering into an offscreen image without a window or swapchain
+	bool headless = false;
+	littlevk::Image offscreen;
+
 	// ImGui resources
 	vk::DescriptorPool imgui_descriptor_pool;
 
@@ -65,8 +147,11 @@ struct DeviceRenderContext : littlevk::Skeleton {
 
 	// TODO: deallocate
 	void resize();
+	void allocate_offscreen();
+	void specialize(uint32_t);
 	littlevk::Image upload_texture(const Texture &);
 	static void configure_imgui(DeviceRenderContext &);
-	static DeviceRenderContext from(const vk::PhysicalDevice &, const std::vector <const char *> &, size_t);
+	static DeviceRenderContext from(const vk::PhysicalDevice &, const std::vector <const char *> &, size_t, bool = false,
+			const std::optional <vk::Extent2D> & = std::nullopt);
 };
 
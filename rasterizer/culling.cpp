@@ -0,0 +1,302 @@
+#include <cstring>
+
+#include "context.hpp"
+#include "culling.hpp"
+#include "instances.hpp"
+#include "loader.hpp"
+#include "vkutil.hpp"
+
+static const std::array <vk::DescriptorSetLayoutBinding, 2> reduction_dslbs {
+	vk::DescriptorSetLayoutBinding {
+		0, vk::DescriptorType::eCombinedImageSampler,
+		1, vk::ShaderStageFlagBits::eCompute
+	},
+
+	vk::DescriptorSetLayoutBinding {
+		1, vk::DescriptorType::eStorageImage,
+		1, vk::ShaderStageFlagBits::eCompute
+	},
+};
+
+static uint32_t previous_power_of_two(uint32_t x)
+{
+	uint32_t p = 1;
+	while (2 * p <= x)
+		p *= 2;
+
+	return p;
+}
+
+static void memory_barrier(const vk::CommandBuffer &cmd,
+		vk::PipelineStageFlags src_stage, vk::AccessFlags src_access,
+		vk::PipelineStageFlags dst_stage, vk::AccessFlags dst_access)
+{
+	vk::MemoryBarrier barrier { src_access, dst_access };
+	cmd.pipelineBarrier(src_stage, dst_stage, {}, barrier, {}, {});
+}
+
+static void depth_barrier(const vk::CommandBuffer &cmd, const littlevk::Image &depth,
+		vk::ImageLayout from, vk::ImageLayout to,
+		vk::PipelineStageFlags src_stage, vk::AccessFlags src_access,
+		vk::PipelineStageFlags dst_stage, vk::AccessFlags dst_access)
+{
+	vk::ImageMemoryBarrier barrier {
+		src_access, dst_access, from, to,
+		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+		depth.image,
+		vk::ImageSubresourceRange { vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1 }
+	};
+
+	cmd.pipelineBarrier(src_stage, dst_stage, {}, {}, {}, barrier);
+}
+
+// Pyramid allocation, redone whenever the depth buffers are
+void OcclusionCulling::resize(DeviceRenderContext &engine)
+{
+	if (pyramid) {
+		for (auto mip : mips)
+			device.destroyImageView(mip);
+
+		device.destroyImageView(view);
+		device.destroyImage(pyramid);
+		device.freeMemory(memory);
+		mips.clear();
+	}
+
+	extent = vk::Extent2D {
+		previous_power_of_two(engine.window.extent.width),
+		previous_power_of_two(engine.window.extent.height)
+	};
+
+	levels = 1;
+	while ((std::max(extent.width, extent.height) >> levels) > 0)
+		levels++;
+
+	pyramid = device.createImage({
+		{}, vk::ImageType::e2D, vk::Format::eR32Sfloat,
+		vk::Extent3D { extent.width, extent.height, 1 },
+		levels, 1, vk::SampleCountFlagBits::e1,
+		vk::ImageTiling::eOptimal,
+		vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled,
+		vk::SharingMode::eExclusive
+	});
+
+	auto requirements = device.getImageMemoryRequirements(pyramid);
+
+	memory = device.allocateMemory({
+		requirements.size,
+		memory_type_index(memory_properties, requirements.memoryTypeBits,
+			vk::MemoryPropertyFlagBits::eDeviceLocal)
+	});
+
+	device.bindImageMemory(pyramid, memory, 0);
+
+	auto make_view = [&](uint32_t base, uint32_t count) {
+		return device.createImageView({
+			{}, pyramid, vk::ImageViewType::e2D, vk::Format::eR32Sfloat, {},
+			vk::ImageSubresourceRange { vk::ImageAspectFlagBits::eColor, base, count, 0, 1 }
+		});
+	};
+
+	view = make_view(0, levels);
+	for (uint32_t i = 0; i < levels; i++)
+		mips.push_back(make_view(i, 1));
+
+	// The pyramid stays in the general layout, for both writing and sampling
+	littlevk::submit_now(device, engine.command_pool, engine.graphics_queue,
+		[&](const vk::CommandBuffer &cmd) {
+			vk::ImageMemoryBarrier barrier {
+				{}, vk::AccessFlagBits::eShaderWrite,
+				vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral,
+				VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+				pyramid,
+				vk::ImageSubresourceRange { vk::ImageAspectFlagBits::eColor, 0, levels, 0, 1 }
+			};
+
+			cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+					vk::PipelineStageFlagBits::eComputeShader,
+					{}, {}, {}, barrier);
+		}
+	);
+
+	// Reduction sets for the current depth buffers
+	device.resetDescriptorPool(descriptor_pool);
+
+	size_t count = engine.depth.size() + levels - 1;
+	std::vector <vk::DescriptorSetLayout> layouts(count, *reduction.dsl);
+	dsets = device.allocateDescriptorSets({ descriptor_pool, layouts });
+
+	auto SROO = vk::ImageLayout::eShaderReadOnlyOptimal;
+	auto general = vk::ImageLayout::eGeneral;
+
+	for (size_t i = 0; i < engine.depth.size(); i++) {
+		littlevk::bind(device, dsets[i], reduction_dslbs)
+			.update(0, 0, sampler, engine.depth[i].view, SROO)
+			.update(1, 0, sampler, mips[0], general)
+			.finalize();
+	}
+
+	for (uint32_t i = 1; i < levels; i++) {
+		littlevk::bind(device, dsets[engine.depth.size() + i - 1], reduction_dslbs)
+			.update(0, 0, sampler, mips[i - 1], general)
+			.update(1, 0, sampler, mips[i], general)
+			.finalize();
+	}
+
+	generation++;
+
+	ulog_info("culling", "depth pyramid %d x %d with %d levels\n", extent.width, extent.height, levels);
+}
+
+// Collects the counters of the frame that last used this slot, and zeroes them for this one
+void OcclusionCulling::begin(const vk::CommandBuffer &cmd, size_t slot, const NGFResources *model, const Instances &instances)
+{
+	if (recorded[slot])
+		std::memcpy(counters.data(), mapped + slot * eCounterCount, sizeof(counters));
+
+	recorded[slot] = false;
+
+	if (!model)
+		return;
+
+	memory_barrier(cmd,
+		vk::PipelineStageFlagBits::eTaskShaderEXT, vk::AccessFlagBits::eShaderWrite,
+		vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite);
+
+	vk::BufferCopy region {
+		0, 0,
+		eCounterCount * sizeof(uint32_t)
+	};
+
+	cmd.copyBuffer(zeros.buffer, instances.visibility, region);
+
+	memory_barrier(cmd,
+		vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite,
+		vk::PipelineStageFlagBits::eTaskShaderEXT, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+}
+
+// Reduces the depth of the first pass into the pyramid; must be outside of a render pass
+void OcclusionCulling::build(const vk::CommandBuffer &cmd, const littlevk::Image &depth, size_t index)
+{
+	depth_barrier(cmd, depth,
+		vk::ImageLayout::eDepthStencilAttachmentOptimal,
+		vk::ImageLayout::eShaderReadOnlyOptimal,
+		vk::PipelineStageFlagBits::eLateFragmentTests,
+		vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::AccessFlagBits::eShaderRead);
+
+	// The previous frame may still be sampling the pyramid
+	memory_barrier(cmd,
+		vk::PipelineStageFlagBits::eTaskShaderEXT, vk::AccessFlagBits::eShaderRead,
+		vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite);
+
+	cmd.bindPipeline(vk::PipelineBindPoint::eCompute, reduction.handle);
+
+	for (uint32_t i = 0; i < levels; i++) {
+		vk::DescriptorSet dset = (i == 0) ? dsets[index] : dsets[dsets.size() - levels + i];
+
+		cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, reduction.layout, 0, { dset }, nullptr);
+
+		uint32_t width = std::max(extent.width >> i, 1u);
+		uint32_t height = std::max(extent.height >> i, 1u);
+		cmd.dispatch((width + 15)/16, (height + 15)/16, 1);
+
+		memory_barrier(cmd,
+			vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite,
+			vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTaskShaderEXT,
+			vk::AccessFlagBits::eShaderRead);
+	}
+
+	depth_barrier(cmd, depth,
+		vk::ImageLayout::eShaderReadOnlyOptimal,
+		vk::ImageLayout::eDepthStencilAttachmentOptimal,
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::AccessFlagBits::eShaderRead,
+		vk::PipelineStageFlagBits::eEarlyFragmentTests,
+		vk::AccessFlagBits::eDepthStencilAttachmentRead
+			| vk::AccessFlagBits::eDepthStencilAttachmentWrite);
+}
+
+// Copies the counters of this frame out for the host; must be outside of a render pass
+void OcclusionCulling::end(const vk::CommandBuffer &cmd, size_t slot, const NGFResources *model, const Instances &instances)
+{
+	if (!model)
+		return;
+
+	memory_barrier(cmd,
+		vk::PipelineStageFlagBits::eTaskShaderEXT, vk::AccessFlagBits::eShaderWrite,
+		vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead);
+
+	vk::BufferCopy region {
+		0, slot * eCounterCount * sizeof(uint32_t),
+		eCounterCount * sizeof(uint32_t)
+	};
+
+	cmd.copyBuffer(instances.visibility, readback.buffer, region);
+
+	memory_barrier(cmd,
+		vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite,
+		vk::PipelineStageFlagBits::eHost, vk::AccessFlagBits::eHostRead);
+
+	recorded[slot] = true;
+}
+
+void OcclusionCulling::destroy()
+{
+	for (auto mip : mips)
+		device.destroyImageView(mip);
+
+	device.destroyImageView(view);
+	device.destroyImage(pyramid);
+	device.freeMemory(memory);
+	device.destroyDescriptorPool(descriptor_pool);
+}
+
+OcclusionCulling OcclusionCulling::from(DeviceRenderContext &engine)
+{
+	OcclusionCulling culling;
+	culling.device = engine.device;
+	culling.memory_properties = engine.memory_properties;
+
+	// Only used with texelFetch
+	culling.sampler = littlevk::SamplerAssembler(engine.device, engine.dal);
+
+	auto bundle = littlevk::ShaderStageBundle(engine.device, engine.dal)
+		.file(SHADERS_DIRECTORY "/pyramid.comp", vk::ShaderStageFlagBits::eCompute);
+
+	culling.reduction = littlevk::PipelineAssembler <littlevk::eCompute> (engine.device, engine.dal)
+		.with_shader_bundle(bundle)
+		.with_dsl_bindings(reduction_dslbs);
+
+	// Enough sets for any framebuffer size
+	uint32_t sets = 64;
+
+	vk::DescriptorPoolSize pool_sizes[] = {
+		{ vk::DescriptorType::eCombinedImageSampler, sets },
+		{ vk::DescriptorType::eStorageImage, sets },
+	};
+
+	culling.descriptor_pool = engine.device.createDescriptorPool({
+		{}, sets, pool_sizes
+	});
+
+	// Counters
+	vk::DeviceSize size = 2 * eCounterCount * sizeof(uint32_t);
+
+	culling.readback = bind(engine.device, engine.memory_properties, engine.dal)
+		.buffer(size, vk::BufferUsageFlagBits::eTransferDst);
+
+	culling.zeros = bind(engine.device, engine.memory_properties, engine.dal)
+		.buffer(size, vk::BufferUsageFlagBits::eTransferSrc);
+
+	void *zeros = engine.device.mapMemory(culling.zeros.memory, 0, size);
+	std::memset(zeros, 0, size);
+	engine.device.unmapMemory(culling.zeros.memory);
+
+	culling.mapped = (uint32_t *) engine.device.mapMemory(culling.readback.memory, 0, size);
+
+	culling.resize(engine);
+
+	return culling;
+}
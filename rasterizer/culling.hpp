@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <littlevk/littlevk.hpp>
+
+struct DeviceRenderContext;
+struct Instances;
+struct NGFResources;
+
+// Depth pyramid for the second (occlusion) pass of the task shader, and the
+// culling and vertex cache counters that the task shader accumulates ahead
+// of the visibility entries of the instances; the counters are read back once
+// the frame that wrote them has completed
+struct OcclusionCulling {
+	enum Counter : uint32_t {
+		eBackface,
+		eFrustum,
+		eOcclusion,
+		eDrawn,
+		eCacheHit,
+		eCacheMiss,
+		eCounterCount
+	};
+
+	vk::Device device;
+	vk::PhysicalDeviceMemoryProperties memory_properties;
+
+	// Power of two pyramid below the framebuffer size, farthest depth per texel
+	vk::Image pyramid;
+	vk::DeviceMemory memory;
+	vk::ImageView view;
+	std::vector <vk::ImageView> mips;
+	vk::Extent2D extent;
+	uint32_t levels = 0;
+
+	// Incremented whenever the pyramid is reallocated, so that descriptor
+	// sets referencing it can be refreshed
+	uint32_t generation = 0;
+
+	vk::Sampler sampler;
+
+	// Reduction, with one set per depth buffer for the first level and one
+	// per level after that
+	littlevk::Pipeline reduction;
+	vk::DescriptorPool descriptor_pool;
+	std::vector <vk::DescriptorSet> dsets;
+
+	// Counter readback per frame in flight
+	littlevk::Buffer readback;
+	littlevk::Buffer zeros;
+	uint32_t *mapped = nullptr;
+	std::array <bool, 2> recorded {};
+	std::array <uint32_t, eCounterCount> counters {};
+
+	void resize(DeviceRenderContext &);
+	void begin(const vk::CommandBuffer &, size_t, const NGFResources *, const Instances &);
+	void build(const vk::CommandBuffer &, const littlevk::Image &, size_t);
+	void end(const vk::CommandBuffer &, size_t, const NGFResources *, const Instances &);
+	void destroy();
+
+	static OcclusionCulling from(DeviceRenderContext &);
+};
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "context.hpp"
+#include "headless.hpp"
+#include "loader.hpp"
+#include "vkutil.hpp"
+
+// Camera paths
+void CameraPath::record(const Transform &transform, double time)
+{
+	if (keyframes.size() >= LIMIT || time - recorded < INTERVAL)
+		return;
+
+	keyframes.push_back(transform);
+	recorded = time;
+
+	if (keyframes.size() == LIMIT)
+		ulog_warning("camera path", "reached %lu keyframes, recording stopped\n", LIMIT);
+}
+
+Transform CameraPath::at(size_t frame, size_t frames) const
+{
+	if (keyframes.size() < 2 || frames < 2)
+		return keyframes.empty() ? Transform() : keyframes.front();
+
+	float t = float(frame) / float(frames - 1) * float(keyframes.size() - 1);
+	size_t i = std::min(size_t(t), keyframes.size() - 2);
+	float alpha = t - float(i);
+
+	const Transform &A = keyframes[i];
+	const Transform &B = keyframes[i + 1];
+
+	Transform result;
+	result.position = glm::mix(A.position, B.position, alpha);
+	result.rotation = glm::mix(A.rotation, B.rotation, alpha);
+	return result;
+}
+
+void CameraPath::save(const std::filesystem::path &path) const
+{
+	std::ofstream file(path);
+	ulog_assert(file, "camera path", "could not open %s\n", path.c_str());
+
+	file << "# px py pz rx ry rz\n";
+	for (const Transform &t : keyframes) {
+		file << t.position.x << " " << t.position.y << " " << t.position.z << " "
+			<< t.rotation.x << " " << t.rotation.y << " " << t.rotation.z << "\n";
+	}
+
+	ulog_info("camera path", "saved %lu keyframes to %s\n", keyframes.size(), path.c_str());
+}
+
+CameraPath CameraPath::load(const std::filesystem::path &path)
+{
+	std::ifstream file(path);
+	ulog_assert(file, "camera path", "could not open %s\n", path.c_str());
+
+	CameraPath result;
+
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		Transform t;
+
+		std::istringstream stream(line);
+		stream >> t.position.x >> t.position.y >> t.position.z
+			>> t.rotation.x >> t.rotation.y >> t.rotation.z;
+
+		ulog_assert(!stream.fail(), "camera path", "malformed keyframe: %s\n", line.c_str());
+
+		result.keyframes.push_back(t);
+	}
+
+	ulog_info("camera path", "loaded %lu keyframes from %s\n", result.keyframes.size(), path.c_str());
+
+	return result;
+}
+
+// Benchmarking
+void benchmark(DeviceRenderContext &engine, ModelLoader &loader,
+		const vk::DescriptorSet &environment_dset,
+		const BenchmarkSettings &settings)
+{
+	// The upload completes on the first polls
+	while (!loader.model()) {
+		loader.poll();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	const NGFResources *model = loader.model();
+
+	CameraPath path;
+	if (!settings.camera_path.empty())
+		path = CameraPath::load(settings.camera_path);
+	else
+		path.keyframes = { engine.camera_transform };
+
+	// Timestamps around the whole frame
+	vk::QueryPool queries = engine.device.createQueryPool({
+		{}, vk::QueryType::eTimestamp, 2
+	});
+
+	float period = engine.phdev.getProperties().limits.timestampPeriod;
+
+	vk::Fence fence = engine.device.createFence({});
+	vk::CommandBuffer cmd = engine.command_buffers[0];
+
+	littlevk::SurfaceOperation op;
+	op.index = 0;
+
+	// Fixed order, for comparable files across runs; modes that the
+	// visibility buffer can resolve are run both ways
+	std::vector <std::pair <std::string, bool>> modes;
+	for (const auto &[key, info] : fragment_shaders) {
+		modes.push_back({ key, false });
+		if (info.resolve >= 0)
+			modes.push_back({ key, true });
+	}
+
+	std::sort(modes.begin(), modes.end());
+
+	std::ofstream csv(settings.output);
+	ulog_assert(csv, "benchmark", "could not open %s\n", settings.output.c_str());
+
+	csv << "mode,instances,resolution,frame,cpu_ms,gpu_ms\n";
+
+	engine.camera.aspect = engine.aspect_ratio();
+
+	Options options;
+	for (const auto &[key, deferred] : modes) {
+		std::string mode = key + (deferred ? " (visibility)" : "");
+
+		for (int resolution : settings.resolutions) {
+			options.key = key;
+			options.visibility = deferred;
+			options.resolution = resolution;
+
+			double cpu_total = 0.0;
+			double gpu_total = 0.0;
+
+			for (size_t frame = 0; frame < settings.frames; frame++) {
+				engine.camera_transform = path.at(frame, settings.frames);
+
+				auto start = std::chrono::high_resolution_clock::now();
+
+				cmd.begin(vk::CommandBufferBeginInfo { vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+				cmd.resetQueryPool(queries, 0, 2);
+				cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, queries, 0);
+
+				littlevk::viewport_and_scissor(cmd, littlevk::RenderArea(engine.window));
+
+				engine.culling.begin(cmd, 0, model, engine.instances);
+				engine.vertex_cache.update(cmd, model, loader.descriptor());
+
+				render_pass_begin(engine, cmd, op, clear_color(options));
+				render_scene(engine, cmd, op, options, model, loader.descriptor(), environment_dset, frame/60.0f);
+				render_pass_end(engine, cmd);
+
+				engine.culling.end(cmd, 0, model, engine.instances);
+
+				cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, queries, 1);
+				cmd.end();
+
+				vk::SubmitInfo submit_info {
+					0, nullptr, nullptr,
+					1, &cmd
+				};
+
+				engine.graphics_queue.submit(submit_info, fence);
+
+				auto end = std::chrono::high_resolution_clock::now();
+
+				(void) engine.device.waitForFences(fence, vk::True, UINT64_MAX);
+				engine.device.resetFences(fence);
+
+				auto timestamps = engine.device.getQueryPoolResults <uint64_t> (queries, 0, 2,
+						2 * sizeof(uint64_t), sizeof(uint64_t),
+						vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait).value;
+
+				double cpu_ms = std::chrono::duration <double, std::milli> (end - start).count();
+				double gpu_ms = double(timestamps[1] - timestamps[0]) * period * 1e-6;
+
+				cpu_total += cpu_ms;
+				gpu_total += gpu_ms;
+
+				csv << mode << "," << engine.instances.count << "," << resolution << "," << frame << ","
+					<< cpu_ms << "," << gpu_ms << "\n";
+			}
+
+			ulog_info("benchmark", "%-23s %4u instances, resolution %2d: %6.3f ms cpu, %6.3f ms gpu (average of %lu frames)\n",
+					mode.c_str(), engine.instances.count, resolution,
+					cpu_total/settings.frames, gpu_total/settings.frames,
+					settings.frames);
+		}
+	}
+
+	ulog_info("benchmark", "wrote %s\n", settings.output.c_str());
+
+	engine.device.destroyFence(fence);
+	engine.device.destroyQueryPool(queries);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+#include <littlevk/littlevk.hpp>
+
+#include "common.hpp"
+
+struct DeviceRenderContext;
+struct ModelLoader;
+
+// Camera keyframes, one "px py pz rx ry rz" line each (rotations in radians)
+struct CameraPath {
+	std::vector <Transform> keyframes;
+
+	// Recording samples the camera every INTERVAL seconds, up to LIMIT keyframes
+	static constexpr double INTERVAL = 0.1;
+	static constexpr size_t LIMIT = 4096;
+
+	double recorded = -INTERVAL;
+
+	void record(const Transform &, double);
+
+	// Linear interpolation over the whole path
+	Transform at(size_t, size_t) const;
+
+	void save(const std::filesystem::path &) const;
+
+	static CameraPath load(const std::filesystem::path &);
+};
+
+struct BenchmarkSettings {
+	size_t frames = 300;
+	std::filesystem::path camera_path;
+	std::filesystem::path output = "benchmark.csv";
+	std::vector <int> resolutions { 2, 4, 8, 12, 15 };
+	vk::Extent2D extent { 1920, 1080 };
+
+	// Copies of the model, in a grid
+	uint32_t instances = 1;
+};
+
+// Replays the camera path for every render mode and tessellation resolution,
+// writing the per-frame CPU (record and submit) and GPU (timestamp) times
+void benchmark(DeviceRenderContext &, ModelLoader &, const vk::DescriptorSet &, const BenchmarkSettings &);
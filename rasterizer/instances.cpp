@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "context.hpp"
+#include "instances.hpp"
+#include "vkutil.hpp"
+
+static void allocate(const vk::Device &device, const vk::PhysicalDeviceMemoryProperties &memory_properties,
+		vk::DeviceSize size, vk::BufferUsageFlags usage, vk::Buffer &buffer, vk::DeviceMemory &memory)
+{
+	if (buffer) {
+		device.destroyBuffer(buffer);
+		device.freeMemory(memory);
+	}
+
+	buffer = device.createBuffer({
+		{}, size, usage,
+		vk::SharingMode::eExclusive
+	});
+
+	auto requirements = device.getBufferMemoryRequirements(buffer);
+
+	memory = device.allocateMemory({
+		requirements.size,
+		memory_type_index(memory_properties, requirements.memoryTypeBits,
+			vk::MemoryPropertyFlagBits::eDeviceLocal)
+	});
+
+	device.bindBufferMemory(buffer, memory, 0);
+}
+
+// Square grid in the XZ plane, centered at the origin, cycling through the assets
+void Instances::arrange(uint32_t instances, float spacing, uint32_t assets)
+{
+	instances = std::max(instances, 1u);
+	assets = std::max(assets, 1u);
+	if (instances == requested.size() && spacing == grid_spacing && assets == asset_count)
+		return;
+
+	grid_spacing = spacing;
+	asset_count = assets;
+
+	uint32_t side = std::ceil(std::sqrt(float(instances)));
+	float center = 0.5f * spacing * (side - 1);
+
+	requested.clear();
+	for (uint32_t i = 0; i < instances; i++) {
+		glm::vec3 position {
+			spacing * (i % side) - center,
+			0.0f,
+			spacing * (i / side) - center
+		};
+
+		requested.push_back({ glm::translate(glm::mat4(1.0f), position), glm::uvec4(i % assets, 0, 0, 0) });
+	}
+
+	dirty = true;
+}
+
+// Uploads the instances and resets the visibility when either the instances
+// or the model changed, with the patch count of the widest asset per
+// instance; waits for the device, so only at frame boundaries
+void Instances::update(DeviceRenderContext &engine, uint32_t patches)
+{
+	if (!dirty && patches == patch_count && buffer)
+		return;
+
+	engine.device.waitIdle();
+
+	count = requested.size();
+	patch_count = patches;
+
+	vk::DeviceSize size = count * sizeof(Instance);
+	if (size > capacity) {
+		capacity = std::max(size, 2 * capacity);
+		allocate(device, memory_properties, capacity,
+			vk::BufferUsageFlagBits::eStorageBuffer
+				| vk::BufferUsageFlagBits::eTransferDst,
+			buffer, memory);
+	}
+
+	vk::DeviceSize visibility_size = (OcclusionCulling::eCounterCount + vk::DeviceSize(count) * patches) * sizeof(uint32_t);
+	if (visibility_size > visibility_capacity) {
+		visibility_capacity = std::max(visibility_size, 2 * visibility_capacity);
+		allocate(device, memory_properties, visibility_capacity,
+			vk::BufferUsageFlagBits::eStorageBuffer
+				| vk::BufferUsageFlagBits::eTransferSrc
+				| vk::BufferUsageFlagBits::eTransferDst,
+			visibility, visibility_memory);
+	}
+
+	littlevk::submit_now(device, engine.command_pool, engine.graphics_queue,
+		[&](const vk::CommandBuffer &cmd) {
+			// Inline updates are limited to 64 KB each
+			const uint8_t *data = (const uint8_t *) requested.data();
+			for (vk::DeviceSize offset = 0; offset < size; offset += 65536) {
+				vk::DeviceSize chunk = std::min <vk::DeviceSize> (65536, size - offset);
+				cmd.updateBuffer(buffer, offset, chunk, data + offset);
+			}
+
+			cmd.fillBuffer(visibility, 0, vk::WholeSize, 0);
+
+			vk::MemoryBarrier barrier {
+				vk::AccessFlagBits::eTransferWrite,
+				vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite
+			};
+
+			cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+				vk::PipelineStageFlagBits::eTaskShaderEXT | vk::PipelineStageFlagBits::eMeshShaderEXT,
+				{}, barrier, {}, {});
+		}
+	);
+
+	dirty = false;
+	generation++;
+
+	ulog_info("instances", "%u instances of %u patches\n", count, patches);
+}
+
+void Instances::destroy()
+{
+	if (buffer) {
+		device.destroyBuffer(buffer);
+		device.freeMemory(memory);
+	}
+
+	if (visibility) {
+		device.destroyBuffer(visibility);
+		device.freeMemory(visibility_memory);
+	}
+}
+
+Instances Instances::from(DeviceRenderContext &engine)
+{
+	Instances instances;
+	instances.device = engine.device;
+	instances.memory_properties = engine.memory_properties;
+	instances.arrange(1, 0.0f, 1);
+
+	// Allocated up front, so that descriptor sets can always reference them
+	instances.update(engine, 0);
+
+	return instances;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <littlevk/littlevk.hpp>
+
+struct DeviceRenderContext;
+
+// Transform and asset of an instance, as read by the task and mesh shaders
+struct Instance {
+	glm::mat4 transform;
+	glm::uvec4 asset;
+};
+
+// Instances of the assets of the loaded model, drawn as a grid of (patch,
+// instance) task workgroups; the instances and, separately, the culling
+// counters followed by the visibility of every pair live in storage buffers
+// that are reallocated whenever the instances or the model change
+struct Instances {
+	vk::Device device;
+	vk::PhysicalDeviceMemoryProperties memory_properties;
+
+	// Requested instances, uploaded on the next update
+	std::vector <Instance> requested;
+	float grid_spacing = 0.0f;
+	uint32_t asset_count = 0;
+	bool dirty = true;
+
+	// Uploaded state
+	uint32_t count = 0;
+	uint32_t patch_count = 0;
+
+	vk::Buffer buffer;
+	vk::DeviceMemory memory;
+	vk::DeviceSize capacity = 0;
+
+	vk::Buffer visibility;
+	vk::DeviceMemory visibility_memory;
+	vk::DeviceSize visibility_capacity = 0;
+
+	// Incremented whenever the buffers are reallocated, so that descriptor
+	// sets referencing them can be refreshed
+	uint32_t generation = 0;
+
+	void arrange(uint32_t, float, uint32_t);
+	void update(DeviceRenderContext &, uint32_t);
+	void destroy();
+
+	static Instances from(DeviceRenderContext &);
+};
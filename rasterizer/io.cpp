@@ -1,4 +1,16 @@
-#include <fstream>
+#include <cerrno>
+#include <cstring>
+#include <span>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glm/gtc/packing.hpp>
+
+#include <zlib.h>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb/stb_image_write.h>
@@ -9,74 +21,336 @@
 #include "io.hpp"
 #include "microlog.h"
 
-NGF NGF::load(const std::filesystem::path &path)
+// Memory mapping
+MappedFile::MappedFile(MappedFile &&other)
 {
-	NGF ngf;
+	*this = std::move(other);
+}
+
+MappedFile::~MappedFile()
+{
+	if (address)
+		munmap(const_cast <uint8_t *> (address), length);
+}
 
-	std::ifstream fin(path);
-	ulog_assert(fin.good(), "Bad ngf file %s\n", path.c_str());
+MappedFile &MappedFile::operator=(MappedFile &&other)
+{
+	if (this != &other) {
+		if (address)
+			munmap(const_cast <uint8_t *> (address), length);
 
-	int32_t sizes[3];
-	fin.read(reinterpret_cast <char *> (sizes), sizeof(sizes));
-	ulog_info("ngf io", "%d patches, %d vertices, %d feature size\n", sizes[0], sizes[1], sizes[2]);
+		address = std::exchange(other.address, nullptr);
+		length = std::exchange(other.length, 0);
+	}
+
+	return *this;
+}
+
+MappedFile MappedFile::open(const std::filesystem::path &path)
+{
+	MappedFile file;
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	ulog_assert(fd >= 0, "mmap", "could not open %s\n", path.c_str());
+
+	struct stat st;
+	fstat(fd, &st);
+
+	file.length = st.st_size;
+
+	void *address = mmap(nullptr, file.length, PROT_READ, MAP_PRIVATE, fd, 0);
+	ulog_assert(address != MAP_FAILED, "mmap", "could not map %s\n", path.c_str());
+
+	// The whole file is consumed front to back; the advice values are not
+	// flags, so each is given separately
+	for (int advice : { MADV_SEQUENTIAL, MADV_WILLNEED }) {
+		if (madvise(address, file.length, advice) != 0)
+			ulog_warning("mmap", "madvise(%d) failed for %s: %s\n", advice, path.c_str(), strerror(errno));
+	}
+
+	close(fd);
+
+	file.address = reinterpret_cast <const uint8_t *> (address);
+	return file;
+}
+
+// Sequential reads from an in-memory section
+struct SectionReader {
+	std::span <const uint8_t> data;
+	size_t offset = 0;
+
+	std::span <const uint8_t> take(size_t bytes) {
+		ulog_assert(offset + bytes <= data.size(), "ngf io", "truncated section\n");
+		auto result = data.subspan(offset, bytes);
+		offset += bytes;
+		return result;
+	}
+
+	void read(void *dst, size_t bytes) {
+		std::memcpy(dst, take(bytes).data(), bytes);
+	}
+
+	template <typename T>
+	T read() {
+		T value;
+		read(&value, sizeof(T));
+		return value;
+	}
+};
+
+// Aligned data is used in place, anything else is copied once
+template <typename T>
+static std::span <const T> view(NGF &ngf, std::span <const uint8_t> bytes)
+{
+	size_t count = bytes.size() / sizeof(T);
+	if (reinterpret_cast <uintptr_t> (bytes.data()) % alignof(T) == 0)
+		return { reinterpret_cast <const T *> (bytes.data()), count };
+
+	std::span <T> copy = ngf.allocate <T> (count);
+	std::memcpy(copy.data(), bytes.data(), count * sizeof(T));
+	return copy;
+}
+
+// Verifies the checksum and inflates the section if necessary
+static std::span <const uint8_t> section_payload(NGF &ngf, const format::Section &section)
+{
+	std::span <const uint8_t> file = ngf.file.bytes();
+	ulog_assert(section.offset + section.size <= file.size(), "ngf io", "section %u is out of bounds\n", section.tag);
+
+	std::span <const uint8_t> stored = file.subspan(section.offset, section.size);
+
+	uint32_t crc = crc32(0L, stored.data(), stored.size());
+	ulog_assert(crc == section.crc, "ngf io", "checksum mismatch in section %u\n", section.tag);
+
+	if (!(section.encoding & format::eDeflate))
+		return stored;
+
+	std::span <uint8_t> raw = ngf.allocate <uint8_t> (section.raw);
+
+	uLongf length = section.raw;
+	int status = uncompress(raw.data(), &length, stored.data(), stored.size());
+	ulog_assert(status == Z_OK && length == section.raw, "ngf io", "failed to inflate section %u\n", section.tag);
+
+	return raw;
+}
+
+// Dequantization directly into the upload layout
+static void decode_vertices(SectionReader reader, uint32_t encoding, std::vector <glm::vec4> &vertices)
+{
+	switch (encoding & 0xff) {
+	case format::eFloat32:
+		for (auto &v : vertices) {
+			float p[3];
+			reader.read(p, sizeof(p));
+			v = glm::vec4(p[0], p[1], p[2], 0.0f);
+		}
+		break;
+	case format::eFloat16:
+		for (auto &v : vertices) {
+			uint16_t h[3];
+			reader.read(h, sizeof(h));
+			v = glm::vec4(glm::unpackHalf1x16(h[0]), glm::unpackHalf1x16(h[1]), glm::unpackHalf1x16(h[2]), 0.0f);
+		}
+		break;
+	case format::eQuantized:
+	{
+		// 16-bit fixed point within the bounding box
+		glm::vec3 min;
+		glm::vec3 extent;
+		reader.read(&min, sizeof(min));
+		reader.read(&extent, sizeof(extent));
+
+		for (auto &v : vertices) {
+			uint16_t q[3];
+			reader.read(q, sizeof(q));
+			v = glm::vec4(min + extent * glm::vec3(q[0], q[1], q[2])/65535.0f, 0.0f);
+		}
+	} break;
+	default:
+		ulog_assert(false, "ngf io", "unknown vertex encoding %u\n", encoding);
+	}
+}
+
+static std::span <const float> decode_features(NGF &ngf, SectionReader reader, uint32_t encoding, size_t count)
+{
+	if ((encoding & 0xff) == format::eFloat32)
+		return view <float> (ngf, reader.take(count * sizeof(float)));
 
-	std::vector <glm::ivec4> patches;
-	std::vector <glm::vec3> vertices;
-	std::vector <float> features;
+	std::span <float> features = ngf.allocate <float> (count);
 
-	patches.resize(sizes[0]);
-	vertices.resize(sizes[1]);
-	features.resize(sizes[1] * sizes[2]);
+	switch (encoding & 0xff) {
+	case format::eFloat16:
+		for (float &f : features)
+			f = glm::unpackHalf1x16(reader.read <uint16_t> ());
+		break;
+	case format::eQuantized:
+	{
+		// 8-bit values with a range per feature channel
+		uint32_t feature_size = ngf.feature_size;
+
+		std::vector <float> min(feature_size);
+		std::vector <float> scale(feature_size);
+		reader.read(min.data(), feature_size * sizeof(float));
+		reader.read(scale.data(), feature_size * sizeof(float));
+
+		std::span <const uint8_t> q = reader.take(count);
+		for (size_t i = 0; i < count; i++) {
+			uint32_t j = i % feature_size;
+			features[i] = min[j] + scale[j] * q[i];
+		}
+	} break;
+	default:
+		ulog_assert(false, "ngf io", "unknown feature encoding %u\n", encoding);
+	}
+
+	return features;
+}
+
+// Same records as QuantizedMLP::stream() in the extensions
+static void decode_network(NGF &ngf, SectionReader reader)
+{
+	for (int32_t i = 0; i < LAYERS; i++) {
+		int32_t rows = reader.read <int32_t> ();
+		int32_t cols = reader.read <int32_t> ();
+		int32_t precision = reader.read <int32_t> ();
+		ulog_info("ngf io", "weight matrix with size %d x %d (precision %d)\n", rows, cols, precision);
+
+		size_t count = rows * cols;
+
+		ulog_assert(precision == format::eFloat32 || precision == format::eFloat16 || precision == format::eQuantized,
+				"ngf io", "unknown precision %d of weight matrix %d\n", precision, i);
+
+		if (precision == format::eFloat32) {
+			ngf.weights[i] = Tensor { view <float> (ngf, reader.take(count * sizeof(float))), rows, cols };
+			continue;
+		}
+
+		std::span <float> values = ngf.allocate <float> (count);
+		if (precision == format::eFloat16) {
+			for (float &f : values)
+				f = glm::unpackHalf1x16(reader.read <uint16_t> ());
+		} else {
+			std::vector <float> scales(rows);
+			reader.read(scales.data(), rows * sizeof(float));
+
+			std::span <const uint8_t> q = reader.take(count);
+			for (size_t k = 0; k < count; k++)
+				values[k] = scales[k / cols] * int8_t(q[k]);
+		}
+
+		ngf.weights[i] = Tensor { values, rows, cols };
+	}
+
+	for (int32_t i = 0; i < LAYERS; i++) {
+		int32_t size = reader.read <int32_t> ();
+		ulog_info("ngf io", "bias vector with size %d\n", size);
+
+		ngf.biases[i] = Tensor { view <float> (ngf, reader.take(size * sizeof(float))), size, 1 };
+	}
+}
+
+static void load_v2(NGF &ngf)
+{
+	SectionReader header { ngf.file.bytes() };
+	header.offset = sizeof(uint32_t);
+
+	uint32_t version = header.read <uint32_t> ();
+	ulog_assert(version <= format::VERSION, "ngf io", "unsupported format version %u\n", version);
+
+	uint32_t count = header.read <uint32_t> ();
+	header.read <uint32_t> ();
+
+	std::vector <format::Section> sections(count);
+	header.read(sections.data(), count * sizeof(format::Section));
+
+	auto find = [&](uint32_t tag) -> const format::Section & {
+		for (const auto &section : sections) {
+			if (section.tag == tag)
+				return section;
+		}
+
+		ulog_error("ngf io", "missing section %u\n", tag);
+		exit(EXIT_FAILURE);
+	};
+
+	SectionReader info { section_payload(ngf, find(format::eInfo)) };
+	int32_t patches = info.read <int32_t> ();
+	int32_t vertices = info.read <int32_t> ();
+	int32_t feature_size = info.read <int32_t> ();
+	int32_t layers = info.read <int32_t> ();
+	ulog_info("ngf io", "%d patches, %d vertices, %d feature size\n", patches, vertices, feature_size);
+	ulog_assert(layers == LAYERS, "ngf io", "expected %d layers, got %d\n", LAYERS, layers);
+
+	ngf.patch_count = patches;
+	ngf.feature_size = feature_size;
+
+	const auto &vsection = find(format::eVertices);
+	ngf.vertices.resize(vertices);
+	decode_vertices({ section_payload(ngf, vsection) }, vsection.encoding, ngf.vertices);
+
+	const auto &fsection = find(format::eFeatures);
+	ngf.features = decode_features(ngf, { section_payload(ngf, fsection) }, fsection.encoding, vertices * feature_size);
+
+	SectionReader complexes { section_payload(ngf, find(format::eComplexes)) };
+	ngf.patches = view <glm::ivec4> (ngf, complexes.take(patches * sizeof(glm::ivec4)));
+
+	ulog_info("ngf io", "read patches data\n");
+
+	decode_network(ngf, { section_payload(ngf, find(format::eNetwork)) });
+}
+
+// Original layout without a header
+static void load_v1(NGF &ngf)
+{
+	SectionReader reader { ngf.file.bytes() };
+
+	int32_t sizes[3];
+	reader.read(sizes, sizeof(sizes));
+	ulog_info("ngf io", "%d patches, %d vertices, %d feature size\n", sizes[0], sizes[1], sizes[2]);
 
 	ngf.patch_count = sizes[0];
 	ngf.feature_size = sizes[2];
 
-	fin.read(reinterpret_cast <char *> (vertices.data()), vertices.size() * sizeof(glm::vec3));
-	fin.read(reinterpret_cast <char *> (features.data()), features.size() * sizeof(float));
-	fin.read(reinterpret_cast <char *> (patches.data()), patches.size() * sizeof(glm::ivec4));
+	// Vertices are widened straight from the mapped pages
+	ngf.vertices.resize(sizes[1]);
+	decode_vertices({ reader.take(sizes[1] * sizeof(glm::vec3)) }, format::eFloat32, ngf.vertices);
+
+	ngf.features = view <float> (ngf, reader.take(sizes[1] * sizes[2] * sizeof(float)));
+	ngf.patches = view <glm::ivec4> (ngf, reader.take(sizes[0] * sizeof(glm::ivec4)));
 
 	ulog_info("ngf io", "read patches data\n");
 
-	std::array <Tensor, LAYERS> weights;
 	for (int32_t i = 0; i < LAYERS; i++) {
 		int32_t sizes[2];
-		fin.read(reinterpret_cast <char *> (sizes), sizeof(sizes));
+		reader.read(sizes, sizeof(sizes));
 		ulog_info("ngf io", "weight matrix with size %d x %d\n", sizes[0], sizes[1]);
 
-		Tensor w;
-		w.width = sizes[0];
-		w.height = sizes[1];
-		w.resize(sizes[0] * sizes[1]);
-		fin.read(reinterpret_cast <char *> (w.data()), w.size() * sizeof(float));
-
-		weights[i] = w;
+		auto data = view <float> (ngf, reader.take(sizes[0] * sizes[1] * sizeof(float)));
+		ngf.weights[i] = Tensor { data, sizes[0], sizes[1] };
 	}
 
-	std::array <Tensor, LAYERS> biases;
 	for (int32_t i = 0; i < LAYERS; i++) {
-		int32_t size;
-		fin.read(reinterpret_cast <char *> (&size), sizeof(size));
+		int32_t size = reader.read <int32_t> ();
 		ulog_info("ngf io", "bias vector with size %d\n", size);
 
-		Tensor w;
-		w.width = size;
-		w.height = 1;
-		w.resize(size);
-		fin.read(reinterpret_cast <char *> (w.data()), w.size() * sizeof(float));
-
-		biases[i] = w;
+		ngf.biases[i] = Tensor { view <float> (ngf, reader.take(size * sizeof(float))), size, 1 };
 	}
+}
+
+NGF NGF::load(const std::filesystem::path &path)
+{
+	NGF ngf;
+
+	ngf.file = MappedFile::open(path);
+	ulog_assert(ngf.file.length >= sizeof(uint32_t), "ngf io", "bad ngf file %s\n", path.c_str());
 
-	ngf.patches = patches;
-	ngf.features = features;
-	ngf.weights = weights;
-	ngf.biases = biases;
+	uint32_t magic;
+	std::memcpy(&magic, ngf.file.address, sizeof(magic));
 
-	// TODO: put this elsewhere..
-	// Need special care for vertices to align them properly
-	ngf.vertices.resize(vertices.size());
-	for (int32_t i = 0; i < vertices.size(); i++)
-		ngf.vertices[i] = glm::vec4(vertices[i], 0.0f);
+	if (magic == format::MAGIC)
+		load_v2(ngf);
+	else
+		load_v1(ngf);
 
 	return ngf;
 }
@@ -3,21 +3,84 @@
 #include <array>
 #include <cstdint>
 #include <filesystem>
+#include <span>
 #include <vector>
 
 #include <glm/glm.hpp>
 
 constexpr int32_t LAYERS = 4;
 
-struct Tensor : std::vector <float> {
+// Versioned NGF format; a 16 byte header (magic, version, section count,
+// reserved) is followed by the section table and the section payloads
+namespace format {
+
+constexpr uint32_t MAGIC = 0x3246474e; // "NGF2"
+constexpr uint32_t VERSION = 2;
+
+enum Tag : uint32_t {
+	eInfo = 1,
+	eVertices = 2,
+	eFeatures = 3,
+	eComplexes = 4,
+	eNetwork = 5,
+};
+
+// Lower byte selects the value encoding, the deflate flag can be combined with any
+enum Encoding : uint32_t {
+	eFloat32 = 0,
+	eFloat16 = 1,
+	eQuantized = 2,
+	eDeflate = 1 << 8,
+};
+
+struct Section {
+	uint32_t tag;
+	uint32_t encoding;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t raw;
+	uint32_t crc;
+	uint32_t reserved;
+};
+
+static_assert(sizeof(Section) == 40);
+
+}
+
+// Read-only mapping of a file, unmapped on destruction
+struct MappedFile {
+	const uint8_t *address = nullptr;
+	size_t length = 0;
+
+	MappedFile() = default;
+	MappedFile(const MappedFile &) = delete;
+	MappedFile(MappedFile &&);
+	~MappedFile();
+
+	MappedFile &operator=(const MappedFile &) = delete;
+	MappedFile &operator=(MappedFile &&);
+
+	std::span <const uint8_t> bytes() const {
+		return { address, length };
+	}
+
+	static MappedFile open(const std::filesystem::path &);
+};
+
+// Views into the mapped file, or into decoded storage
+struct Tensor : std::span <const float> {
 	int32_t width;
 	int32_t height;
 };
 
 struct NGF {
-	std::vector <glm::ivec4> patches;
+	// Backing memory for the views below
+	MappedFile file;
+	std::vector <std::vector <uint8_t>> storage;
+
+	std::span <const glm::ivec4> patches;
 	std::vector <glm::vec4> vertices;
-	std::vector <float> features;
+	std::span <const float> features;
 
 	uint32_t patch_count;
 	uint32_t feature_size;
@@ -25,6 +88,12 @@ struct NGF {
 	std::array <Tensor, LAYERS> weights;
 	std::array <Tensor, LAYERS> biases;
 
+	template <typename T>
+	std::span <T> allocate(size_t count) {
+		storage.emplace_back(count * sizeof(T));
+		return { reinterpret_cast <T *> (storage.back().data()), count };
+	}
+
 	static NGF load(const std::filesystem::path &);
 };
 
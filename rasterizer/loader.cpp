@@ -0,0 +1,452 @@
+#include <chrono>
+#include <utility>
+
+#include <sys/resource.h>
+
+#include <glm/gtc/packing.hpp>
+
+#include "bounds.hpp"
+#include "context.hpp"
+#include "loader.hpp"
+#include "vkutil.hpp"
+#include "microlog.h"
+
+HomogenizedNGF HomogenizedNGF::from(const NGF &ngf)
+{
+	std::vector <float> parameters;
+
+	// Hidden layers, transposed in one pass over the source rows
+	for (int32_t l = 0; l < LAYERS - 1; l++) {
+		const auto &W = ngf.weights[l];
+
+		size_t inputs = W.height;
+		size_t offset = parameters.size();
+		parameters.resize(offset + 64 * inputs);
+
+		for (size_t i = 0; i < 64; i++) {
+			for (size_t j = 0; j < inputs; j++)
+				parameters[offset + j * 64 + i] = W[i * inputs + j];
+		}
+
+		parameters.insert(parameters.end(), ngf.biases[l].begin(), ngf.biases[l].end());
+	}
+
+	const auto &W3 = ngf.weights[LAYERS - 1];
+	const auto &b3 = ngf.biases[LAYERS - 1];
+	parameters.insert(parameters.end(), W3.begin(), W3.end());
+	parameters.insert(parameters.end(), b3.begin(), b3.end());
+
+	// Align to vec4 size
+	parameters.resize(4 * ((parameters.size() + 3)/4));
+
+	// Feature vector
+	std::vector <glm::vec4> features(ngf.patch_count * ngf.feature_size);
+
+	for (size_t i = 0; i < ngf.patch_count; i++) {
+		glm::ivec4 complex = ngf.patches[i];
+		for (size_t j = 0; j < ngf.feature_size; j++) {
+			float f0 = ngf.features[complex.x * ngf.feature_size + j];
+			float f1 = ngf.features[complex.y * ngf.feature_size + j];
+			float f2 = ngf.features[complex.z * ngf.feature_size + j];
+			float f3 = ngf.features[complex.w * ngf.feature_size + j];
+			features[i * ngf.feature_size + j] = glm::vec4(f0, f1, f2, f3);
+		}
+	}
+
+	return HomogenizedNGF {
+		.patches = ngf.patches,
+		.vertices = ngf.vertices,
+		.features = std::move(features),
+		.parameters = std::move(parameters),
+	};
+}
+
+HomogenizedNGF HomogenizedNGF::pack(const std::vector <NGF> &ngfs)
+{
+	// A single model stays a view into its file
+	if (ngfs.size() == 1)
+		return from(ngfs[0]);
+
+	HomogenizedNGF result;
+	for (const NGF &ngf : ngfs) {
+		HomogenizedNGF hngf = from(ngf);
+
+		int32_t base = result.packed_vertices.size();
+		for (const glm::ivec4 &complex : hngf.patches)
+			result.packed_patches.push_back(complex + base);
+
+		result.packed_vertices.insert(result.packed_vertices.end(), hngf.vertices.begin(), hngf.vertices.end());
+		result.features.insert(result.features.end(), hngf.features.begin(), hngf.features.end());
+		result.parameters.insert(result.parameters.end(), hngf.parameters.begin(), hngf.parameters.end());
+	}
+
+	// Moving the vectors keeps their storage, so the views stay valid
+	result.patches = result.packed_patches;
+	result.vertices = result.packed_vertices;
+
+	return result;
+}
+
+// Conversion for the half precision parameters, read in pairs by the shaders
+static std::vector <uint16_t> halves(std::span <const float> buffer)
+{
+	std::vector <uint16_t> result(buffer.size());
+	for (size_t i = 0; i < buffer.size(); i++)
+		result[i] = glm::packHalf1x16(buffer[i]);
+
+	return result;
+}
+
+// Load time and peak resident memory, for comparing loaders
+static void report_load(const std::filesystem::path &path, std::chrono::high_resolution_clock::time_point start)
+{
+	auto end = std::chrono::high_resolution_clock::now();
+	double ms = std::chrono::duration <double, std::milli> (end - start).count();
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	ulog_info("ngf io", "loaded %s in %.2f ms (peak RSS %ld KB)\n", path.c_str(), ms, usage.ru_maxrss);
+}
+
+// Buffer recycling
+BufferPool::Entry BufferPool::acquire(const vk::Device &device,
+		const vk::PhysicalDeviceMemoryProperties &memory_properties,
+		vk::DeviceSize size)
+{
+	{
+		std::lock_guard guard(lock);
+
+		auto best = free.end();
+		for (auto it = free.begin(); it != free.end(); it++) {
+			if (it->size >= size && (best == free.end() || it->size < best->size))
+				best = it;
+		}
+
+		if (best != free.end()) {
+			Entry entry = *best;
+			free.erase(best);
+			return entry;
+		}
+	}
+
+	vk::Buffer buffer = device.createBuffer({
+		{}, size,
+		vk::BufferUsageFlagBits::eStorageBuffer
+			| vk::BufferUsageFlagBits::eIndirectBuffer
+			| vk::BufferUsageFlagBits::eTransferDst,
+		vk::SharingMode::eExclusive
+	});
+
+	auto requirements = device.getBufferMemoryRequirements(buffer);
+
+	vk::DeviceMemory memory = device.allocateMemory({
+		requirements.size,
+		memory_type_index(memory_properties, requirements.memoryTypeBits,
+			vk::MemoryPropertyFlagBits::eDeviceLocal)
+	});
+
+	device.bindBufferMemory(buffer, memory, 0);
+
+	return Entry { buffer, memory, size };
+}
+
+void BufferPool::release(const Entry &entry)
+{
+	std::lock_guard guard(lock);
+	free.push_back(entry);
+}
+
+void BufferPool::destroy(const vk::Device &device)
+{
+	std::lock_guard guard(lock);
+	for (const auto &entry : free) {
+		device.destroyBuffer(entry.buffer);
+		device.freeMemory(entry.memory);
+	}
+
+	free.clear();
+}
+
+// Model loading
+ModelLoader::ModelLoader(DeviceRenderContext &engine_) : engine(engine_)
+{
+	sampler = littlevk::SamplerAssembler(engine.device, engine.dal);
+
+	for (auto &dset : dsets) {
+		dset = littlevk::bind(engine.device, engine.descriptor_pool)
+			.allocate_descriptor_sets(engine.meshlet_dsl).front();
+	}
+
+	worker = std::thread(&ModelLoader::run, this);
+}
+
+void ModelLoader::request(const std::vector <std::filesystem::path> &paths, std::optional <NGF> ngf)
+{
+	{
+		std::lock_guard guard(lock);
+		requested = Request { paths, std::move(ngf) };
+	}
+
+	cv.notify_one();
+}
+
+void ModelLoader::run()
+{
+	while (true) {
+		Request request;
+
+		{
+			std::unique_lock guard(lock);
+			cv.wait(guard, [&]() { return stop || requested; });
+			if (stop)
+				return;
+
+			request = std::move(*requested);
+			requested.reset();
+		}
+
+		auto resources = prepare(request);
+		if (!resources)
+			continue;
+
+		std::lock_guard guard(lock);
+		ready = std::move(resources);
+	}
+}
+
+std::optional <NGFResources> ModelLoader::prepare(Request &request)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// The assets share the pipelines, which are specialized for one feature size
+	std::vector <NGF> ngfs;
+	for (size_t i = 0; i < request.paths.size(); i++) {
+		NGF ngf = (i == 0 && request.ngf) ? std::move(*request.ngf) : NGF::load(request.paths[i]);
+		if (!ngfs.empty() && ngf.feature_size != ngfs[0].feature_size) {
+			ulog_warning("loader", "skipping %s, whose feature size %u differs from %u\n",
+					request.paths[i].c_str(), ngf.feature_size, ngfs[0].feature_size);
+			continue;
+		}
+
+		ngfs.push_back(std::move(ngf));
+	}
+
+	if (ngfs.empty())
+		return std::nullopt;
+
+	HomogenizedNGF hngf = HomogenizedNGF::pack(ngfs);
+
+	NGFResources resources;
+	resources.feature_size = ngfs[0].feature_size;
+	resources.path = request.paths[0];
+
+	std::vector <glm::vec4> bounds;
+	for (const NGF &ngf : ngfs) {
+		std::vector <glm::vec4> asset_bounds = patch_bounds(ngf);
+		bounds.insert(bounds.end(), asset_bounds.begin(), asset_bounds.end());
+
+		resources.assets.push_back(glm::uvec4(resources.patch_count, ngf.patch_count, 0, 0));
+		resources.widest = std::max(resources.widest, ngf.patch_count);
+		resources.patch_count += ngf.patch_count;
+		resources.kbs += ngf.file.length/1024;
+	}
+
+	// Gather everything first, so that the staging arena is sized once for the batch
+	std::array <std::span <const uint8_t>, 8> buffers;
+
+	auto stage_buffer = [&](uint32_t index, const auto &buffer) {
+		std::span data(buffer);
+		buffers[index] = { (const uint8_t *) data.data(), data.size_bytes() };
+		resources.buffers[index] = buffer_pool.acquire(engine.device, engine.memory_properties, data.size_bytes());
+	};
+
+	uint32_t patches = hngf.patches.size();
+
+	stage_buffer(0, hngf.features);
+
+	std::vector <uint16_t> half_parameters;
+	if (engine.half_precision) {
+		half_parameters = halves(hngf.parameters);
+		stage_buffer(1, half_parameters);
+	} else {
+		stage_buffer(1, hngf.parameters);
+	}
+
+	stage_buffer(2, resources.assets);
+	stage_buffer(5, bounds);
+	stage_buffer(6, hngf.patches);
+	stage_buffer(7, hngf.vertices);
+
+	// Vertex cache, with only the state initialized
+	resources.buffers[3] = buffer_pool.acquire(engine.device, engine.memory_properties,
+			VertexCache::cache_size(patches));
+	resources.buffers[4] = buffer_pool.acquire(engine.device, engine.memory_properties,
+			VertexCache::state_size(patches));
+
+	vk::DeviceSize total = 0;
+	for (const auto &b : buffers)
+		total += Uploader::aligned(b.size());
+
+	// Wait for the previous batch to complete before reusing the arena
+	{
+		std::unique_lock guard(lock);
+		cv.wait(guard, [&]() { return stop || !uploading; });
+		if (stop) {
+			release(resources);
+			return std::nullopt;
+		}
+
+		uploading = true;
+	}
+
+	Uploader &uploader = engine.uploader;
+	uploader.reserve(total);
+	uploader.begin();
+
+	// The vertex cache is not uploaded, only filled below
+	for (uint32_t i = 0; i < buffers.size(); i++) {
+		if (!buffers[i].empty())
+			uploader.upload(resources.buffers[i].buffer, buffers[i]);
+	}
+
+	// Empty miss list, dispatched as (0, 1, 1) workgroups
+	const vk::Buffer &state = resources.buffers[4].buffer;
+	uploader.fill(state, 0, VertexCache::state_size(patches), 0);
+	uploader.fill(state, sizeof(uint32_t), 2 * sizeof(uint32_t), 1);
+
+	report_load(request.paths[0], start);
+
+	return resources;
+}
+
+bool ModelLoader::poll()
+{
+	frame++;
+
+	// Release the previous model once no frame in flight can reference it
+	if (retired && frame >= retire_frame) {
+		release(*retired);
+		retired.reset();
+	}
+
+	bool swapped = false;
+	if (inflight && engine.uploader.complete()) {
+		uint32_t next = 1 - active;
+
+		const auto &buffers = inflight->buffers;
+
+		// Models with another feature size only need the pipelines specialized
+		engine.specialize(inflight->feature_size);
+
+		// The buffers may be larger recycled ones, while the shaders derive
+		// the slot and asset counts from the bound ranges
+		uint32_t patches = inflight->patch_count;
+		vk::DeviceSize table = inflight->assets.size() * sizeof(glm::uvec4);
+
+		littlevk::bind(engine.device, dsets[next], meshlet_dslbs)
+			.update(0, 0, buffers[6].buffer, 0, vk::WholeSize)
+			.update(1, 0, buffers[7].buffer, 0, vk::WholeSize)
+			.update(2, 0, buffers[0].buffer, 0, vk::WholeSize)
+			.update(3, 0, buffers[1].buffer, 0, vk::WholeSize)
+			.update(4, 0, buffers[5].buffer, 0, vk::WholeSize)
+			.update(5, 0, engine.instances.visibility, 0, vk::WholeSize)
+			.update(6, 0, sampler, engine.culling.view, vk::ImageLayout::eGeneral)
+			.update(7, 0, buffers[3].buffer, 0, VertexCache::cache_size(patches))
+			.update(8, 0, buffers[4].buffer, 0, VertexCache::state_size(patches))
+			.update(9, 0, engine.instances.buffer, 0, vk::WholeSize)
+			.update(10, 0, buffers[2].buffer, 0, table)
+			.finalize();
+
+		ulog_info("loader", "uploaded %s in %.2f ms\n", inflight->path.c_str(), engine.uploader.milliseconds);
+
+		// Exchanged, since a moved-from optional would keep the handles
+		retired = std::exchange(slots[active], std::nullopt);
+		retire_frame = frame + 2;
+
+		slots[next] = std::move(inflight);
+		active = next;
+
+		inflight.reset();
+		swapped = true;
+
+		// The staging arena is free for the next model
+		{
+			std::lock_guard guard(lock);
+			uploading = false;
+		}
+
+		cv.notify_one();
+	}
+
+	// The spare descriptor set is only free again once the retired model is gone
+	if (!inflight && !retired) {
+		{
+			std::lock_guard guard(lock);
+			inflight = std::move(ready);
+			ready.reset();
+		}
+
+		if (inflight)
+			engine.uploader.submit(engine.graphics_queue);
+	}
+
+	if (const NGFResources *resources = model())
+		engine.instances.update(engine, resources->widest);
+
+	refresh();
+
+	return swapped;
+}
+
+// The depth pyramid and the instance buffers are only reallocated after
+// waiting for the device, and no frame has been submitted since
+void ModelLoader::refresh()
+{
+	if (pyramid_generation != engine.culling.generation) {
+		for (auto &dset : dsets) {
+			littlevk::bind(engine.device, dset, meshlet_dslbs)
+				.update(6, 0, sampler, engine.culling.view, vk::ImageLayout::eGeneral)
+				.finalize();
+		}
+
+		pyramid_generation = engine.culling.generation;
+	}
+
+	if (instances_generation != engine.instances.generation) {
+		for (auto &dset : dsets) {
+			littlevk::bind(engine.device, dset, meshlet_dslbs)
+				.update(5, 0, engine.instances.visibility, 0, vk::WholeSize)
+				.update(9, 0, engine.instances.buffer, 0, vk::WholeSize)
+				.finalize();
+		}
+
+		instances_generation = engine.instances.generation;
+	}
+}
+
+void ModelLoader::release(const NGFResources &resources)
+{
+	for (const auto &entry : resources.buffers)
+		buffer_pool.release(entry);
+}
+
+void ModelLoader::drop()
+{
+	{
+		std::lock_guard guard(lock);
+		stop = true;
+	}
+
+	cv.notify_one();
+	worker.join();
+
+	engine.device.waitIdle();
+
+	for (auto *resources : { &ready, &inflight, &retired, &slots[0], &slots[1] }) {
+		if (*resources)
+			release(**resources);
+	}
+
+	buffer_pool.destroy(engine.device);
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+
+#include <littlevk/littlevk.hpp>
+
+#include "io.hpp"
+
+struct DeviceRenderContext;
+
+// Patches and vertices are already in the upload layout and remain views into
+// the NGF, which must outlive the upload. The network parameters are packed
+// layer by layer as [W0, b0, W1, b1, W2, b2, W3, b3]; the hidden layers are
+// stored by input, so four consecutive outputs form one vec4, while the last
+// layer is stored by output and its bias is padded to a vec4
+struct HomogenizedNGF {
+	std::span <const glm::ivec4> patches;
+	std::span <const glm::vec4> vertices;
+	std::vector <glm::vec4> features;
+	std::vector <float> parameters;
+
+	// Storage behind the views when several models are packed, with the
+	// vertex indices of the patches offset into the packed vertices
+	std::vector <glm::ivec4> packed_patches;
+	std::vector <glm::vec4> packed_vertices;
+
+	static HomogenizedNGF from(const NGF &);
+
+	// Models of the same feature size one after the other, so that their
+	// parameters are blocks of the same size
+	static HomogenizedNGF pack(const std::vector <NGF> &);
+};
+
+// Device local storage buffers, recycled across models; the shaders index
+// them explicitly, so any buffer at least as large can be reused
+struct BufferPool {
+	struct Entry {
+		vk::Buffer buffer;
+		vk::DeviceMemory memory;
+		vk::DeviceSize size;
+	};
+
+	std::mutex lock;
+	std::vector <Entry> free;
+
+	Entry acquire(const vk::Device &, const vk::PhysicalDeviceMemoryProperties &, vk::DeviceSize);
+
+	void release(const Entry &);
+	void destroy(const vk::Device &);
+};
+
+// GPU resources of a model, which packs one or more assets; the buffers are
+// the features, the networks, the asset table, the vertex cache slots and
+// state, the bounds, the complexes and the vertices, all storage buffers so
+// that packed assets are not bound by the 1D image limit
+struct NGFResources {
+	std::array <BufferPool::Entry, 8> buffers;
+
+	// First patch and patch count of each asset, as in the asset table
+	std::vector <glm::uvec4> assets;
+
+	// Patches of the largest asset, the width of the task grid
+	uint32_t widest = 0;
+
+	uint32_t patch_count = 0;
+	uint32_t feature_size = 0;
+	size_t kbs = 0;
+	std::filesystem::path path;
+};
+
+// Prepares models on a background thread; the main thread submits the
+// recorded uploads and swaps descriptor sets at frame boundaries
+struct ModelLoader {
+	// Assets packed into one model; the first may already be loaded
+	struct Request {
+		std::vector <std::filesystem::path> paths;
+		std::optional <NGF> ngf;
+	};
+
+	DeviceRenderContext &engine;
+
+	BufferPool buffer_pool;
+	vk::Sampler sampler;
+
+	// Double buffered, since the descriptor pool does not allow freeing sets
+	std::array <vk::DescriptorSet, 2> dsets;
+	std::array <std::optional <NGFResources>, 2> slots;
+	uint32_t active = 0;
+
+	// Depth pyramid and instance generations referenced by the descriptor sets
+	uint32_t pyramid_generation = 0;
+	uint32_t instances_generation = 0;
+
+	// Previous model, released once the frames in flight are done with it
+	std::optional <NGFResources> retired;
+	size_t retire_frame = 0;
+	size_t frame = 0;
+
+	// Shared with the worker thread; the staging arena of the engine belongs
+	// to the worker while recording and to the main thread until the batch
+	// completes, so a new batch is only recorded once uploading is cleared
+	std::mutex lock;
+	std::condition_variable cv;
+	std::optional <Request> requested;
+	std::optional <NGFResources> ready;
+	bool uploading = false;
+	bool stop = false;
+
+	std::optional <NGFResources> inflight;
+	std::thread worker;
+
+	ModelLoader(DeviceRenderContext &);
+
+	void request(const std::vector <std::filesystem::path> &, std::optional <NGF> = std::nullopt);
+	bool poll();
+	void refresh();
+	void release(const NGFResources &);
+	void drop();
+
+	const NGFResources *model() const {
+		return slots[active] ? &*slots[active] : nullptr;
+	}
+
+	vk::DescriptorSet descriptor() const {
+		return dsets[active];
+	}
+
+	// Worker side
+	void run();
+	std::optional <NGFResources> prepare(Request &);
+};
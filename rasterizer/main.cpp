@@ -1,6 +1,9 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <optional>
-#include <fstream>
+#include <sstream>
+#include <stdexcept>
 
 #include <glm/glm.hpp>
 
@@ -16,12 +19,9 @@
 #include "glio.hpp"
 #include "vkutil.hpp"
 #include "context.hpp"
-
-struct MVP {
-	glm::mat4 model;
-	glm::mat4 view;
-	glm::mat4 proj;
-};
+#include "headless.hpp"
+#include "loader.hpp"
+#include "profiler.hpp"
 
 bool valid_window(const DeviceRenderContext &engine)
 {
@@ -29,17 +29,15 @@ bool valid_window(const DeviceRenderContext &engine)
 }
 
 // Interface rendering
-struct Options {
-	bool backface_culling = false;
-	int resolution = 15;
-	std::string key = "Shaded";
-};
-
 struct Statistics {
 	size_t patch_count;
+	size_t asset_count;
+	double upload_ms;
+	std::filesystem::path model;
+	std::array <uint32_t, OcclusionCulling::eCounterCount> culling;
 };
 
-std::string imgui_pass(const vk::CommandBuffer &cmd, Options &options, const Statistics &stats, size_t kbs)
+std::string imgui_pass(const vk::CommandBuffer &cmd, Options &options, const Statistics &stats, size_t kbs, const Profiler &profiler)
 {
 	static std::vector <float> frametimes;
 	static const size_t WINDOW = 60;
@@ -76,11 +74,34 @@ std::string imgui_pass(const vk::CommandBuffer &cmd, Options &options, const Sta
 		ImGui::Text("%05.2f ms per frame (average)", ft * 1000.0f);
 		ImGui::Text("%05.2f ms per frame (max)", max * 1000.0f);
 		ImGui::Text("%04d frames per second", (int) fr);
+
+		profiler.plot();
+
+		if (ImGui::Button("Dump to JSON")) {
+			std::string name = "profile-" + stats.model.stem().string()
+				+ "-" + options.key + "-" + std::to_string(options.resolution) + ".json";
+
+			profiler.dump(name, stats.model.string(), options.key, options.resolution);
+		}
 	}
 
 	if (ImGui::CollapsingHeader("Statistics", tflags)) {
 		ImGui::Text("%4ld patches", stats.patch_count);
+		if (stats.asset_count > 1)
+			ImGui::Text("%4ld assets", stats.asset_count);
 		ImGui::Text("%4ld KB", kbs);
+		ImGui::Text("%.2f ms upload", stats.upload_ms);
+
+		const auto &culling = stats.culling;
+		ImGui::Text("%4u patches drawn", culling[OcclusionCulling::eDrawn]);
+		ImGui::Text("%4u culled (backface)", culling[OcclusionCulling::eBackface]);
+		ImGui::Text("%4u culled (frustum)", culling[OcclusionCulling::eFrustum]);
+		ImGui::Text("%4u culled (occlusion)", culling[OcclusionCulling::eOcclusion]);
+
+		uint32_t hits = culling[OcclusionCulling::eCacheHit];
+		uint32_t lookups = hits + culling[OcclusionCulling::eCacheMiss];
+		if (options.vertex_cache && lookups > 0)
+			ImGui::Text("%5.1f%% vertex cache hits", 100.0f * hits/lookups);
 	}
 
 	if (ImGui::CollapsingHeader("Render mode", tflags)) {
@@ -109,7 +130,16 @@ std::string imgui_pass(const vk::CommandBuffer &cmd, Options &options, const Sta
 
 	if (ImGui::CollapsingHeader("Options", tflags)) {
 		ImGui::Checkbox("Backface culling (aprox.)", &options.backface_culling);
-		ImGui::DragInt("Tessellation", (int *) &options.resolution, 0.05f, 2, 15);
+		ImGui::Checkbox("Occlusion culling (Hi-Z)", &options.occlusion_culling);
+		ImGui::DragInt("Instances", &options.instances, 1.0f, 1, 4096);
+		ImGui::DragFloat("Spacing", &options.spacing, 0.01f, 0.0f, 10.0f);
+		ImGui::Checkbox("Vertex cache", &options.vertex_cache);
+		ImGui::Checkbox("Visibility buffer", &options.visibility);
+		ImGui::Checkbox("Adaptive tessellation", &options.adaptive_tessellation);
+		ImGui::DragInt(options.adaptive_tessellation ? "Max tessellation" : "Tessellation",
+			(int *) &options.resolution, 0.05f, 2, 15);
+		if (options.adaptive_tessellation)
+			ImGui::DragFloat("Edge length (px)", &options.edge_pixels, 0.1f, 1.0f, 64.0f);
 	}
 
 	ImGui::End();
@@ -120,123 +150,6 @@ std::string imgui_pass(const vk::CommandBuffer &cmd, Options &options, const Sta
 	return path;
 }
 
-struct HomogenizedNGF {
-	std::vector <glm::ivec4> patches;
-	std::vector <glm::vec4> vertices;
-	std::vector <glm::vec4> features;
-	std::vector <float> biases;
-	std::vector <float> W0;
-	std::vector <float> W1;
-	std::vector <float> W2;
-	std::vector <float> W3;
-
-	static HomogenizedNGF from(const NGF &);
-};
-
-HomogenizedNGF HomogenizedNGF::from(const NGF &ngf)
-{
-	// Concatenate the biases into a single buffer
-	std::vector <float> biases;
-	for (int32_t i = 0; i < LAYERS; i++)
-		biases.insert(biases.end(), ngf.biases[i].begin(), ngf.biases[i].end());
-
-	// Align to vec4 size
-	size_t fixed = (biases.size() + 3)/4;
-	biases.resize(4 * fixed);
-
-	// Weights (transposed)
-	size_t w0c = ngf.weights[0].height;
-	std::vector <float> W0(64 * w0c);
-	std::vector <float> W1(64 * 64);
-	std::vector <float> W2(64 * 64);
-	std::vector <float> W3 = ngf.weights[3];
-
-	for (size_t i = 0; i < 64; i++) {
-		for (size_t j = 0; j < 64; j++) {
-			W1[j * 64 + i] = ngf.weights[1][i * 64 + j];
-			W2[j * 64 + i] = ngf.weights[2][i * 64 + j];
-		}
-
-		for (size_t j = 0; j < w0c; j++)
-			W0[j * 64 + i] = ngf.weights[0][i * w0c + j];
-	}
-
-	// Feature vector
-	std::vector <glm::vec4> features(ngf.patch_count * ngf.feature_size);
-
-	for (size_t i = 0; i < ngf.patch_count; i++) {
-		glm::ivec4 complex = ngf.patches[i];
-		for (size_t j = 0; j < ngf.feature_size; j++) {
-			float f0 = ngf.features[complex.x * ngf.feature_size + j];
-			float f1 = ngf.features[complex.y * ngf.feature_size + j];
-			float f2 = ngf.features[complex.z * ngf.feature_size + j];
-			float f3 = ngf.features[complex.w * ngf.feature_size + j];
-			features[i * ngf.feature_size + j] = glm::vec4(f0, f1, f2, f3);
-		}
-	}
-
-	return HomogenizedNGF {
-		.patches = ngf.patches,
-		.vertices = ngf.vertices,
-		.features = features,
-		.biases = biases,
-		.W0 = W0, .W1 = W1,
-		.W2 = W2, .W3 = W3,
-	};
-}
-
-// Configuring descriptor sets
-vk::DescriptorSet neural_geometry_image(DeviceRenderContext &engine, const HomogenizedNGF &hngf)
-{
-	static const auto allocator = [&] <typename T> (const std::vector <T> &buffer, vk::Extent2D extent,
-			vk::ImageType type = vk::ImageType::e2D,
-			vk::Format format = vk::Format::eR32G32B32A32Sfloat) {
-		return general_allocator(engine.device, engine.memory_properties,
-				engine.command_pool, engine.graphics_queue,
-				engine.dal, buffer, extent, type, format);
-	};
-
-	// Allocate textures for the NGF
-	uint32_t patches = hngf.patches.size();
-	uint32_t features = hngf.features.size() / patches;
-	uint32_t vertices = hngf.vertices.size();
-	uint32_t biases = hngf.biases.size();
-	uint32_t wsize = hngf.W0.size() >> 6;
-
-	auto complex_texture = allocator(hngf.patches, { patches, 1 },
-			vk::ImageType::e1D, vk::Format::eR32G32B32A32Sint);
-
-	auto vertex_texture = allocator(hngf.vertices, { vertices, 1 }, vk::ImageType::e1D);
-	auto feature_texture = allocator(hngf.features, { features, patches });
-
-	auto bias_texture = allocator(hngf.biases, { biases, 1 }, vk::ImageType::e1D);
-	auto W0_texture = allocator(hngf.W0, { 16, wsize });
-	auto W1_texture = allocator(hngf.W1, { 16, 64 });
-	auto W2_texture = allocator(hngf.W2, { 16, 64 });
-	auto W3_texture = allocator(hngf.W3, { 16, 3 });
-
-	// Bind the resources
-	vk::DescriptorSet dset = littlevk::bind(engine.device, engine.descriptor_pool)
-		.allocate_descriptor_sets(*engine.primaries.at("Shaded").dsl).front();
-
-	vk::Sampler floating_sampler = littlevk::SamplerAssembler(engine.device, engine.dal);
-
-	auto SROO = vk::ImageLayout::eShaderReadOnlyOptimal;
-
-	littlevk::bind(engine.device, dset, meshlet_dslbs)
-		.update(0, 0, floating_sampler, complex_texture.view, SROO)
-		.update(1, 0, floating_sampler, vertex_texture.view, SROO)
-		.update(2, 0, floating_sampler, feature_texture.view, SROO)
-		.update(3, 0, floating_sampler, bias_texture.view, SROO)
-		.update(4, 0, floating_sampler, W0_texture.view, SROO)
-		.update(5, 0, floating_sampler, W1_texture.view, SROO)
-		.update(6, 0, floating_sampler, W2_texture.view, SROO)
-		.update(7, 0, floating_sampler, W3_texture.view, SROO)
-		.finalize();
-
-	return dset;
-}
-
 vk::DescriptorSet environment_map(DeviceRenderContext &engine, const std::filesystem::path &path)
 {
 	vk::Sampler sampler = littlevk::SamplerAssembler(engine.device, engine.dal);
@@ -244,6 +157,8 @@ vk::DescriptorSet environment_map(DeviceRenderContext &engine, const std::filesy
 	auto tex = Texture::load("resources/environment.hdr");
 	littlevk::Image dtex = engine.upload_texture(tex);
 
+	ulog_info("testbed", "uploaded environment map in %.2f ms\n", engine.uploader.milliseconds);
+
 	vk::DescriptorSet dset = littlevk::bind(engine.device, engine.descriptor_pool)
 		.allocate_descriptor_sets(*engine.environment.dsl).front();
 
@@ -254,61 +169,168 @@ vk::DescriptorSet environment_map(DeviceRenderContext &engine, const std::filesy
 	return dset;
 }
 
-std::ifstream::pos_type filesize(const std::string &filename)
-{
-	std::ifstream in(filename, std::ifstream::ate | std::ifstream::binary);
-	return in.tellg();
-}
-
 int main(int argc, char *argv[])
 {
 	littlevk::config().enable_validation_layers = false;
 	littlevk::config().enable_logging = false;
 
 	if (argc < 2) {
-		ulog_error("testbed", "Usage: testbed <ngf>\n");
+		ulog_error("testbed", "Usage: testbed <ngf> [--asset <ngf>]... [--fp16] [--record-path <file>]\n");
+		ulog_error("testbed", "       testbed <ngf> [--asset <ngf>]... --headless [--fp16] [--frames <N>] [--camera-path <file>]"
+				" [--resolutions <r0,r1,...>] [--extent <W>x<H>] [--instances <N>] [--output <csv>]\n");
 		return EXIT_FAILURE;
 	}
 
 	std::string path = argv[1];
 
-	// Load the neural geometry field
+	// Further assets, drawn alongside the first one by the instances
+	std::vector <std::filesystem::path> assets { path };
+
+	bool half = false;
+	bool headless = false;
+
+	BenchmarkSettings settings;
+	std::filesystem::path record_path;
+
+	for (int i = 2; i < argc; i++) {
+		std::string arg = argv[i];
+
+		// Options with a value
+		auto value = [&]() -> std::string {
+			if (i + 1 >= argc) {
+				ulog_error("testbed", "Missing value for %s\n", arg.c_str());
+				exit(EXIT_FAILURE);
+			}
+
+			return argv[++i];
+		};
+
+		// Whole numbers, so that a typo names the option instead of throwing
+		auto number = [&](const std::string &text) -> long {
+			try {
+				size_t end = 0;
+				long result = std::stol(text, &end);
+				if (end == text.size())
+					return result;
+			} catch (const std::logic_error &) {}
+
+			ulog_error("testbed", "Invalid value \"%s\" for %s\n", text.c_str(), arg.c_str());
+			exit(EXIT_FAILURE);
+		};
+
+		if (arg == "--fp16") {
+			half = true;
+		} else if (arg == "--asset") {
+			assets.push_back(value());
+		} else if (arg == "--headless") {
+			headless = true;
+		} else if (arg == "--frames") {
+			settings.frames = std::max(number(value()), 1L);
+		} else if (arg == "--camera-path") {
+			settings.camera_path = value();
+		} else if (arg == "--output") {
+			settings.output = value();
+		} else if (arg == "--record-path") {
+			record_path = value();
+		} else if (arg == "--resolutions") {
+			settings.resolutions.clear();
+
+			std::istringstream stream(value());
+			for (std::string token; std::getline(stream, token, ',');)
+				settings.resolutions.push_back(std::clamp(number(token), 2L, 15L));
+		} else if (arg == "--instances") {
+			settings.instances = std::max(number(value()), 1L);
+		} else if (arg == "--extent") {
+			std::string extent = value();
+			size_t x = extent.find('x');
+			if (x == std::string::npos) {
+				ulog_error("testbed", "Invalid value \"%s\" for %s, expected <W>x<H>\n", extent.c_str(), arg.c_str());
+				return EXIT_FAILURE;
+			}
+
+			settings.extent.width = std::max(number(extent.substr(0, x)), 1L);
+			settings.extent.height = std::max(number(extent.substr(x + 1)), 1L);
+		} else {
+			ulog_error("testbed", "Unknown option %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Load the neural geometry field; the pipelines depend on its feature size
 	auto ngf = NGF::load(path);
-	auto hngf = HomogenizedNGF::from(ngf);
+	uint32_t feature_size = ngf.feature_size;
 
 	// Configure renderer
-	static const std::vector <const char *> extensions {
+	std::vector <const char *> extensions {
 		VK_EXT_MESH_SHADER_EXTENSION_NAME,
 		VK_EXT_ROBUSTNESS_2_EXTENSION_NAME,
 		VK_KHR_MAINTENANCE_4_EXTENSION_NAME,
 		VK_KHR_SHADER_NON_SEMANTIC_INFO_EXTENSION_NAME,
-		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 	};
 
-	auto predicate = [](const vk::PhysicalDevice &phdev) {
+	if (!headless)
+		extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+	auto predicate = [&](const vk::PhysicalDevice &phdev) {
 		return littlevk::physical_device_able(phdev, extensions);
 	};
 
 	vk::PhysicalDevice phdev = littlevk::pick_physical_device(predicate);
 
+	// Half precision arithmetic is optional
+	if (half && littlevk::physical_device_able(phdev, { VK_KHR_SHADER_FLOAT16_INT8_EXTENSION_NAME }))
+		extensions.push_back(VK_KHR_SHADER_FLOAT16_INT8_EXTENSION_NAME);
+
 	// Initialization
-	DeviceRenderContext engine = DeviceRenderContext::from(phdev, extensions, ngf.feature_size);
+	std::optional <vk::Extent2D> offscreen;
+	if (headless)
+		offscreen = settings.extent;
+
+	auto startup = std::chrono::high_resolution_clock::now();
+
+	DeviceRenderContext engine = DeviceRenderContext::from(phdev, extensions, feature_size, half, offscreen);
+
+	// Cold starts compile every shader, warm starts load them from the cache
+	auto ms = std::chrono::duration <double, std::milli> (std::chrono::high_resolution_clock::now() - startup).count();
+	ulog_info("testbed", "pipelines ready in %.2f ms (%d shaders compiled, %d cached)\n",
+			ms, engine.shader_cache.compiled, engine.shader_cache.loaded);
 
 	engine.camera_transform.position = glm::vec3 { 0, 0, 3 };
 	engine.camera_transform.rotation = glm::vec3 { 0, glm::radians(180.0f), 0 };
 
-	// Descriptor sets
-	auto meshlet_dset = neural_geometry_image(engine, hngf);
+	// Descriptor sets; the environment map is uploaded before the loader
+	// thread starts using the staging arena
 	auto environment_dset = environment_map(engine, "resources/environment.hdr");
 
+	ModelLoader loader(engine);
+	loader.request(assets, std::move(ngf));
+
+	if (headless) {
+		engine.instances.arrange(settings.instances, Options().spacing, assets.size());
+
+		benchmark(engine, loader, environment_dset, settings);
+
+		loader.drop();
+		engine.shader_cache.save();
+		engine.shader_cache.destroy();
+		engine.visibility.destroy();
+		engine.instances.destroy();
+		engine.culling.destroy();
+		engine.uploader.destroy();
+		engine.dal.drop();
+		return EXIT_SUCCESS;
+	}
+
+	// Camera keyframes of the session, replayed by the headless mode
+	CameraPath recording;
+
 	// Frame data
 	Options options;
 	Statistics stats;
 
-	stats.patch_count = ngf.patch_count;
+	Profiler profiler = Profiler::from(engine);
 
 	size_t frame = 0;
-	size_t kbs = filesize(path)/1024;
 	while (valid_window(engine)) {
 		// Get events
 		glfwPollEvents();
@@ -316,13 +338,12 @@ int main(int argc, char *argv[])
 		// Handle input
 		handle_key_input(engine.window.handle, engine.camera_transform);
 
+		if (!record_path.empty())
+			recording.record(engine.camera_transform, glfwGetTime());
+
 		// Update camera state before passing to render hooks
 		engine.camera.aspect = engine.aspect_ratio();
 
-		MVP mvp;
-		mvp.view = engine.camera.view_matrix(engine.camera_transform);
-		mvp.proj = engine.camera.perspective_matrix();
-
 		// Frame
 		auto frame_info = new_frame(engine, frame);
 		if (!frame_info)
@@ -330,76 +351,41 @@ int main(int argc, char *argv[])
 
 		auto [cmd, op] = *frame_info;
 
-		glm::vec4 color(1.0f);
-		if (options.key == "Depth")
-			color = glm::vec4(0.0f);
-
-		render_pass_begin(engine, cmd, op, color);
-
-		if (options.key == "Shaded") {
-			RayFrame rayframe = engine.camera.rayframe(engine.camera_transform);
+		// Swap in a newly uploaded model at the frame boundary, along with
+		// the instances requested through the interface
+		const NGFResources *current = loader.model();
+		engine.instances.arrange(options.instances, options.spacing, current ? current->assets.size() : 1);
+		loader.poll();
 
-			cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, engine.environment.handle);
-			cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
-					engine.environment.layout,
-					0, { environment_dset }, nullptr);
-			cmd.pushConstants <RayFrame> (engine.environment.layout,
-				vk::ShaderStageFlagBits::eFragment,
-				0, rayframe);
-			cmd.bindVertexBuffers(0, { VK_NULL_HANDLE }, { 0 });
-			cmd.draw(6, 1, 0, 0);
-		}
-
-		const auto &ppl = engine.primaries[options.key];
-		cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, ppl.handle);
-		cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, ppl.layout,
-				0, { meshlet_dset }, nullptr);
-
-		// Task/Mesh shader push constants
-		int flags = 0;
-		flags |= int(options.backface_culling);
-
-		glm::vec3 viewing = glm::vec3(glm::inverse(mvp.view) * glm::vec4(0, 0, 1, 0));
-
-		float time = glfwGetTime();
+		const NGFResources *model = loader.model();
+		stats.patch_count = model ? model->patch_count : 0;
+		stats.asset_count = model ? model->assets.size() : 0;
+		stats.upload_ms = engine.uploader.milliseconds;
+		stats.model = model ? model->path : "";
 
-		TaskData task_data;
-		task_data.model = Transform().matrix();
-		task_data.view = mvp.view;
-		task_data.proj = mvp.proj;
-		task_data.flags = flags;
-		task_data.resolution = options.resolution;
-		task_data.viewing = viewing;
-		task_data.time = time;
+		profiler.begin(cmd, frame);
+		engine.culling.begin(cmd, frame, model, engine.instances);
+		engine.vertex_cache.update(cmd, model, loader.descriptor());
+		stats.culling = engine.culling.counters;
 
-		cmd.pushConstants <TaskData> (ppl.layout,
-			vk::ShaderStageFlagBits::eMeshEXT
-				| vk::ShaderStageFlagBits::eTaskEXT,
-			0, task_data);
+		render_pass_begin(engine, cmd, op, clear_color(options));
 
-		// Fragment shader push constants
-		ShadingData shading_data;
-		shading_data.viewing = viewing;
-		shading_data.color = glm::vec3(0.59, 0.74, 0.76);
+		render_scene(engine, cmd, op, options, model, loader.descriptor(), environment_dset, glfwGetTime(), &profiler);
 
-		cmd.pushConstants <ShadingData> (ppl.layout,
-			vk::ShaderStageFlagBits::eFragment,
-			sizeof(TaskData), shading_data);
+		// Interface
+		profiler.start(cmd, Profiler::eInterface);
 
-		cmd.drawMeshTasksEXT(ngf.patch_count, 1, 1);
+		auto path = imgui_pass(cmd, options, stats, model ? model->kbs : 0, profiler);
+		if (path.size())
+			loader.request({ path });
 
-		// Interface
-		auto path = imgui_pass(cmd, options, stats, kbs);
-		if (path.size()) {
-			auto ngf = NGF::load(path);
-			auto hngf = HomogenizedNGF::from(ngf);
-			meshlet_dset = neural_geometry_image(engine, hngf);
-			kbs = filesize(path)/1024;
-		}
+		profiler.end(cmd, Profiler::eInterface);
 
 		// End of render pass
 		render_pass_end(engine, cmd);
 
+		engine.culling.end(cmd, frame, model, engine.instances);
+
 		// Conclude the frame and submit
 		end_frame(engine.graphics_queue, engine.sync, cmd, frame);
 
@@ -410,7 +396,18 @@ int main(int argc, char *argv[])
 		frame = 1 - frame;
 	}
 
+	if (!record_path.empty())
+		recording.save(record_path);
+
 	// Free the resources
+	loader.drop();
+	profiler.destroy();
+	engine.shader_cache.save();
+	engine.shader_cache.destroy();
+	engine.visibility.destroy();
+	engine.instances.destroy();
+	engine.culling.destroy();
+	engine.uploader.destroy();
 	engine.window.drop();
 	engine.dal.drop();
 }
@@ -0,0 +1,186 @@
+#include <fstream>
+
+#include <implot.h>
+
+#include "context.hpp"
+#include "profiler.hpp"
+
+static constexpr vk::QueryPipelineStatisticFlags statistic_flags =
+	vk::QueryPipelineStatisticFlagBits::eClippingInvocations
+	| vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations
+	| vk::QueryPipelineStatisticFlagBits::eTaskShaderInvocationsEXT
+	| vk::QueryPipelineStatisticFlagBits::eMeshShaderInvocationsEXT;
+
+template <typename T>
+static void push_rolling(std::vector <T> &history, T value)
+{
+	history.push_back(value);
+	if (history.size() > Profiler::WINDOW)
+		history.erase(history.begin());
+}
+
+// Collects the results of the frame that last used this slot and resets its queries
+void Profiler::begin(const vk::CommandBuffer &cmd, size_t frame)
+{
+	slot = frame;
+
+	if (recorded[slot]) {
+		std::array <uint64_t, 2 * ePassCount> stamps;
+
+		auto result = device.getQueryPoolResults(timestamp_pools[slot],
+				0, stamps.size(),
+				sizeof(stamps), stamps.data(), sizeof(uint64_t),
+				vk::QueryResultFlagBits::e64);
+
+		if (result == vk::Result::eSuccess) {
+			for (uint32_t i = 0; i < ePassCount; i++) {
+				float ms = float(stamps[2 * i + 1] - stamps[2 * i]) * period * 1e-6f;
+				push_rolling(times[i], ms);
+			}
+		}
+
+		if (statistics) {
+			std::array <uint64_t, STATISTICS_QUERIES * eCounterCount> values;
+
+			result = device.getQueryPoolResults(statistics_pools[slot],
+					0, STATISTICS_QUERIES,
+					sizeof(values), values.data(), eCounterCount * sizeof(uint64_t),
+					vk::QueryResultFlagBits::e64);
+
+			if (result == vk::Result::eSuccess) {
+				for (uint32_t i = 0; i < eCounterCount; i++) {
+					uint64_t sum = 0;
+					for (uint32_t q = 0; q < STATISTICS_QUERIES; q++)
+						sum += values[q * eCounterCount + i];
+
+					push_rolling(counters[i], float(sum));
+				}
+			}
+		}
+	}
+
+	cmd.resetQueryPool(timestamp_pools[slot], 0, 2 * ePassCount);
+	if (statistics)
+		cmd.resetQueryPool(statistics_pools[slot], 0, STATISTICS_QUERIES);
+
+	recorded[slot] = true;
+}
+
+void Profiler::start(const vk::CommandBuffer &cmd, Pass pass)
+{
+	cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timestamp_pools[slot], 2 * pass);
+}
+
+void Profiler::end(const vk::CommandBuffer &cmd, Pass pass)
+{
+	cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestamp_pools[slot], 2 * pass + 1);
+}
+
+// Queries cannot span render passes, so each NGF pass has its own
+void Profiler::begin_statistics(const vk::CommandBuffer &cmd, uint32_t query)
+{
+	if (statistics)
+		cmd.beginQuery(statistics_pools[slot], query, {});
+}
+
+void Profiler::end_statistics(const vk::CommandBuffer &cmd, uint32_t query)
+{
+	if (statistics)
+		cmd.endQuery(statistics_pools[slot], query);
+}
+
+// Rolling graphs, for the Performance panel
+void Profiler::plot() const
+{
+	auto axes = ImPlotAxisFlags_AutoFit;
+
+	if (ImPlot::BeginPlot("Passes (ms)", ImVec2(-1, 160))) {
+		ImPlot::SetupAxes(nullptr, nullptr, ImPlotAxisFlags_NoTickLabels | axes, axes);
+		for (uint32_t i = 0; i < ePassCount; i++)
+			ImPlot::PlotLine(pass_names[i], times[i].data(), times[i].size());
+
+		ImPlot::EndPlot();
+	}
+
+	if (!statistics) {
+		ImGui::Text("Pipeline statistics are not supported");
+		return;
+	}
+
+	if (ImPlot::BeginPlot("NGF passes (counts)", ImVec2(-1, 160))) {
+		ImPlot::SetupAxes(nullptr, nullptr, ImPlotAxisFlags_NoTickLabels | axes, axes);
+		for (uint32_t i = 0; i < eCounterCount; i++)
+			ImPlot::PlotLine(counter_names[i], counters[i].data(), counters[i].size());
+
+		ImPlot::EndPlot();
+	}
+}
+
+void Profiler::dump(const std::filesystem::path &path, const std::string &model, const std::string &mode, int resolution) const
+{
+	std::ofstream file(path);
+	if (!file) {
+		ulog_error("profiler", "could not open %s\n", path.c_str());
+		return;
+	}
+
+	auto array = [&](const std::vector <float> &values) {
+		file << "[";
+		for (size_t i = 0; i < values.size(); i++)
+			file << (i ? ", " : "") << values[i];
+		file << "]";
+	};
+
+	file << "{\n";
+	file << "  \"model\": \"" << model << "\",\n";
+	file << "  \"mode\": \"" << mode << "\",\n";
+	file << "  \"resolution\": " << resolution << ",\n";
+
+	file << "  \"passes_ms\": {\n";
+	for (uint32_t i = 0; i < ePassCount; i++) {
+		file << "    \"" << pass_names[i] << "\": ";
+		array(times[i]);
+		file << (i + 1 < ePassCount ? ",\n" : "\n");
+	}
+	file << "  },\n";
+
+	file << "  \"statistics\": {\n";
+	for (uint32_t i = 0; i < eCounterCount && statistics; i++) {
+		file << "    \"" << counter_names[i] << "\": ";
+		array(counters[i]);
+		file << (i + 1 < eCounterCount ? ",\n" : "\n");
+	}
+	file << "  }\n";
+	file << "}\n";
+
+	ulog_info("profiler", "wrote %s\n", path.c_str());
+}
+
+void Profiler::destroy()
+{
+	for (auto pool : timestamp_pools)
+		device.destroyQueryPool(pool);
+
+	if (statistics) {
+		for (auto pool : statistics_pools)
+			device.destroyQueryPool(pool);
+	}
+}
+
+Profiler Profiler::from(const DeviceRenderContext &engine)
+{
+	Profiler profiler;
+	profiler.device = engine.device;
+	profiler.period = engine.phdev.getProperties().limits.timestampPeriod;
+	profiler.statistics = engine.pipeline_statistics;
+
+	for (auto &pool : profiler.timestamp_pools)
+		pool = engine.device.createQueryPool({ {}, vk::QueryType::eTimestamp, 2 * ePassCount });
+
+	if (profiler.statistics) {
+		for (auto &pool : profiler.statistics_pools)
+			pool = engine.device.createQueryPool({ {}, vk::QueryType::ePipelineStatistics, STATISTICS_QUERIES, statistic_flags });
+	}
+
+	return profiler;
+}
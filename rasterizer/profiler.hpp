@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <filesystem>
+#include <vector>
+
+#include <littlevk/littlevk.hpp>
+
+struct DeviceRenderContext;
+
+// GPU timestamps per pass and pipeline statistics of the NGF passes, one set
+// of query pools per frame in flight; results are collected when the slot
+// comes around again, so they lag the frame by the swapchain depth
+struct Profiler {
+	enum Pass : uint32_t {
+		eEnvironment,
+		eNGF,
+		ePyramid,
+		eOcclusion,
+		eResolve,
+		eInterface,
+		ePassCount
+	};
+
+	// In the order Vulkan writes them (ascending flag bits)
+	enum Counter : uint32_t {
+		ePrimitives,
+		eFragments,
+		eTaskInvocations,
+		eMeshInvocations,
+		eCounterCount
+	};
+
+	static constexpr std::array <const char *, ePassCount> pass_names {
+		"Environment", "NGF", "Depth pyramid", "NGF (occlusion)", "Resolve", "Interface"
+	};
+
+	static constexpr std::array <const char *, eCounterCount> counter_names {
+		"Primitives", "Fragments", "Task invocations", "Mesh invocations"
+	};
+
+	// One query per NGF pass, summed
+	static constexpr uint32_t STATISTICS_QUERIES = 2;
+
+	// Rolling history length, in frames
+	static constexpr size_t WINDOW = 240;
+
+	vk::Device device;
+	float period = 1.0f;
+	bool statistics = false;
+
+	std::array <vk::QueryPool, 2> timestamp_pools;
+	std::array <vk::QueryPool, 2> statistics_pools;
+	std::array <bool, 2> recorded {};
+
+	// Slot of the frame being recorded
+	size_t slot = 0;
+
+	std::array <std::vector <float>, ePassCount> times;
+	std::array <std::vector <float>, eCounterCount> counters;
+
+	void begin(const vk::CommandBuffer &, size_t);
+	void start(const vk::CommandBuffer &, Pass);
+	void end(const vk::CommandBuffer &, Pass);
+	void begin_statistics(const vk::CommandBuffer &, uint32_t);
+	void end_statistics(const vk::CommandBuffer &, uint32_t);
+
+	void plot() const;
+	void dump(const std::filesystem::path &, const std::string &, const std::string &, int) const;
+	void destroy();
+
+	static Profiler from(const DeviceRenderContext &);
+};
@@ -0,0 +1,269 @@
+#include <cstdlib>
+#include <fstream>
+#include <regex>
+#include <set>
+#include <sstream>
+
+#include <unistd.h>
+
+#include <glslang/Public/ShaderLang.h>
+#include <glslang/Public/ResourceLimits.h>
+#include <glslang/SPIRV/GlslangToSpv.h>
+
+#include "shaders.hpp"
+#include "microlog.h"
+
+static std::string read(const std::filesystem::path &path)
+{
+	std::ifstream file(path);
+	ulog_assert(file.good(), "shaders", "could not open %s\n", path.c_str());
+
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	return buffer.str();
+}
+
+// FNV-1a, enough to tell sources apart
+static uint64_t hash(uint64_t h, const std::string &data)
+{
+	for (char c : data) {
+		h ^= uint8_t(c);
+		h *= 0x100000001b3ull;
+	}
+
+	return h;
+}
+
+// Hash of a source and every file it includes, relative to its directory
+static uint64_t hash_sources(uint64_t h, const std::filesystem::path &path, std::set <std::filesystem::path> &visited)
+{
+	if (!visited.insert(path).second)
+		return h;
+
+	std::string source = read(path);
+	h = hash(h, source);
+
+	static const std::regex include("#include\\s+\"([^\"]+)\"");
+	for (std::sregex_iterator it(source.begin(), source.end(), include), end; it != end; it++)
+		h = hash_sources(h, path.parent_path() / (*it)[1].str(), visited);
+
+	return h;
+}
+
+struct Includer : glslang::TShader::Includer {
+	std::filesystem::path directory;
+
+	Includer(const std::filesystem::path &directory_) : directory(directory_) {}
+
+	IncludeResult *includeLocal(const char *name, const char *, size_t) override {
+		std::filesystem::path path = directory / name;
+		if (!std::filesystem::exists(path))
+			return nullptr;
+
+		std::string *content = new std::string(read(path));
+		return new IncludeResult(path.string(), content->data(), content->size(), content);
+	}
+
+	void releaseInclude(IncludeResult *result) override {
+		if (result) {
+			delete (std::string *) result->userData;
+			delete result;
+		}
+	}
+};
+
+static EShLanguage language(vk::ShaderStageFlagBits stage)
+{
+	switch (stage) {
+	case vk::ShaderStageFlagBits::eVertex:
+		return EShLangVertex;
+	case vk::ShaderStageFlagBits::eFragment:
+		return EShLangFragment;
+	case vk::ShaderStageFlagBits::eCompute:
+		return EShLangCompute;
+	case vk::ShaderStageFlagBits::eTaskEXT:
+		return EShLangTask;
+	case vk::ShaderStageFlagBits::eMeshEXT:
+		return EShLangMesh;
+	default:
+		break;
+	}
+
+	ulog_error("shaders", "unsupported shader stage %s\n", vk::to_string(stage).c_str());
+	return EShLangCount;
+}
+
+static std::vector <uint32_t> compile(const std::filesystem::path &path, vk::ShaderStageFlagBits stage,
+		const littlevk::shader::Defines &defines)
+{
+	EShLanguage lang = language(stage);
+
+	std::string source = read(path);
+	const char *strings[] = { source.c_str() };
+	const char *names[] = { path.c_str() };
+
+	std::string preamble;
+	for (const auto &[name, value] : defines)
+		preamble += "#define " + name + " " + value + "\n";
+
+	glslang::TShader shader(lang);
+	shader.setStringsWithLengthsAndNames(strings, nullptr, names, 1);
+	shader.setPreamble(preamble.c_str());
+	shader.setEnvInput(glslang::EShSourceGlsl, lang, glslang::EShClientVulkan, 100);
+	shader.setEnvClient(glslang::EShClientVulkan, glslang::EShTargetVulkan_1_3);
+	shader.setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_6);
+
+	Includer includer(path.parent_path());
+
+	auto messages = EShMessages(EShMsgSpvRules | EShMsgVulkanRules);
+	if (!shader.parse(GetDefaultResources(), 460, false, messages, includer)) {
+		ulog_error("shaders", "failed to compile %s:\n%s\n", path.c_str(), shader.getInfoLog());
+		return {};
+	}
+
+	glslang::TProgram program;
+	program.addShader(&shader);
+	if (!program.link(messages)) {
+		ulog_error("shaders", "failed to link %s:\n%s\n", path.c_str(), program.getInfoLog());
+		return {};
+	}
+
+	std::vector <uint32_t> spirv;
+	glslang::GlslangToSpv(*program.getIntermediate(lang), spirv);
+	return spirv;
+}
+
+// Written next to the target and renamed over it, so that an interrupted
+// write never leaves a truncated file behind, even with concurrent runs
+static void write_atomic(const std::filesystem::path &path, const void *data, size_t size)
+{
+	std::filesystem::path staging = path;
+	staging += "." + std::to_string(getpid()) + ".tmp";
+
+	bool written = false;
+	{
+		std::ofstream file(staging, std::ios::binary);
+		file.write((const char *) data, size);
+		file.close();
+		written = file.good();
+	}
+
+	std::error_code error;
+	if (written)
+		std::filesystem::rename(staging, path, error);
+	else
+		std::filesystem::remove(staging, error);
+}
+
+// Cached SPIR-V, or nothing if the file is not a complete module
+static std::vector <uint32_t> load_spirv(const std::filesystem::path &path)
+{
+	static constexpr uint32_t MAGIC = 0x07230203;
+
+	// Magic, version, generator, bound and schema
+	static constexpr size_t HEADER = 5;
+
+	std::error_code error;
+	size_t size = std::filesystem::file_size(path, error);
+	if (error || size % sizeof(uint32_t) != 0 || size < HEADER * sizeof(uint32_t))
+		return {};
+
+	std::vector <uint32_t> spirv(size / sizeof(uint32_t));
+
+	std::ifstream file(path, std::ios::binary);
+	file.read((char *) spirv.data(), size);
+	if (!file.good() || spirv[0] != MAGIC)
+		return {};
+
+	return spirv;
+}
+
+vk::ShaderModule ShaderCache::module(const std::filesystem::path &path, vk::ShaderStageFlagBits stage,
+		const littlevk::shader::Defines &defines)
+{
+	std::set <std::filesystem::path> visited;
+	uint64_t key = hash_sources(0xcbf29ce484222325ull, path, visited);
+	key = hash(key, vk::to_string(stage));
+	for (const auto &[name, value] : defines)
+		key = hash(key, name + "=" + value + ";");
+
+	if (modules.count(key))
+		return modules[key];
+
+	std::stringstream name;
+	name << path.filename().string() << "-" << std::hex << key << ".spv";
+	std::filesystem::path cached = directory / name.str();
+
+	std::vector <uint32_t> spirv;
+	if (std::filesystem::exists(cached))
+		spirv = load_spirv(cached);
+
+	if (!spirv.empty()) {
+		loaded++;
+	} else {
+		if (std::filesystem::exists(cached))
+			ulog_warning("shaders", "discarding invalid cached SPIR-V %s\n", cached.c_str());
+
+		spirv = compile(path, stage, defines);
+		ulog_assert(!spirv.empty(), "shaders", "no SPIR-V for %s\n", path.c_str());
+
+		write_atomic(cached, spirv.data(), spirv.size() * sizeof(uint32_t));
+		compiled++;
+	}
+
+	vk::ShaderModule module = device.createShaderModule({
+		{}, spirv.size() * sizeof(uint32_t), spirv.data()
+	});
+
+	return modules[key] = module;
+}
+
+void ShaderCache::save() const
+{
+	auto data = device.getPipelineCacheData(pipeline_cache);
+
+	write_atomic(directory / "pipelines.bin", data.data(), data.size());
+
+	ulog_info("shaders", "saved %lu KB of pipeline cache\n", data.size()/1024);
+}
+
+void ShaderCache::destroy()
+{
+	for (const auto &[_, module] : modules)
+		device.destroyShaderModule(module);
+
+	device.destroyPipelineCache(pipeline_cache);
+}
+
+ShaderCache ShaderCache::from(const vk::Device &device)
+{
+	ShaderCache cache;
+	cache.device = device;
+
+	// XDG cache directory, or the working directory without one
+	if (const char *xdg = std::getenv("XDG_CACHE_HOME"))
+		cache.directory = std::filesystem::path(xdg) / "ngf";
+	else if (const char *home = std::getenv("HOME"))
+		cache.directory = std::filesystem::path(home) / ".cache" / "ngf";
+	else
+		cache.directory = ".ngf-cache";
+
+	std::filesystem::create_directories(cache.directory);
+
+	std::vector <uint8_t> data;
+
+	std::filesystem::path pipelines = cache.directory / "pipelines.bin";
+	if (std::filesystem::exists(pipelines)) {
+		std::ifstream file(pipelines, std::ios::binary);
+		data.resize(std::filesystem::file_size(pipelines));
+		file.read((char *) data.data(), data.size());
+	}
+
+	cache.pipeline_cache = device.createPipelineCache({
+		{}, data.size(), data.data()
+	});
+
+	glslang::InitializeProcess();
+
+	return cache;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <filesystem>
+#include <unordered_map>
+
+#include <littlevk/littlevk.hpp>
+
+// Compiled SPIR-V cached on disk, keyed by a hash of the source (with its
+// includes), the stage and the defines, along with a pipeline cache that is
+// saved on exit; the driver discards pipeline cache data from other devices
+struct ShaderCache {
+	vk::Device device;
+	std::filesystem::path directory;
+
+	vk::PipelineCache pipeline_cache;
+	std::unordered_map <uint64_t, vk::ShaderModule> modules;
+
+	// Startup statistics
+	uint32_t compiled = 0;
+	uint32_t loaded = 0;
+
+	vk::ShaderModule module(const std::filesystem::path &, vk::ShaderStageFlagBits,
+			const littlevk::shader::Defines & = {});
+
+	void save() const;
+	void destroy();
+
+	static ShaderCache from(const vk::Device &);
+};
@@ -0,0 +1,222 @@
+// Evaluation of the network, shared by the mesh shader and the vertex cache;
+// expects the nfloat/nvec4 types and a workgroup of 64 invocations which all
+// call eval in uniform control flow
+
+// Specialized when the pipelines are created, so that models with another
+// feature size only need new pipelines rather than new SPIR-V
+layout (constant_id = 0) const uint FEATURE_SIZE = 20;
+
+// Local execution data
+const uint ENCODING_LEVELS = 8;
+const uint FFIN = FEATURE_SIZE + 3 * 2 * ENCODING_LEVELS;
+
+// Corner vertex indices of each patch, and the vertices
+layout (binding = 0, std430) readonly buffer Complexes {
+	ivec4 complexes[];
+};
+
+layout (binding = 1, std430) readonly buffer Vertices {
+	vec4 vertices[];
+};
+
+// Corner features of each patch
+layout (binding = 2, std430) readonly buffer Features {
+	vec4 features[];
+};
+
+// Network parameters, layer by layer (see HomogenizedNGF) and one block per
+// asset; half precision parameters are packed in pairs since 16-bit storage
+// is not required
+#ifdef NGF_FP16
+layout (binding = 3, std430) readonly buffer Parameters {
+	uvec2 parameters[];
+};
+#else
+layout (binding = 3, std430) readonly buffer Parameters {
+	vec4 parameters[];
+};
+#endif
+
+// Offsets of each block, in vec4 units
+const uint W0_OFFSET = 0;
+const uint B0_OFFSET = W0_OFFSET + 16 * FFIN;
+const uint W1_OFFSET = B0_OFFSET + 16;
+const uint B1_OFFSET = W1_OFFSET + 16 * 64;
+const uint W2_OFFSET = B1_OFFSET + 16;
+const uint B2_OFFSET = W2_OFFSET + 16 * 64;
+const uint W3_OFFSET = B2_OFFSET + 16;
+const uint B3_OFFSET = W3_OFFSET + 16 * 3;
+
+// Parameters of one asset, with the last bias padded to a vec4
+const uint PARAMETER_BLOCK = B3_OFFSET + 1;
+
+// Block of the asset being evaluated
+uint parameter_base;
+
+#ifdef NGF_FP16
+nvec4 parameter(uint i)
+{
+	uvec2 p = parameters[parameter_base + i];
+	return nvec4(unpackFloat2x16(p.x), unpackFloat2x16(p.y));
+}
+#else
+nvec4 parameter(uint i)
+{
+	return parameters[parameter_base + i];
+}
+#endif
+
+#define leaky_relu(x) max(x, nfloat(0.01) * x)
+
+const uint MSIZE = FFIN > 64 ? FFIN : 64;
+
+// Columns of the first layer loaded by the workgroup at a time
+const uint CHUNK = 4;
+
+shared nvec4 columns[CHUNK * FFIN];
+
+vec3 eval(uint pindex, uint asset, vec2 uv)
+{
+	nfloat A[MSIZE];
+	nvec4 B[16];
+
+	parameter_base = asset * PARAMETER_BLOCK;
+
+	ivec4 complex = complexes[pindex];
+
+	vec3 v0 = vertices[complex.x].xyz;
+	vec3 v1 = vertices[complex.y].xyz;
+	vec3 v2 = vertices[complex.z].xyz;
+	vec3 v3 = vertices[complex.w].xyz;
+
+	vec3 vertex = mix(mix(v0, v1, uv.y), mix(v3, v2, uv.y), uv.x);
+
+	uint base = pindex * FEATURE_SIZE;
+	for (uint i = 0; i < FEATURE_SIZE; i++) {
+		vec4 fv = features[base + i];
+		A[i] = nfloat(mix(mix(fv.x, fv.y, uv.y), mix(fv.w, fv.z, uv.y), uv.x));
+	}
+
+	// Positional encoding
+	const float powers[] = float[](1, 2, 4, 8, 16, 32, 64, 128);
+
+	uint k = FEATURE_SIZE;
+	for (uint i = 0; i < ENCODING_LEVELS; i++) {
+		float p = powers[i];
+		// Kept in full precision, since the higher frequencies need it
+		vec3 sin_v = sin(p * vertex);
+		vec3 cos_v = cos(p * vertex);
+
+		A[k++] = nfloat(sin_v.x);
+		A[k++] = nfloat(sin_v.y);
+		A[k++] = nfloat(sin_v.z);
+
+		A[k++] = nfloat(cos_v.x);
+		A[k++] = nfloat(cos_v.y);
+		A[k++] = nfloat(cos_v.z);
+	}
+
+	// Network evaluation
+	uint tid = gl_LocalInvocationID.x + gl_LocalInvocationID.y * gl_WorkGroupSize.x;
+	uint stride = gl_WorkGroupSize.x * gl_WorkGroupSize.y;
+
+	// Layer 0
+	for (uint i = 0; i < 16; i += CHUNK) {
+		// Consecutive invocations load consecutive parameters
+		for (uint t = tid; t < CHUNK * FFIN; t += stride) {
+			uint j = t / CHUNK;
+			uint c = t % CHUNK;
+			columns[c * FFIN + j] = parameter(W0_OFFSET + 16 * j + i + c);
+		}
+
+		barrier();
+
+		// Evaluate
+		for (uint c = 0; c < CHUNK; c++) {
+			nvec4 v = parameter(B0_OFFSET + i + c);
+			for (uint j = 0; j < FFIN; j++)
+				v += A[j] * columns[c * FFIN + j];
+
+			B[i + c] = leaky_relu(v);
+		}
+
+		// Before the next chunk overwrites the columns
+		barrier();
+	}
+
+	// Layer 1; the remaining parameters are read at the same address by the
+	// whole workgroup, and are broadcast from the cache
+	for (uint i = 0; i < 16; i++) {
+		uint k = i << 2;
+
+		// Evaluate
+		nvec4 v = parameter(B1_OFFSET + i);
+		for (uint j = 0; j < 16; j++) {
+			uint l = W1_OFFSET + 16 * (j << 2) + i;
+			nvec4 v0 = parameter(l);
+			nvec4 v1 = parameter(l + 16);
+			nvec4 v2 = parameter(l + 32);
+			nvec4 v3 = parameter(l + 48);
+			nvec4 s = B[j];
+
+			v += s.x * v0 + s.y * v1 + s.z * v2 + s.w * v3;
+		}
+
+		nvec4 lv = leaky_relu(v);
+		A[k + 0] = lv.x;
+		A[k + 1] = lv.y;
+		A[k + 2] = lv.z;
+		A[k + 3] = lv.w;
+	}
+
+	// Layer 2
+	for (uint i = 0; i < 16; i++) {
+		// Evaluate
+		nvec4 v = parameter(B2_OFFSET + i);
+		for (uint j = 0; j < 64; j++)
+			v += A[j] * parameter(W2_OFFSET + 16 * j + i);
+
+		// The displacement is accumulated in full precision
+		vec4 lv = vec4(leaky_relu(v));
+
+		// Fuse with the last layer
+		vec4 wx = vec4(parameter(W3_OFFSET + i));
+		vec4 wy = vec4(parameter(W3_OFFSET + 16 + i));
+		vec4 wz = vec4(parameter(W3_OFFSET + 32 + i));
+
+		vertex.x += dot(wx, lv);
+		vertex.y += dot(wy, lv);
+		vertex.z += dot(wz, lv);
+	}
+
+	return vertex + vec3(parameter(B3_OFFSET).xyz);
+}
+
+// Snaps a boundary parameter onto the grid of a coarser edge; every point of
+// that grid is still reached, so both patches sharing the edge end up with
+// the same vertices along it (collapsed triangles are left degenerate)
+float stitch(float t, uint edge)
+{
+	float n = float(edge - 1);
+	return round(t * n)/n;
+}
+
+// Parameters of a vertex in the patch lattice, with the edges stitched to the
+// resolutions in the payload
+vec2 lattice(uvec2 offset, uint resolution, uint edges)
+{
+	vec2 uv = offset/float(resolution - 1);
+
+	uint last = resolution - 1;
+	if (offset.x == 0)
+		uv.y = stitch(uv.y, bitfieldExtract(edges, 0, 8));
+	else if (offset.x == last)
+		uv.y = stitch(uv.y, bitfieldExtract(edges, 8, 8));
+
+	if (offset.y == 0)
+		uv.x = stitch(uv.x, bitfieldExtract(edges, 16, 8));
+	else if (offset.y == last)
+		uv.x = stitch(uv.x, bitfieldExtract(edges, 24, 8));
+
+	return uv;
+}
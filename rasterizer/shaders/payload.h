@@ -1,4 +1,18 @@
 struct Payload {
 	uint pindex;
+	uint instance;
+	uint asset;
 	uint resolution;
+
+	// Resolutions of the edges at u = 0, u = 1, v = 0 and v = 1, a byte
+	// each; shared edges get the same value from both patches
+	uint edges;
+
+	// Vertex cache slot plus one, or zero to evaluate the network
+	uint slot;
 };
+
+// Vertex cache layout; a slot holds the lattice of one patch at up to the
+// maximum resolution, in rows of the maximum resolution
+const uint CACHE_ROW = 15;
+const uint CACHE_STRIDE = CACHE_ROW * CACHE_ROW;
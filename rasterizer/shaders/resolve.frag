@@ -0,0 +1,175 @@
+#version 450
+
+layout (push_constant) uniform ResolvePushConstants {
+	mat4 inverse_view_projection;
+	vec3 viewing;
+	vec3 color;
+	int mode;
+};
+
+// Primitive identifier (see ngf.mesh), depth and instance of each pixel
+layout (binding = 0) uniform usampler2D visibility;
+
+layout (location = 0) in vec2 uv;
+
+layout (location = 0) out vec4 fragment;
+
+const uint EMPTY = 0xFFFFFFFFu;
+
+// Identifiers are the patch index above the primitive within the patch
+const uint PATCH_MASK = ~0x7FFu;
+
+// Render modes, in the order of the resolve field of FragmentShaderInfo
+const int SHADED = 0;
+const int PATCHES = 1;
+const int NORMALS = 2;
+const int DEPTH = 3;
+
+// Spherical harmonics lighting
+mat4 R = mat4(
+	-0.034424, -0.021329, 0.086425, -0.146638,
+	-0.021329, 0.034424, 0.004396, -0.050819,
+	0.086425, 0.004396, 0.088365, -0.377601,
+	-0.146638, -0.050819, -0.377601, 1.618500
+);
+
+mat4 G = mat4(
+	-0.032890, -0.013668, 0.066403, -0.107776,
+	-0.013668, 0.032890, -0.012273, 0.013852,
+	0.066403, -0.012273, -0.021086, -0.223067,
+	-0.107776, 0.013852, -0.223067, 1.598757
+);
+
+mat4 B = mat4(
+	-0.035777, -0.008999, 0.051376, -0.087520,
+	-0.008999, 0.035777, -0.034691, 0.030949,
+	0.051376, -0.034691, -0.010211, -0.081895,
+	-0.087520, 0.030949, -0.081895, 1.402876
+);
+
+// Color wheel for patches
+const vec3 WHEEL[16] = vec3[](
+	vec3(0.880, 0.320, 0.320),
+	vec3(0.880, 0.530, 0.320),
+	vec3(0.880, 0.740, 0.320),
+	vec3(0.810, 0.880, 0.320),
+	vec3(0.600, 0.880, 0.320),
+	vec3(0.390, 0.880, 0.320),
+	vec3(0.320, 0.880, 0.460),
+	vec3(0.320, 0.880, 0.670),
+	vec3(0.320, 0.880, 0.880),
+	vec3(0.320, 0.670, 0.880),
+	vec3(0.320, 0.460, 0.880),
+	vec3(0.390, 0.320, 0.880),
+	vec3(0.600, 0.320, 0.880),
+	vec3(0.810, 0.320, 0.880),
+	vec3(0.880, 0.320, 0.740),
+	vec3(0.880, 0.320, 0.530)
+);
+
+// Tone mapping
+vec3 aces(vec3 x)
+{
+	const float a = 2.51;
+	const float b = 0.03;
+	const float c = 2.43;
+	const float d = 0.59;
+	const float e = 0.14;
+	return clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0.0, 1.0);
+}
+
+// World position of a pixel; the mesh shader flips y after projecting
+vec3 reconstruct(ivec2 p, float depth)
+{
+	vec2 ndc = 2 * (vec2(p) + 0.5) / vec2(textureSize(visibility, 0)) - 1;
+	vec4 world = inverse_view_projection * vec4(ndc.x, -ndc.y, depth, 1);
+	return world.xyz / world.w;
+}
+
+// Position of a covered neighbor whose identifier matches under the mask;
+// identifiers only match within the same instance, unless any will do
+bool neighbor(ivec2 q, uint id, uint instance, uint mask, out vec3 Q)
+{
+	ivec2 size = textureSize(visibility, 0);
+	if (any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, size)))
+		return false;
+
+	uvec3 texel = texelFetch(visibility, q, 0).xyz;
+	if (texel.x == EMPTY || (texel.x & mask) != (id & mask))
+		return false;
+
+	if (mask != 0u && texel.z != instance)
+		return false;
+
+	Q = reconstruct(q, uintBitsToFloat(texel.y));
+	return true;
+}
+
+// Screen space derivative along d, preferring neighbors on the same triangle,
+// then on the same patch (for triangles smaller than a pixel), then any
+vec3 derivative(ivec2 p, uint id, uint instance, vec3 P, ivec2 d)
+{
+	const uint masks[3] = uint[](~0u, PATCH_MASK, 0u);
+
+	vec3 Q;
+	for (int i = 0; i < 3; i++) {
+		if (neighbor(p + d, id, instance, masks[i], Q))
+			return Q - P;
+		if (neighbor(p - d, id, instance, masks[i], Q))
+			return P - Q;
+	}
+
+	return vec3(d, 0);
+}
+
+void main()
+{
+	ivec2 p = ivec2(gl_FragCoord.xy);
+
+	uvec3 texel = texelFetch(visibility, p, 0).xyz;
+	if (texel.x == EMPTY)
+		discard;
+
+	uint id = texel.x;
+	float depth = uintBitsToFloat(texel.y);
+	uint instance = texel.z;
+
+	if (mode == PATCHES) {
+		fragment = vec4(WHEEL[(id >> 11) % 16], 1.0f);
+		return;
+	}
+
+	if (mode == DEPTH) {
+		float near = 0.1f;
+		float far = 1000.0f;
+
+		float linearized = (near * far)/(far + depth * (near - far));
+		fragment = vec4(vec3(log(linearized + 1)), 1);
+		return;
+	}
+
+	vec3 P = reconstruct(p, depth);
+	vec3 dU = derivative(p, id, instance, P, ivec2(1, 0));
+	vec3 dV = derivative(p, id, instance, P, ivec2(0, 1));
+	vec3 N = normalize(cross(dU, dV));
+
+	if (mode == NORMALS) {
+		fragment = vec4(0.5 + 0.5 * N, 1.0f);
+		return;
+	}
+
+	vec3 light_direction = normalize(vec3(1, -1, -1));
+
+	vec3 diffuse = 0.1 * color * vec3(max(0, dot(N, light_direction)));
+
+	vec3 H = normalize(-viewing + light_direction);
+	vec3 specular = 0.4 * vec3(pow(max(0, dot(N, H)), 128));
+
+	vec4 n = vec4(N, 1);
+	float r = dot(n, R * n);
+	float g = dot(n, G * n);
+	float b = dot(n, B * n);
+
+	vec3 ambient = 0.3 * color * vec3(r, g, b);
+	fragment = vec4(aces(diffuse + specular + ambient), 1);
+}
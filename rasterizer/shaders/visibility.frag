@@ -0,0 +1,13 @@
+#version 450
+
+#extension GL_EXT_mesh_shader: require
+
+layout (location = 3) perprimitiveEXT flat in uint primitive;
+layout (location = 4) perprimitiveEXT flat in uint instance;
+
+layout (location = 0) out uvec4 fragment;
+
+void main()
+{
+	fragment = uvec4(primitive, floatBitsToUint(gl_FragCoord.z), instance, 0);
+}
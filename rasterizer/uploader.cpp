@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <cstring>
+
+#include "uploader.hpp"
+#include "vkutil.hpp"
+#include "microlog.h"
+
+// (Re)allocates the staging buffer; only valid while no batch is in flight
+void Uploader::reserve(vk::DeviceSize size)
+{
+	if (size <= capacity)
+		return;
+
+	if (buffer) {
+		device.unmapMemory(memory);
+		device.destroyBuffer(buffer);
+		device.freeMemory(memory);
+	}
+
+	// Grow geometrically so that slightly larger models do not reallocate
+	capacity = std::max(size, 2 * capacity);
+
+	buffer = device.createBuffer({
+		{}, capacity,
+		vk::BufferUsageFlagBits::eTransferSrc,
+		vk::SharingMode::eExclusive
+	});
+
+	auto requirements = device.getBufferMemoryRequirements(buffer);
+
+	memory = device.allocateMemory({
+		requirements.size,
+		memory_type_index(memory_properties, requirements.memoryTypeBits,
+			vk::MemoryPropertyFlagBits::eHostVisible
+				| vk::MemoryPropertyFlagBits::eHostCoherent)
+	});
+
+	device.bindBufferMemory(buffer, memory, 0);
+
+	mapped = (uint8_t *) device.mapMemory(memory, 0, capacity);
+
+	ulog_info("uploader", "staging buffer resized to %lu KB\n", capacity/1024);
+}
+
+void Uploader::begin()
+{
+	ulog_assert(!pending, "uploader", "previous batch has not completed\n");
+
+	start = std::chrono::high_resolution_clock::now();
+
+	head = 0;
+	cmd.begin(vk::CommandBufferBeginInfo { vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+}
+
+void Uploader::upload(const littlevk::Image &image, vk::Extent2D extent, std::span <const uint8_t> data)
+{
+	vk::DeviceSize offset = aligned(head);
+	ulog_assert(offset + data.size() <= capacity, "uploader", "staging buffer overflow\n");
+
+	std::memcpy(mapped + offset, data.data(), data.size());
+	head = offset + data.size();
+
+	// Only the region covered by the data, since the image may be larger
+	vk::BufferImageCopy region {
+		offset, 0, 0,
+		vk::ImageSubresourceLayers { vk::ImageAspectFlagBits::eColor, 0, 0, 1 },
+		vk::Offset3D { 0, 0, 0 },
+		vk::Extent3D { extent.width, extent.height, 1 }
+	};
+
+	littlevk::transition(cmd, image,
+			vk::ImageLayout::eUndefined,
+			vk::ImageLayout::eTransferDstOptimal);
+
+	cmd.copyBufferToImage(buffer, image.image,
+			vk::ImageLayout::eTransferDstOptimal, region);
+
+	littlevk::transition(cmd, image,
+			vk::ImageLayout::eTransferDstOptimal,
+			vk::ImageLayout::eShaderReadOnlyOptimal);
+}
+
+// Storage buffers are read by the mesh shaders only
+void Uploader::upload(const vk::Buffer &destination, std::span <const uint8_t> data)
+{
+	vk::DeviceSize offset = aligned(head);
+	ulog_assert(offset + data.size() <= capacity, "uploader", "staging buffer overflow\n");
+
+	std::memcpy(mapped + offset, data.data(), data.size());
+	head = offset + data.size();
+
+	cmd.copyBuffer(buffer, destination, vk::BufferCopy { offset, 0, data.size() });
+
+	vk::BufferMemoryBarrier barrier {
+		vk::AccessFlagBits::eTransferWrite,
+		vk::AccessFlagBits::eShaderRead,
+		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+		destination, 0, data.size()
+	};
+
+	cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eMeshShaderEXT,
+			{}, {}, barrier, {});
+}
+
+// Buffer range set to a repeated word, read and written by the task shader
+// and the vertex cache evaluation
+void Uploader::fill(const vk::Buffer &destination, vk::DeviceSize offset, vk::DeviceSize size, uint32_t value)
+{
+	cmd.fillBuffer(destination, offset, size, value);
+
+	vk::BufferMemoryBarrier barrier {
+		vk::AccessFlagBits::eTransferWrite,
+		vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite
+			| vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eIndirectCommandRead,
+		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+		destination, offset, size
+	};
+
+	cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eTransfer
+				| vk::PipelineStageFlagBits::eDrawIndirect
+				| vk::PipelineStageFlagBits::eComputeShader
+				| vk::PipelineStageFlagBits::eTaskShaderEXT,
+			{}, {}, barrier, {});
+}
+
+void Uploader::submit(const vk::Queue &queue)
+{
+	cmd.end();
+
+	device.resetFences(fence);
+
+	vk::SubmitInfo submit_info {
+		0, nullptr, nullptr,
+		1, &cmd
+	};
+
+	queue.submit(submit_info, fence);
+	pending = true;
+}
+
+// Non-blocking check for the batch in flight
+bool Uploader::complete()
+{
+	if (!pending)
+		return true;
+
+	if (device.getFenceStatus(fence) != vk::Result::eSuccess)
+		return false;
+
+	auto end = std::chrono::high_resolution_clock::now();
+	milliseconds = std::chrono::duration <double, std::milli> (end - start).count();
+	pending = false;
+
+	return true;
+}
+
+void Uploader::wait()
+{
+	if (pending)
+		(void) device.waitForFences(fence, vk::True, UINT64_MAX);
+
+	complete();
+}
+
+void Uploader::destroy()
+{
+	wait();
+
+	if (buffer) {
+		device.unmapMemory(memory);
+		device.destroyBuffer(buffer);
+		device.freeMemory(memory);
+	}
+
+	device.destroyFence(fence);
+	device.destroyCommandPool(command_pool);
+
+	buffer = nullptr;
+	mapped = nullptr;
+	capacity = 0;
+}
+
+Uploader Uploader::from(const vk::Device &device,
+		const vk::PhysicalDeviceMemoryProperties &memory_properties,
+		uint32_t family, vk::DeviceSize capacity)
+{
+	Uploader uploader;
+	uploader.device = device;
+	uploader.memory_properties = memory_properties;
+
+	uploader.command_pool = device.createCommandPool({
+		vk::CommandPoolCreateFlagBits::eResetCommandBuffer, family
+	});
+
+	uploader.cmd = device.allocateCommandBuffers({
+		uploader.command_pool, vk::CommandBufferLevel::ePrimary, 1
+	}).front();
+
+	uploader.fence = device.createFence({});
+
+	uploader.reserve(capacity);
+
+	return uploader;
+}
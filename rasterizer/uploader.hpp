@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <span>
+
+#include <littlevk/littlevk.hpp>
+
+// Batched texture and buffer uploads through one persistently mapped staging buffer;
+// every copy and layout transition of a batch is recorded into a single
+// command buffer and completes behind a single fence. The staging buffer is a
+// linear arena for one batch: the head is reset by begin and the buffer may be
+// reallocated by reserve, so only one batch can be in flight at a time
+struct Uploader {
+	vk::Device device;
+	vk::PhysicalDeviceMemoryProperties memory_properties;
+
+	vk::Buffer buffer;
+	vk::DeviceMemory memory;
+	uint8_t *mapped = nullptr;
+	vk::DeviceSize capacity = 0;
+	vk::DeviceSize head = 0;
+
+	vk::CommandPool command_pool;
+	vk::CommandBuffer cmd;
+	vk::Fence fence;
+
+	// Timing of the last batch, from the first staged byte to the fence
+	std::chrono::high_resolution_clock::time_point start;
+	double milliseconds = 0.0;
+	bool pending = false;
+
+	void reserve(vk::DeviceSize);
+	void begin();
+	void upload(const littlevk::Image &, vk::Extent2D, std::span <const uint8_t>);
+	void upload(const vk::Buffer &, std::span <const uint8_t>);
+	void fill(const vk::Buffer &, vk::DeviceSize, vk::DeviceSize, uint32_t);
+	void submit(const vk::Queue &);
+	bool complete();
+	void wait();
+	void destroy();
+
+	template <typename T>
+	void upload(const littlevk::Image &image, vk::Extent2D extent, std::span <const T> data) {
+		upload(image, extent, { (const uint8_t *) data.data(), data.size_bytes() });
+	}
+
+	// Offsets are aligned for any texel format in use
+	static constexpr vk::DeviceSize ALIGNMENT = 16;
+
+	static vk::DeviceSize aligned(vk::DeviceSize size) {
+		return ALIGNMENT * ((size + ALIGNMENT - 1) / ALIGNMENT);
+	}
+
+	static Uploader from(const vk::Device &, const vk::PhysicalDeviceMemoryProperties &, uint32_t, vk::DeviceSize);
+};
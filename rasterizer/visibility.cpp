@@ -0,0 +1,233 @@
+#include "context.hpp"
+#include "visibility.hpp"
+#include "vkutil.hpp"
+
+static const std::array <vk::DescriptorSetLayoutBinding, 1> resolve_dslbs {
+	vk::DescriptorSetLayoutBinding {
+		0, vk::DescriptorType::eCombinedImageSampler,
+		1, vk::ShaderStageFlagBits::eFragment
+	},
+};
+
+// Targets for the current depth buffers
+void VisibilityBuffer::resize(DeviceRenderContext &engine)
+{
+	for (size_t i = 0; i < images.size(); i++) {
+		device.destroyFramebuffer(framebuffers[i]);
+		device.destroyImageView(views[i]);
+		device.destroyImage(images[i]);
+		device.freeMemory(memories[i]);
+	}
+
+	images.clear();
+	memories.clear();
+	views.clear();
+	framebuffers.clear();
+
+	vk::Extent2D extent = engine.window.extent;
+
+	for (const auto &depth : engine.depth) {
+		vk::Image image = device.createImage({
+			{}, vk::ImageType::e2D, FORMAT,
+			vk::Extent3D { extent.width, extent.height, 1 },
+			1, 1, vk::SampleCountFlagBits::e1,
+			vk::ImageTiling::eOptimal,
+			vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
+			vk::SharingMode::eExclusive
+		});
+
+		auto requirements = device.getImageMemoryRequirements(image);
+
+		vk::DeviceMemory memory = device.allocateMemory({
+			requirements.size,
+			memory_type_index(memory_properties, requirements.memoryTypeBits,
+				vk::MemoryPropertyFlagBits::eDeviceLocal)
+		});
+
+		device.bindImageMemory(image, memory, 0);
+
+		vk::ImageView view = device.createImageView({
+			{}, image, vk::ImageViewType::e2D, FORMAT, {},
+			vk::ImageSubresourceRange { vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 }
+		});
+
+		std::array <vk::ImageView, 2> attachments { view, depth.view };
+
+		vk::Framebuffer framebuffer = device.createFramebuffer({
+			{}, render_pass, attachments, extent.width, extent.height, 1
+		});
+
+		images.push_back(image);
+		memories.push_back(memory);
+		views.push_back(view);
+		framebuffers.push_back(framebuffer);
+	}
+
+	device.resetDescriptorPool(descriptor_pool);
+
+	std::vector <vk::DescriptorSetLayout> layouts(images.size(), *resolve.dsl);
+	dsets = device.allocateDescriptorSets({ descriptor_pool, layouts });
+
+	for (size_t i = 0; i < images.size(); i++) {
+		littlevk::bind(device, dsets[i], resolve_dslbs)
+			.update(0, 0, sampler, views[i], vk::ImageLayout::eShaderReadOnlyOptimal)
+			.finalize();
+	}
+}
+
+// Starts the first NGF pass; must be outside of a render pass
+void VisibilityBuffer::begin(const DeviceRenderContext &engine, const vk::CommandBuffer &cmd, size_t index) const
+{
+	std::array <vk::ClearValue, 2> clear_values {
+		vk::ClearColorValue { std::array <uint32_t, 4> { ~0u, ~0u, ~0u, ~0u } },
+		vk::ClearDepthStencilValue { 1.0f, 0 }
+	};
+
+	vk::RenderPassBeginInfo info {
+		render_pass, framebuffers[index],
+		vk::Rect2D { {}, engine.window.extent },
+		clear_values
+	};
+
+	cmd.beginRenderPass(info, vk::SubpassContents::eInline);
+}
+
+// Continues into the occlusion pass, after the depth pyramid reduction
+void VisibilityBuffer::resume(const DeviceRenderContext &engine, const vk::CommandBuffer &cmd, size_t index) const
+{
+	vk::MemoryBarrier barrier {
+		vk::AccessFlagBits::eColorAttachmentWrite
+			| vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+		vk::AccessFlagBits::eColorAttachmentRead
+			| vk::AccessFlagBits::eColorAttachmentWrite
+			| vk::AccessFlagBits::eDepthStencilAttachmentRead
+			| vk::AccessFlagBits::eDepthStencilAttachmentWrite
+	};
+
+	cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput
+			| vk::PipelineStageFlagBits::eLateFragmentTests,
+		vk::PipelineStageFlagBits::eColorAttachmentOutput
+			| vk::PipelineStageFlagBits::eEarlyFragmentTests,
+		{}, barrier, {}, {});
+
+	vk::RenderPassBeginInfo info {
+		resume_pass, framebuffers[index],
+		vk::Rect2D { {}, engine.window.extent }
+	};
+
+	cmd.beginRenderPass(info, vk::SubpassContents::eInline);
+}
+
+// Shades the visible pixels into the resumed main render pass; must be
+// outside of a render pass, and ends inside the main one
+void VisibilityBuffer::shade(const DeviceRenderContext &engine, const vk::CommandBuffer &cmd,
+		const littlevk::SurfaceOperation &op, const Options &options) const
+{
+	vk::MemoryBarrier barrier {
+		vk::AccessFlagBits::eColorAttachmentWrite,
+		vk::AccessFlagBits::eShaderRead
+	};
+
+	cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput,
+		vk::PipelineStageFlagBits::eFragmentShader,
+		{}, barrier, {}, {});
+
+	render_pass_resume(engine, cmd, op);
+
+	glm::mat4 view = engine.camera.view_matrix(engine.camera_transform);
+	glm::mat4 proj = engine.camera.perspective_matrix();
+
+	ResolveData data;
+	data.inverse_view_projection = glm::inverse(proj * view);
+	data.viewing = glm::vec3(glm::inverse(view) * glm::vec4(0, 0, 1, 0));
+	data.color = glm::vec3(0.59, 0.74, 0.76);
+	data.mode = fragment_shaders.at(options.key).resolve;
+
+	cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, resolve.handle);
+	cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, resolve.layout,
+			0, { dsets[op.index] }, nullptr);
+	cmd.pushConstants <ResolveData> (resolve.layout, vk::ShaderStageFlagBits::eFragment, 0, data);
+	cmd.draw(6, 1, 0, 0);
+}
+
+void VisibilityBuffer::destroy()
+{
+	for (size_t i = 0; i < images.size(); i++) {
+		device.destroyFramebuffer(framebuffers[i]);
+		device.destroyImageView(views[i]);
+		device.destroyImage(images[i]);
+		device.freeMemory(memories[i]);
+	}
+
+	device.destroyDescriptorPool(descriptor_pool);
+}
+
+VisibilityBuffer VisibilityBuffer::from(DeviceRenderContext &engine)
+{
+	VisibilityBuffer visibility;
+	visibility.device = engine.device;
+	visibility.memory_properties = engine.memory_properties;
+
+	// Identifiers are cleared once per frame, while the depth is cleared by
+	// the main render pass and kept for the resolve and the interface
+	vk::AttachmentDescription identifiers {
+		{}, FORMAT, vk::SampleCountFlagBits::e1,
+		vk::AttachmentLoadOp::eClear, vk::AttachmentStoreOp::eStore,
+		vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eDontCare,
+		vk::ImageLayout::eUndefined, vk::ImageLayout::eColorAttachmentOptimal
+	};
+
+	vk::AttachmentDescription depth = littlevk::default_depth_attachment();
+	depth.loadOp = vk::AttachmentLoadOp::eLoad;
+	depth.storeOp = vk::AttachmentStoreOp::eStore;
+	depth.initialLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+	depth.finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
+	visibility.render_pass = littlevk::RenderPassAssembler(engine.device, engine.dal)
+		.add_attachment(identifiers)
+		.add_attachment(depth)
+		.add_subpass(vk::PipelineBindPoint::eGraphics)
+			.color_attachment(0, vk::ImageLayout::eColorAttachmentOptimal)
+			.depth_attachment(1, vk::ImageLayout::eDepthStencilAttachmentOptimal)
+			.done();
+
+	identifiers.loadOp = vk::AttachmentLoadOp::eLoad;
+	identifiers.initialLayout = vk::ImageLayout::eColorAttachmentOptimal;
+	identifiers.finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+
+	visibility.resume_pass = littlevk::RenderPassAssembler(engine.device, engine.dal)
+		.add_attachment(identifiers)
+		.add_attachment(depth)
+		.add_subpass(vk::PipelineBindPoint::eGraphics)
+			.color_attachment(0, vk::ImageLayout::eColorAttachmentOptimal)
+			.depth_attachment(1, vk::ImageLayout::eDepthStencilAttachmentOptimal)
+			.done();
+
+	// Only used with texelFetch
+	visibility.sampler = littlevk::SamplerAssembler(engine.device, engine.dal);
+
+	auto bundle = littlevk::ShaderStageBundle(engine.device, engine.dal)
+		.file(SHADERS_DIRECTORY "/quad.vert", vk::ShaderStageFlagBits::eVertex)
+		.file(SHADERS_DIRECTORY "/resolve.frag", vk::ShaderStageFlagBits::eFragment);
+
+	visibility.resolve = littlevk::PipelineAssembler <littlevk::eGraphics> (engine.device, engine.window, engine.dal)
+		.with_render_pass(engine.render_pass, 0)
+		.with_shader_bundle(bundle)
+		.cull_mode(vk::CullModeFlagBits::eNone)
+		.depth_stencil(false, false)
+		.with_dsl_bindings(resolve_dslbs)
+		.with_push_constant <ResolveData> (vk::ShaderStageFlagBits::eFragment);
+
+	// Enough sets for any swapchain
+	uint32_t sets = 8;
+
+	vk::DescriptorPoolSize pool_size { vk::DescriptorType::eCombinedImageSampler, sets };
+
+	visibility.descriptor_pool = engine.device.createDescriptorPool({
+		{}, sets, pool_size
+	});
+
+	visibility.resize(engine);
+
+	return visibility;
+}
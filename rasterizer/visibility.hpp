@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <littlevk/littlevk.hpp>
+
+struct DeviceRenderContext;
+struct Options;
+
+struct alignas(16) ResolveData {
+	glm::mat4 inverse_view_projection;
+	alignas(16) glm::vec3 viewing;
+	alignas(16) glm::vec3 color;
+	int mode;
+};
+
+// Deferred alternative to the fragment shaders: the NGF passes only write the
+// packed patch and primitive index (see ngf.mesh), the depth and the instance
+// of each pixel, and a full screen resolve shades every pixel once, rebuilding
+// the position from the depth and the normal from neighbors on the same
+// triangle of the same instance
+struct VisibilityBuffer {
+	// Identifier, depth and instance; three channel targets are rarely
+	// supported as color attachments, so the last channel is unused
+	static constexpr vk::Format FORMAT = vk::Format::eR32G32B32A32Uint;
+
+	vk::Device device;
+	vk::PhysicalDeviceMemoryProperties memory_properties;
+
+	// The first pass clears the identifiers and the second one keeps them;
+	// both continue from the depth of the main render pass
+	vk::RenderPass render_pass;
+	vk::RenderPass resume_pass;
+
+	// NGF pipeline, created with the others (see DeviceRenderContext::specialize)
+	littlevk::Pipeline geometry;
+	littlevk::Pipeline resolve;
+
+	// One target per depth buffer
+	std::vector <vk::Image> images;
+	std::vector <vk::DeviceMemory> memories;
+	std::vector <vk::ImageView> views;
+	std::vector <vk::Framebuffer> framebuffers;
+
+	vk::Sampler sampler;
+	vk::DescriptorPool descriptor_pool;
+	std::vector <vk::DescriptorSet> dsets;
+
+	void resize(DeviceRenderContext &);
+	void begin(const DeviceRenderContext &, const vk::CommandBuffer &, size_t) const;
+	void resume(const DeviceRenderContext &, const vk::CommandBuffer &, size_t) const;
+	void shade(const DeviceRenderContext &, const vk::CommandBuffer &, const littlevk::SurfaceOperation &, const Options &) const;
+	void destroy();
+
+	static VisibilityBuffer from(DeviceRenderContext &);
+};
@@ -1,5 +1,19 @@
 #include "vkutil.hpp"
 #include "context.hpp"
+#include "loader.hpp"
+#include "profiler.hpp"
+
+uint32_t memory_type_index(const vk::PhysicalDeviceMemoryProperties &memory_properties,
+		uint32_t bits, vk::MemoryPropertyFlags flags)
+{
+	for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+		if ((bits & (1u << i)) && (memory_properties.memoryTypes[i].propertyFlags & flags) == flags)
+			return i;
+	}
+
+	ulog_assert(false, "memory_type_index", "no memory type with the requested properties\n");
+	return 0;
+}
 
 std::optional <std::pair <vk::CommandBuffer, littlevk::SurfaceOperation>> new_frame(DeviceRenderContext &engine, size_t frame)
 {
@@ -56,8 +70,202 @@ void render_pass_begin(const DeviceRenderContext &engine, const vk::CommandBuffe
 	return cmd.beginRenderPass(rpbi, vk::SubpassContents::eInline);
 }
 
+// Continues into the second pass of the frame, keeping the attachments
+void render_pass_resume(const DeviceRenderContext &engine, const vk::CommandBuffer &cmd, const littlevk::SurfaceOperation &op)
+{
+	vk::MemoryBarrier barrier {
+		vk::AccessFlagBits::eColorAttachmentWrite
+			| vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+		vk::AccessFlagBits::eColorAttachmentRead
+			| vk::AccessFlagBits::eColorAttachmentWrite
+			| vk::AccessFlagBits::eDepthStencilAttachmentRead
+			| vk::AccessFlagBits::eDepthStencilAttachmentWrite
+	};
+
+	cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput
+			| vk::PipelineStageFlagBits::eLateFragmentTests,
+		vk::PipelineStageFlagBits::eColorAttachmentOutput
+			| vk::PipelineStageFlagBits::eEarlyFragmentTests,
+		{}, barrier, {}, {});
+
+	const auto &rpbi = littlevk::default_rp_begin_info <2>
+		(engine.resume_pass, engine.framebuffers[op.index], engine.window);
+
+	return cmd.beginRenderPass(rpbi, vk::SubpassContents::eInline);
+}
+
 void render_pass_end(const DeviceRenderContext &engine, const vk::CommandBuffer &cmd)
 {
 	return cmd.endRenderPass();
 }
 
+
+glm::vec4 clear_color(const Options &options)
+{
+	if (options.key == "Depth")
+		return glm::vec4(0.0f);
+
+	return glm::vec4(1.0f);
+}
+
+// Draws the model for one culling phase (see ngf.task)
+static void render_ngf(DeviceRenderContext &engine, const vk::CommandBuffer &cmd, const Options &options,
+		const littlevk::Pipeline &ppl, const NGFResources *model, const vk::DescriptorSet &model_dset,
+		float time, int phase)
+{
+	glm::mat4 view = engine.camera.view_matrix(engine.camera_transform);
+	glm::mat4 proj = engine.camera.perspective_matrix();
+
+	cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, ppl.handle);
+	cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, ppl.layout,
+			0, { model_dset }, nullptr);
+
+	// Task/Mesh shader push constants
+	int flags = 0;
+	flags |= int(options.backface_culling);
+	flags |= phase << 1;
+	flags |= int(options.vertex_cache) << 3;
+
+	glm::vec3 viewing = glm::vec3(glm::inverse(view) * glm::vec4(0, 0, 1, 0));
+
+	TaskData task_data;
+	task_data.model = Transform().matrix();
+	task_data.view = view;
+	task_data.proj = proj;
+	task_data.flags = flags;
+	task_data.resolution = options.resolution;
+	task_data.detail = 0.0f;
+	if (options.adaptive_tessellation)
+		task_data.detail = 0.5f * engine.window.extent.height/std::max(options.edge_pixels, 1.0f);
+	task_data.frame = engine.vertex_cache.frame;
+	task_data.viewing = viewing;
+	task_data.time = time;
+
+	// Fragment shader push constants
+	ShadingData shading_data;
+	shading_data.viewing = viewing;
+	shading_data.color = glm::vec3(0.59, 0.74, 0.76);
+
+	cmd.pushConstants <ShadingData> (ppl.layout,
+		vk::ShaderStageFlagBits::eFragment,
+		sizeof(TaskData), shading_data);
+
+	if (!model)
+		return;
+
+	// Every patch of every instance, as (patch, instance) workgroups over the
+	// patches of the widest asset; the instances are split across draws
+	// within the task workgroup limits, with the first instance of each draw
+	// in the upper bits of the flags
+	uint32_t patches = model->widest;
+	uint32_t batch = std::min(engine.task_group_total / std::max(patches, 1u), engine.task_group_count[1]);
+	batch = std::max(batch, 1u);
+
+	for (uint32_t first = 0; first < engine.instances.count; first += batch) {
+		task_data.flags = flags | int(first << 8);
+
+		cmd.pushConstants <TaskData> (ppl.layout,
+			vk::ShaderStageFlagBits::eMeshEXT
+				| vk::ShaderStageFlagBits::eTaskEXT,
+			0, task_data);
+
+		cmd.drawMeshTasksEXT(patches, std::min(batch, engine.instances.count - first), 1);
+	}
+}
+
+void render_scene(DeviceRenderContext &engine, const vk::CommandBuffer &cmd,
+		const littlevk::SurfaceOperation &op, const Options &options,
+		const NGFResources *model, const vk::DescriptorSet &model_dset,
+		const vk::DescriptorSet &environment_dset, float time,
+		Profiler *profiler)
+{
+	auto start = [&](Profiler::Pass pass) {
+		if (profiler)
+			profiler->start(cmd, pass);
+	};
+
+	auto end = [&](Profiler::Pass pass) {
+		if (profiler)
+			profiler->end(cmd, pass);
+	};
+
+	// Environment
+	start(Profiler::eEnvironment);
+
+	if (options.key == "Shaded") {
+		RayFrame rayframe = engine.camera.rayframe(engine.camera_transform);
+
+		cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, engine.environment.handle);
+		cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+				engine.environment.layout,
+				0, { environment_dset }, nullptr);
+		cmd.pushConstants <RayFrame> (engine.environment.layout,
+			vk::ShaderStageFlagBits::eFragment,
+			0, rayframe);
+		cmd.bindVertexBuffers(0, { VK_NULL_HANDLE }, { 0 });
+		cmd.draw(6, 1, 0, 0);
+	}
+
+	end(Profiler::eEnvironment);
+
+	// Patches visible in the last frame, or all of them without occlusion culling
+	bool occlusion = options.occlusion_culling && model;
+
+	// The deferred path draws into the visibility buffer instead, continuing
+	// from the depth cleared by the main render pass
+	bool deferred = options.visibility && fragment_shaders.at(options.key).resolve >= 0;
+
+	const auto &ppl = deferred ? engine.visibility.geometry : engine.primaries[options.key];
+
+	if (deferred) {
+		render_pass_end(engine, cmd);
+		engine.visibility.begin(engine, cmd, op.index);
+	}
+
+	start(Profiler::eNGF);
+	if (profiler)
+		profiler->begin_statistics(cmd, 0);
+
+	render_ngf(engine, cmd, options, ppl, model, model_dset, time, occlusion ? 1 : 0);
+
+	if (profiler)
+		profiler->end_statistics(cmd, 0);
+	end(Profiler::eNGF);
+
+	render_pass_end(engine, cmd);
+
+	// Depth pyramid of the first pass
+	start(Profiler::ePyramid);
+
+	if (occlusion)
+		engine.culling.build(cmd, engine.depth[op.index], op.index);
+
+	end(Profiler::ePyramid);
+
+	if (deferred)
+		engine.visibility.resume(engine, cmd, op.index);
+	else
+		render_pass_resume(engine, cmd, op);
+
+	// Remaining patches, tested against the pyramid
+	start(Profiler::eOcclusion);
+	if (profiler)
+		profiler->begin_statistics(cmd, 1);
+
+	if (occlusion)
+		render_ngf(engine, cmd, options, ppl, model, model_dset, time, 2);
+
+	if (profiler)
+		profiler->end_statistics(cmd, 1);
+	end(Profiler::eOcclusion);
+
+	// Shading of the visibility buffer, in the resumed main render pass
+	start(Profiler::eResolve);
+
+	if (deferred) {
+		render_pass_end(engine, cmd);
+		engine.visibility.shade(engine, cmd, op, options);
+	}
+
+	end(Profiler::eResolve);
+}
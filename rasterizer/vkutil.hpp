@@ -1,13 +1,19 @@
 #pragma once
 
-#include <utility>
 #include <optional>
+#include <utility>
 
 #include <glm/glm.hpp>
 
 #include <littlevk/littlevk.hpp>
 
 struct DeviceRenderContext;
+struct NGFResources;
+struct Options;
+struct Profiler;
+
+// Memory type with all of the requested properties, for raw allocations
+uint32_t memory_type_index(const vk::PhysicalDeviceMemoryProperties &, uint32_t, vk::MemoryPropertyFlags);
 
 std::optional <std::pair <vk::CommandBuffer, littlevk::SurfaceOperation>>
 new_frame(DeviceRenderContext &, size_t);
@@ -20,47 +26,17 @@ void present_frame(DeviceRenderContext &, const littlevk::SurfaceOperation &, si
 void render_pass_begin(const DeviceRenderContext &, const vk::CommandBuffer &,
 		const littlevk::SurfaceOperation &, const glm::vec4 &);
 
-void render_pass_end(const DeviceRenderContext &, const vk::CommandBuffer &);
-
-// Allocate and copy in one step
-template <typename T>
-littlevk::Image general_allocator(const vk::Device &device,
-		const vk::PhysicalDeviceMemoryProperties &memory_properties,
-		const vk::CommandPool &command_pool,
-		const vk::Queue &graphics_queue,
-		littlevk::Deallocator &dal,
-		const std::vector <T> &buffer, vk::Extent2D extent,
-		const vk::ImageType type = vk::ImageType::e2D,
-		const vk::Format format = vk::Format::eR32G32B32A32Sfloat)
-{
-	vk::ImageViewType view = (type == vk::ImageType::e2D)
-		? vk::ImageViewType::e2D
-		: vk::ImageViewType::e1D;
-
-	littlevk::Image texture;
-	littlevk::Buffer staging;
-	std::tie(texture, staging) = bind(device, memory_properties, dal)
-		.image(extent, format,
-			vk::ImageUsageFlagBits::eSampled
-				| vk::ImageUsageFlagBits::eTransferDst,
-			vk::ImageAspectFlagBits::eColor,
-			type, view)
-		.buffer(buffer, vk::BufferUsageFlagBits::eTransferSrc);
+void render_pass_resume(const DeviceRenderContext &, const vk::CommandBuffer &,
+		const littlevk::SurfaceOperation &);
 
-	littlevk::submit_now(device, command_pool, graphics_queue,
-		[&](const vk::CommandBuffer &cmd) {
-			littlevk::transition(cmd, texture,
-					vk::ImageLayout::eUndefined,
-					vk::ImageLayout::eTransferDstOptimal);
-
-			littlevk::copy_buffer_to_image(cmd, texture, staging,
-					vk::ImageLayout::eTransferDstOptimal);
+void render_pass_end(const DeviceRenderContext &, const vk::CommandBuffer &);
 
-			littlevk::transition(cmd, texture,
-					vk::ImageLayout::eTransferDstOptimal,
-					vk::ImageLayout::eShaderReadOnlyOptimal);
-		}
-	);
+glm::vec4 clear_color(const Options &);
 
-	return texture;
-};
+// Environment (if shaded) and the model, from the current camera of the
+// engine; starts inside the render pass begun by the caller and ends inside
+// the resumed pass, after the depth pyramid reduction in between
+void render_scene(DeviceRenderContext &, const vk::CommandBuffer &,
+		const littlevk::SurfaceOperation &, const Options &,
+		const NGFResources *, const vk::DescriptorSet &, const vk::DescriptorSet &, float,
+		Profiler * = nullptr);
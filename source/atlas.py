@@ -0,0 +1,69 @@
+import time
+import torch
+import argparse
+import ngfutil
+
+
+def synthetic_bounds(count: int, generator: torch.Generator) -> torch.Tensor:
+    """Charts with log-normal scales and aspect ratios between 1:4 and 4:1"""
+    scale = torch.randn(count, generator=generator).mul(0.5).exp()
+    aspect = 2 ** (4 * torch.rand(count, generator=generator) - 2)
+
+    bounds = torch.zeros((count, 4), dtype=torch.float32)
+    bounds[:, 2] = scale * aspect.sqrt()
+    bounds[:, 3] = scale / aspect.sqrt()
+    return bounds
+
+
+def mesh_bounds(path: str, charts: int, generator: torch.Generator) -> torch.Tensor:
+    """Charts of a mesh, scaled by the square root of their surface area"""
+    V, N, F, _ = ngfutil.load_mesh_cached(path)
+    geometry = ngfutil.geometry(V, N, F)
+
+    # Distinct seeds, as repeated ones leave empty charts behind
+    seeds = torch.randperm(F.shape[0], generator=generator)[:charts].tolist()
+    vertices, faces, uvs, voffsets, foffsets, _ = ngfutil.parametrize_multicharts_packed(geometry, seeds)
+    charts = len(seeds)
+
+    v = vertices[faces.long()]
+    areas = torch.linalg.cross(v[:, 1] - v[:, 0], v[:, 2] - v[:, 0], dim=-1).norm(dim=-1) / 2
+    chart = torch.repeat_interleave(torch.arange(charts), foffsets.diff())
+    area = torch.zeros(charts).index_add_(0, chart, areas)
+
+    vchart = torch.repeat_interleave(torch.arange(charts), voffsets.diff())
+    lo = torch.full((charts, 2), float('inf')).scatter_reduce(0, vchart[:, None].expand(-1, 2), uvs, 'amin')
+    hi = torch.full((charts, 2), float('-inf')).scatter_reduce(0, vchart[:, None].expand(-1, 2), uvs, 'amax')
+
+    # Skip any chart that still came out empty or degenerate
+    keep = (foffsets.diff() > 0) & (voffsets.diff() > 0) & (area > 0)
+    lo, hi, area = lo[keep], hi[keep], area[keep]
+
+    scale = (area / area.mean()).sqrt()[:, None]
+    return torch.cat([lo * scale, hi * scale], dim=1)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Time and measure the utilization of the chart atlas packer')
+    parser.add_argument('--counts', type=int, nargs='+', default=[1000, 10000, 100000], help='Synthetic chart counts')
+    parser.add_argument('--mesh', type=str, default=None, help='Pack the parametrized charts of a mesh instead')
+    parser.add_argument('--charts', type=int, default=1000, help='Chart count for --mesh')
+    parser.add_argument('--density', type=float, default=16.0, help='Texels per unit of chart uv')
+    parser.add_argument('--gutter', type=int, default=2, help='Texels of padding on each side of a chart')
+    parser.add_argument('--rotate', action='store_true', help='Also try packings with rotated charts')
+    args = parser.parse_args()
+
+    generator = torch.Generator().manual_seed(0)
+
+    if args.mesh:
+        inputs = [ mesh_bounds(args.mesh, args.charts, generator) ]
+    else:
+        inputs = [ synthetic_bounds(count, generator) for count in args.counts ]
+
+    print(f'{"charts":>8} {"atlas":>12} {"utilization":>12} {"ms":>10}')
+    for bounds in inputs:
+        start = time.perf_counter()
+        _, _, width, height, utilization = ngfutil.pack_atlas(bounds, args.density, args.gutter, args.rotate)
+        elapsed = 1000 * (time.perf_counter() - start)
+
+        atlas = f'{width}x{height}'
+        print(f'{bounds.shape[0]:8d} {atlas:>12} {100 * utilization:11.1f}% {elapsed:10.1f}')
@@ -0,0 +1,27 @@
+import os
+import argparse
+
+from ngf import NGF
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Convert NGF binaries to the versioned format')
+    parser.add_argument('input', type=str, help='NGF binary (.bin) or PyTorch (.pt) file')
+    parser.add_argument('output', type=str, help='Output binary')
+    parser.add_argument('--vertices', type=str, default='quantized', choices=['fp32', 'fp16', 'quantized'])
+    parser.add_argument('--features', type=str, default='quantized', choices=['fp32', 'fp16', 'quantized'])
+    parser.add_argument('--network', type=str, default='fp16', choices=['fp32', 'fp16', 'int8'])
+    parser.add_argument('--no-deflate', action='store_true', help='Store the sections uncompressed')
+    args = parser.parse_args()
+
+    if args.input.endswith('.pt'):
+        ngf = NGF.from_pt(args.input)
+    else:
+        ngf = NGF.from_binary(args.input, device='cpu')
+
+    stream = ngf.stream_v2(args.vertices, args.features, args.network, not args.no_deflate)
+    with open(args.output, 'wb') as file:
+        file.write(stream)
+
+    before = os.path.getsize(args.input) / 1024
+    after = len(stream) / 1024
+    print(f'{args.input} ({before:.1f} KB) -> {args.output} ({after:.1f} KB)')
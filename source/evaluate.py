@@ -1,6 +1,7 @@
 import os
 import torch
 import optext
+import ngfutil
 import argparse
 import numpy as np
 
@@ -191,36 +192,19 @@ def scene_evaluations(reference, directory, alt=None):
 
     evaluator = Evaluator(ref)
 
-    qslim = os.path.join(os.path.dirname(__file__), os.path.pardir, 'build', 'simplify')
-    assert os.path.exists(qslim), 'Could not find simplification program %s' % qslim
+    # One progressive collapse sequence of the reference, in its original
+    # coordinates, from which every size matched baseline is extracted
+    V, _, F, _ = ngfutil.load_mesh_cached(reference)
+    progressive = ngfutil.ProgressiveMesh(V, F)
 
     os.makedirs('results/generated', exist_ok=True)
     qslim_result = 'results/generated/smashed.obj'
 
-    def qslim_exec(rate):
-        import subprocess
-
-        cmd = subprocess.list2cmdline([ qslim, args.reference, qslim_result, str(rate) ])
-        subprocess.call(cmd, shell=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
-
-        qslimmed, _ = load_mesh(qslim_result)
-        size = mesh_size(qslimmed.vertices, qslimmed.faces)
-
-        return size
-
-    def qslim_search(size):
-        from tqdm import trange
-
-        small, large = 0.001, 0.95
-        for _ in trange(15, ncols=100, desc='QSlim'):
-            mid = (small + large) / 2
-            qsize = qslim_exec(mid)
-            if qsize > size:
-                large = mid
-            else:
-                small = mid
-
-        qslim_exec((small + large) / 2)
+    def qslim_extract(size):
+        V, F = progressive.extract_bytes(size)
+        with open(qslim_result, 'w') as file:
+            file.write(''.join(f'v {x} {y} {z}\n' for x, y, z in V.tolist()))
+            file.write(''.join(f'f {a + 1} {b + 1} {c + 1}\n' for a, b, c in F.tolist()))
 
     evaluations = { 'reference' : {
             'size': mesh_size(ref.vertices, ref.faces),
@@ -264,9 +248,10 @@ def scene_evaluations(reference, directory, alt=None):
     # QSlim and nvdiffmodeling at various sizes
     for size in sizes:
         # QSlim
-        qslim_search(size)
+        qslim_extract(size)
 
-        smashed, _ = load_mesh(qslim_result)
+        # Generated per size and run, so kept out of the mesh cache
+        smashed, _ = load_mesh(qslim_result, cache=False)
 
         metrics = evaluator.eval_metrics(smashed, name)
         metrics['count'] = smashed.faces.shape[0]
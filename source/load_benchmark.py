@@ -0,0 +1,34 @@
+import os
+import time
+import argparse
+import ngfutil
+
+
+def timed(fn, repeat: int):
+    result = fn()
+    start = time.perf_counter()
+    for _ in range(repeat):
+        result = fn()
+    return result, 1000 * (time.perf_counter() - start) / repeat
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Compare the native mesh loaders against Assimp')
+    parser.add_argument('meshes', type=str, nargs='+', help='STL, OBJ or PLY files')
+    parser.add_argument('--repeat', type=int, default=3, help='Timed repetitions per loader')
+    parser.add_argument('--no-weld', action='store_true', help='Keep duplicated positions')
+    args = parser.parse_args()
+
+    weld = not args.no_weld
+
+    print(f'{"mesh":>24} {"vertices":>10} {"triangles":>10} {"native ms":>10} {"assimp ms":>10} {"speedup":>8}')
+    for path in args.meshes:
+        (V, _, _, F), native = timed(lambda: ngfutil.load_mesh(path, weld, True), args.repeat)
+        (Va, _, _, Fa), assimp = timed(lambda: ngfutil.load_mesh(path, weld, False), args.repeat)
+
+        if V.shape != Va.shape or F.shape != Fa.shape:
+            print(f'{os.path.basename(path)}: native {tuple(V.shape)}/{tuple(F.shape)} '
+                  f'differs from Assimp {tuple(Va.shape)}/{tuple(Fa.shape)}')
+
+        name = os.path.basename(path)
+        print(f'{name:>24} {V.shape[0]:10d} {F.shape[0]:10d} {native:10.1f} {assimp:10.1f} {assimp / native:7.1f}x')
@@ -1,5 +1,6 @@
 from __future__ import annotations
 
+import zlib
 import meshio
 import logging
 import numpy as np
@@ -43,6 +44,74 @@ class MLP(nn.Module):
         return bytestream
 
 
+# Versioned binary format (see rasterizer/io.hpp)
+FORMAT_MAGIC = b'NGF2'
+FORMAT_VERSION = 2
+
+SECTION_INFO = 1
+SECTION_VERTICES = 2
+SECTION_FEATURES = 3
+SECTION_COMPLEXES = 4
+SECTION_NETWORK = 5
+
+ENCODINGS = {'fp32': 0, 'fp16': 1, 'quantized': 2}
+ENCODING_DEFLATE = 1 << 8
+
+
+def encode_vertices(points: np.ndarray, encoding: str) -> bytes:
+    if encoding == 'fp32':
+        return points.astype(np.float32).tobytes()
+    if encoding == 'fp16':
+        return points.astype(np.float16).tobytes()
+
+    # 16-bit fixed point within the bounding box
+    vmin = points.min(axis=0)
+    extent = points.max(axis=0) - vmin
+    extent[extent == 0] = 1
+    q = np.rint((points - vmin) / extent * 65535).clip(0, 65535).astype(np.uint16)
+    return vmin.astype(np.float32).tobytes() + extent.astype(np.float32).tobytes() + q.tobytes()
+
+
+def encode_features(features: np.ndarray, encoding: str) -> bytes:
+    if encoding == 'fp32':
+        return features.astype(np.float32).tobytes()
+    if encoding == 'fp16':
+        return features.astype(np.float16).tobytes()
+
+    # 8-bit values with a range per feature channel
+    fmin = features.min(axis=0)
+    scale = (features.max(axis=0) - fmin) / 255
+    scale[scale == 0] = 1
+    q = np.rint((features - fmin) / scale).clip(0, 255).astype(np.uint8)
+    return fmin.astype(np.float32).tobytes() + scale.astype(np.float32).tobytes() + q.tobytes()
+
+
+def pack_sections(sections: list[tuple[int, int, bytes]], deflate: bool) -> bytes:
+    header_size = 16
+    entry_size = 40
+
+    table = b''
+    payloads = b''
+    offset = header_size + entry_size * len(sections)
+    for tag, encoding, raw in sections:
+        stored = raw
+        if deflate:
+            compressed = zlib.compress(raw, 9)
+            if len(compressed) < len(raw):
+                stored = compressed
+                encoding |= ENCODING_DEFLATE
+
+        table += np.array([tag, encoding], dtype=np.uint32).tobytes()
+        table += np.array([offset, len(stored), len(raw)], dtype=np.uint64).tobytes()
+        table += np.array([zlib.crc32(stored), 0], dtype=np.uint32).tobytes()
+
+        payloads += stored
+        offset += len(stored)
+
+    header = FORMAT_MAGIC + np.array([FORMAT_VERSION, len(sections), 0], dtype=np.uint32).tobytes()
+    return header + table + payloads
+
+
 # Positional encoding
 def positional_encoding(vector: torch.Tensor, extras: list[torch.Tensor], levels: int) -> torch.Tensor:
     result = extras
@@ -69,7 +138,7 @@ class NGF:
         self.normals = normals
 
         self.ffin = self.features.shape[-1] + 3 * 2 * self.fflevels
-        self.mlp = MLP(self.ffin).cuda()
+        self.mlp = MLP(self.ffin).to(self.points.device)
         if mlp is not None:
             self.mlp.load_state_dict(mlp.state_dict())
 
@@ -128,8 +197,8 @@ class NGF:
         if rate in self.uv_cache:
             return self.uv_cache[rate]
 
-        U = torch.linspace(0.0, 1.0, steps=rate, device='cuda')
-        V = torch.linspace(0.0, 1.0, steps=rate, device='cuda')
+        U = torch.linspace(0.0, 1.0, steps=rate, device=self.points.device)
+        V = torch.linspace(0.0, 1.0, steps=rate, device=self.points.device)
         U, V = torch.meshgrid(U, V, indexing='ij')
 
         U, V = U.reshape(-1), V.reshape(-1)
@@ -153,13 +222,34 @@ class NGF:
 
         delta = 0.45/(rate - 1)
 
-        rtheta = 2 * np.pi * torch.rand(*U.shape, device='cuda')
-        rr = torch.rand(*U.shape, device='cuda').sqrt()
+        rtheta = 2 * np.pi * torch.rand(*U.shape, device=U.device)
+        rr = torch.rand(*U.shape, device=U.device).sqrt()
         ru = delta * rr * rtheta.cos() * UV_interior
         rv = delta * rr * rtheta.sin() * UV_interior
 
         return U + ru, V + rv
 
+    def reorder(self, curve: str = 'hilbert'):
+        """Order patches along a space filling curve and vertices by first touch"""
+        import ngfutil
+
+        order, remap = ngfutil.spatial_order(self.points, self.complexes, curve)
+
+        device = self.points.device
+        order, remap = order.to(device), remap.to(device)
+
+        with torch.no_grad():
+            points = torch.empty_like(self.points)
+            features = torch.empty_like(self.features)
+            points[remap] = self.points
+            features[remap] = self.features
+
+        self.points = points.requires_grad_(self.points.requires_grad)
+        self.features = features.requires_grad_(self.features.requires_grad)
+        self.complexes = remap[self.complexes[order].long()].to(self.complexes.dtype)
+
+        return order, remap
+
     def save(self, filename):
         """Save into a PyTorch (PT) file"""
         torch.save({
@@ -186,12 +276,42 @@ class NGF:
 
         return size_bytes + points_bytes + features_bytes + complexes_bytes + mlp_bytes
 
+    def stream_v2(self, vertices: str = 'quantized', features: str = 'quantized',
+                  network: str = 'fp16', deflate: bool = True) -> bytes:
+        """Convert to the versioned byte stream with reduced precision sections"""
+        import ngfutil
+
+        with torch.no_grad():
+            points = self.points.detach().cpu().numpy()
+            fvectors = self.features.detach().cpu().numpy()
+            complexes = self.complexes.cpu().numpy().astype(np.int32)
+
+        linears = [layer for layer in self.mlp.layers if isinstance(layer, nn.Linear)]
+        weights = [layer.weight.data.cpu() for layer in linears]
+        biases = [layer.bias.data.cpu() for layer in linears]
+        mlp = ngfutil.QuantizedMLP(weights, biases, network)
+
+        sizes = [complexes.shape[0], points.shape[0], fvectors.shape[-1], len(linears)]
+
+        sections = [
+            (SECTION_INFO, 0, np.array(sizes, dtype=np.int32).tobytes()),
+            (SECTION_VERTICES, ENCODINGS[vertices], encode_vertices(points, vertices)),
+            (SECTION_FEATURES, ENCODINGS[features], encode_features(fvectors, features)),
+            (SECTION_COMPLEXES, 0, complexes.tobytes()),
+            (SECTION_NETWORK, 0, mlp.stream()),
+        ]
+
+        return pack_sections(sections, deflate)
+
     @staticmethod
     def from_base(path: str, normalizer: Callable, features: int, config: dict = dict()) -> NGF:
         mesh = meshio.read(path)
         points = torch.from_numpy(mesh.points)
         complexes = torch.from_numpy(mesh.cells_dict['quad'])
+        return NGF.from_complexes(points, complexes, normalizer, features, config)
 
+    @staticmethod
+    def from_complexes(points: torch.Tensor, complexes: torch.Tensor, normalizer: Callable, features: int, config: dict = dict()) -> NGF:
         points = normalizer(points.float().cuda())
         features = torch.zeros((points.shape[0], features)).cuda()
         complexes = complexes.int().cuda()
@@ -204,6 +324,53 @@ class NGF:
                    config.setdefault('jittering', True),
                    config.setdefault('normals', True))
 
+    @staticmethod
+    def from_binary(path: str, device: str = 'cuda') -> NGF:
+        """Load from the byte stream format produced by stream()"""
+        with open(path, 'rb') as file:
+            data = file.read()
+
+        assert data[:4] != FORMAT_MAGIC, 'Versioned NGF binaries are only read by the rasterizer'
+
+        offset = 0
+
+        def read(dtype, count):
+            nonlocal offset
+            array = np.frombuffer(data, dtype=dtype, count=count, offset=offset)
+            offset += array.nbytes
+            return array
+
+        patches, vertices, feature_size = read(np.int32, 3).tolist()
+        points = read(np.float32, 3 * vertices).reshape(vertices, 3)
+        features = read(np.float32, feature_size * vertices).reshape(vertices, feature_size)
+        complexes = read(np.int32, 4 * patches).reshape(patches, 4)
+
+        weights = []
+        for _ in range(4):
+            rows, cols = read(np.int32, 2).tolist()
+            weights.append(read(np.float32, rows * cols).reshape(rows, cols))
+
+        biases = []
+        for _ in range(4):
+            size = read(np.int32, 1).item()
+            biases.append(read(np.float32, size))
+
+        # The stream does not record the frequency levels
+        fflevels = (weights[0].shape[1] - feature_size) // 6
+
+        ngf = NGF(torch.from_numpy(points.copy()).to(device),
+                  torch.from_numpy(features.copy()).to(device),
+                  torch.from_numpy(complexes.copy()).to(device),
+                  fflevels, False, True)
+
+        linears = [layer for layer in ngf.mlp.layers if isinstance(layer, nn.Linear)]
+        with torch.no_grad():
+            for layer, w, b in zip(linears, weights, biases):
+                layer.weight.copy_(torch.from_numpy(w.copy()))
+                layer.bias.copy_(torch.from_numpy(b.copy()))
+
+        return ngf
+
     @staticmethod
     def from_pt(path: str) -> NGF:
         data = torch.load(path)
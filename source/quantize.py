@@ -0,0 +1,118 @@
+import os
+import time
+import torch
+import ngfutil
+import argparse
+import numpy as np
+import torch.nn as nn
+
+from ngf import NGF, positional_encoding
+from util import quadify, vertex_normals
+
+
+def load_ngf(path: str) -> NGF:
+    if path.endswith('.pt'):
+        ngf = NGF.from_pt(path)
+        ngf.points = ngf.points.detach().cpu()
+        ngf.features = ngf.features.detach().cpu()
+        ngf.complexes = ngf.complexes.cpu()
+        ngf.mlp = ngf.mlp.cpu()
+        return ngf
+
+    return NGF.from_binary(path, device='cpu')
+
+
+def network_inputs(ngf: NGF, rate: int):
+    U = torch.linspace(0.0, 1.0, steps=rate)
+    V = torch.linspace(0.0, 1.0, steps=rate)
+    U, V = torch.meshgrid(U, V, indexing='ij')
+    U = U.reshape(-1).repeat((ngf.complexes.shape[0], 1))
+    V = V.reshape(-1).repeat((ngf.complexes.shape[0], 1))
+
+    complexes = ngf.complexes.long()
+    with torch.no_grad():
+        lp = NGF.interpolate(ngf.points, complexes, U, V)
+        lf = NGF.interpolate(ngf.features, complexes, U, V)
+        lin = positional_encoding(lp, [lf], ngf.fflevels)
+
+    return lp, lin
+
+
+def chamfer(X: torch.Tensor, Y: torch.Tensor, device: str, chunk: int = 4096) -> float:
+    X, Y = X.to(device), Y.to(device)
+
+    def directed(A, B):
+        total = 0.0
+        for i in range(0, A.shape[0], chunk):
+            d = torch.cdist(A[i : i + chunk], B)
+            total += d.min(dim=1).values.square().sum().item()
+        return total / A.shape[0]
+
+    return directed(X, Y) + directed(Y, X)
+
+
+def normal_error(N: torch.Tensor, Nref: torch.Tensor) -> float:
+    cosines = (N * Nref).sum(dim=-1).clamp(-1, 1)
+    return torch.rad2deg(torch.acos(cosines)).mean().item()
+
+
+def timed(fn, repeat: int):
+    fn()
+    start = time.perf_counter()
+    for _ in range(repeat):
+        result = fn()
+    return result, 1000 * (time.perf_counter() - start) / repeat
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Post-training quantization of NGF networks')
+    parser.add_argument('ngf', type=str, help='NGF binary (.bin) or PyTorch (.pt) file')
+    parser.add_argument('--rate', type=int, default=16, help='Sampling rate per patch side')
+    parser.add_argument('--precisions', nargs='+', default=['fp32', 'fp16', 'int8'], help='Variants to evaluate')
+    parser.add_argument('--repeat', type=int, default=5, help='Timed repetitions per variant')
+    parser.add_argument('--export', type=str, default=None, help='Directory for the quantized networks')
+    args = parser.parse_args()
+
+    device = 'cuda' if torch.cuda.is_available() else 'cpu'
+
+    ngf = load_ngf(args.ngf)
+    lp, lin = network_inputs(ngf, args.rate)
+
+    # Triangulation of the sampled patches for vertex normals
+    Q = torch.from_numpy(quadify(ngf.complexes.shape[0], args.rate)).long()
+    T = torch.cat([Q[:, [0, 1, 2]], Q[:, [0, 2, 3]]], dim=0)
+
+    # Reference surface from the unmodified network
+    with torch.no_grad():
+        Vref = lp + ngf.mlp(lin)
+        Nref = vertex_normals(Vref, T)
+
+    linears = [layer for layer in ngf.mlp.layers if isinstance(layer, nn.Linear)]
+    weights = [layer.weight.data for layer in linears]
+    biases = [layer.bias.data for layer in linears]
+
+    geometry_bytes = 4 * (3 + ngf.points.numel() + ngf.features.numel() + ngf.complexes.numel())
+
+    print(f'{os.path.basename(args.ngf)}: {ngf.complexes.shape[0]} patches, {lp.shape[0]} samples')
+    print(f'{"precision":>10} {"kernel":>12} {"MLP KB":>8} {"total KB":>9} {"ms":>9} {"chamfer":>10} {"normal (deg)":>13}')
+
+    for precision in args.precisions:
+        mlp = ngfutil.QuantizedMLP(weights, biases, precision)
+        displacements, ms = timed(lambda: mlp.forward(lin), args.repeat)
+
+        V = lp + displacements
+        N = vertex_normals(V, T)
+
+        cd = chamfer(V, Vref, device)
+        ne = normal_error(N, Nref)
+
+        kb = mlp.bytes() / 1024
+        total = (geometry_bytes + mlp.bytes()) / 1024
+        print(f'{precision:>10} {mlp.kernel():>12} {kb:8.1f} {total:9.1f} {ms:9.2f} {cd:10.3e} {ne:13.4f}')
+
+        if args.export is not None:
+            os.makedirs(args.export, exist_ok=True)
+            stem = os.path.splitext(os.path.basename(args.ngf))[0]
+            path = os.path.join(args.export, f'{stem}-{precision}.mlp')
+            with open(path, 'wb') as file:
+                file.write(mlp.stream())
@@ -0,0 +1,127 @@
+import os
+import time
+import torch
+import argparse
+
+from collections import OrderedDict
+
+from ngf import NGF, positional_encoding
+from quantize import load_ngf, network_inputs
+
+
+def timed(fn, repeat: int, device: str) -> float:
+    fn()
+    if device == 'cuda':
+        torch.cuda.synchronize()
+
+    start = time.perf_counter()
+    for _ in range(repeat):
+        fn()
+
+    if device == 'cuda':
+        torch.cuda.synchronize()
+
+    return 1000 * (time.perf_counter() - start) / repeat
+
+
+def miss_rate(ngf: NGF, line: int = 64, capacity: int = 4096) -> float:
+    """Line miss rate of the corner gathers (positions, then features) in patch
+    order, through a simulated LRU cache of the given size in bytes"""
+    positions = ngf.points.shape[1] * ngf.points.element_size()
+    features = ngf.features.shape[1] * ngf.features.element_size()
+    base = ngf.points.shape[0] * positions
+
+    lines = OrderedDict()
+    accesses, misses = 0, 0
+
+    def touch(begin: int, size: int):
+        nonlocal accesses, misses
+        for address in range(begin // line, (begin + size - 1) // line + 1):
+            accesses += 1
+            if address in lines:
+                lines.move_to_end(address)
+                continue
+
+            misses += 1
+            lines[address] = None
+            if len(lines) > capacity // line:
+                lines.popitem(last=False)
+
+    for complex in ngf.complexes.cpu().tolist():
+        for vertex in complex:
+            touch(vertex * positions, positions)
+            touch(base + vertex * features, features)
+
+    return misses / max(accesses, 1)
+
+
+def training_step(ngf: NGF, rate: int):
+    """Forward and backward pass over uniform samples, as in training"""
+    points = ngf.points.detach().requires_grad_()
+    features = ngf.features.detach().requires_grad_()
+
+    U, V = ngf.sample_uniform(rate)
+    lp = NGF.interpolate(points, ngf.complexes, U, V)
+    lf = NGF.interpolate(features, ngf.complexes, U, V)
+    X = lp + ngf.mlp(positional_encoding(lp, [lf], ngf.fflevels))
+    X.square().sum().backward()
+
+
+def gather(ngf: NGF, rate: int):
+    """Only the corner gathers and interpolation, where the order matters most"""
+    with torch.no_grad():
+        U, V = ngf.sample_uniform(rate)
+        NGF.interpolate(ngf.points, ngf.complexes, U, V)
+        NGF.interpolate(ngf.features, ngf.complexes, U, V)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Reorder NGF patches along a space filling curve')
+    parser.add_argument('input', type=str, help='NGF binary (.bin) or PyTorch (.pt) file')
+    parser.add_argument('output', type=str, help='Reordered NGF, in the format of the input')
+    parser.add_argument('--curve', type=str, default='hilbert', choices=['hilbert', 'morton'])
+    parser.add_argument('--rate', type=int, default=16, help='Sampling rate per patch side')
+    parser.add_argument('--repeat', type=int, default=10, help='Timed repetitions')
+    parser.add_argument('--device', type=str, default=None, choices=['cpu', 'cuda'],
+                        help='Device of the timed passes (the GPU if there is one)')
+    args = parser.parse_args()
+
+    device = args.device or ('cuda' if torch.cuda.is_available() else 'cpu')
+
+    ngf = load_ngf(args.input)
+    ngf.points, ngf.features = ngf.points.to(device), ngf.features.to(device)
+    ngf.complexes, ngf.mlp = ngf.complexes.to(device), ngf.mlp.to(device)
+    ngf.uv_cache = {}
+
+    with torch.no_grad():
+        before = ngf.eval(*ngf.sample_uniform(args.rate))
+
+    timings = [(miss_rate(ngf),
+                timed(lambda: gather(ngf, args.rate), args.repeat, device),
+                timed(lambda: training_step(ngf, args.rate), args.repeat, device))]
+
+    order, _ = ngf.reorder(args.curve)
+
+    with torch.no_grad():
+        after = ngf.eval(*ngf.sample_uniform(args.rate))
+
+    timings.append((miss_rate(ngf),
+                    timed(lambda: gather(ngf, args.rate), args.repeat, device),
+                    timed(lambda: training_step(ngf, args.rate), args.repeat, device)))
+
+    # Same samples, only permuted by patch
+    samples = args.rate * args.rate
+    before = before.reshape(-1, samples, 3)[order.to(before.device)]
+    identical = torch.equal(before.reshape(-1, 3), after)
+    print(f'{os.path.basename(args.input)}: {ngf.patches()} patches, {args.curve} order on {device}, '
+          f'{"bit-identical" if identical else "NOT identical"} evaluation')
+
+    print(f'{"":>8} {"misses":>8} {"gather ms":>10} {"step ms":>10}')
+    for name, (m, g, s) in zip(['before', 'after'], timings):
+        print(f'{name:>8} {100 * m:7.1f}% {g:10.3f} {s:10.3f}')
+
+    if args.output.endswith('.pt'):
+        ngf.save(args.output)
+    else:
+        with open(args.output, 'wb') as file:
+            file.write(ngf.stream())
@@ -4,10 +4,9 @@ import tqdm
 import torch
 import logging
 import ngfutil
+import meshio
 import argparse
-import pymeshlab
 import trimesh
-import multiprocessing
 
 from util import *
 from ngf import NGF
@@ -16,14 +15,15 @@ from render import Renderer
 
 class Trainer:
     @staticmethod
-    def quadrangulate_surface(mesh: str, count: int, destination: str) -> None:
-        ms = pymeshlab.MeshSet()
-        ms.load_new_mesh(mesh)
-        ms.meshing_decimation_quadric_edge_collapse(targetfacenum=count, qualitythr=1.0)
-        ms.meshing_repair_non_manifold_edges()
-        ms.meshing_tri_to_quad_by_smart_triangle_pairing()
-        ms.save_current_mesh(destination)
-        logging.info(f'Quadrangulated mesh into {destination}')
+    def quadrangulate_surface(mesh: str, count: int, destination: str) -> tuple[torch.Tensor, torch.Tensor]:
+        V, _, F, _ = ngfutil.load_mesh_cached(mesh)
+        points, complexes = ngfutil.quadrangulate(V, F, count)
+
+        # Kept on disk alongside the other results, but not read back
+        meshio.write_points_cells(destination, points.numpy(), [('quad', complexes.numpy())])
+        logging.info(f'Quadrangulated mesh into {complexes.shape[0]} patches at {destination}')
+
+        return points, complexes
 
     def __init__(self, mesh: str, lod: int, features: int, batch: int):
         # Properties
@@ -42,16 +42,7 @@ class Trainer:
         self.target, normalizer = load_mesh(mesh)
         logging.info(f'Loaded reference mesh {mesh}')
 
-        qargs = (mesh, 2 * lod, self.exporter.partitioned())
-        proc = multiprocessing.Process(target=Trainer.quadrangulate_surface, args=qargs)
-        proc.start()
-
-        # Wait for minute before termimating
-        proc.join(60)
-        if proc.is_alive():
-            logging.error('Quadrangulation running overtime')
-            proc.terminate()
-            exit()
+        points, complexes = Trainer.quadrangulate_surface(mesh, lod, self.exporter.partitioned())
 
         self.renderer = Renderer()
         logging.info('Constructed renderer for optimization')
@@ -59,21 +50,20 @@ class Trainer:
         self.views = None
         self.reference_views = None
 
-        self.ngf = NGF.from_base(self.exporter.partitioned(), normalizer, features)
+        self.ngf = NGF.from_complexes(points, complexes, normalizer, features)
 
-    def precompute_reference_views(self):
+    def precompute_reference_views(self) -> ReferenceViewStore:
         vertices = self.target.vertices
         vertices = vertices[self.target.faces].reshape(-1, 3)
         faces = torch.arange(vertices.shape[0])
         faces = faces.int().cuda().reshape(-1, 3)
         normals = vertex_normals(vertices, faces)
 
-        cache = []
-        for view in tqdm.tqdm(self.views, ncols=50, leave=False):
-            reference_view = self.renderer.render(vertices, normals, faces, view.unsqueeze(0))
-            cache.append(reference_view)
+        # Only rendered when the store does not have these views yet
+        def render(view):
+            return self.renderer.render(vertices, normals, faces, view.unsqueeze(0))
 
-        return list(torch.cat(cache).split(self.batch))
+        return ReferenceViewStore.open(self.target, self.views, self.renderer, render, self.batch)
 
     def optimize_resolution(self, optimizer: torch.optim.Optimizer, rate: int) -> dict[str, list[float]]:
         import numpy as np
@@ -116,7 +106,7 @@ class Trainer:
 
                 batch_source_views = self.renderer.render(vertices, normals, faces, batch_views)
 
-                render_loss = (ref_views.cuda() - batch_source_views).abs().mean()
+                render_loss = (ref_views - batch_source_views).abs().mean()
                 loss = render_loss + laplacian_loss
 
                 optimizer.zero_grad()
@@ -139,7 +129,8 @@ class Trainer:
             'laplacian': []
         }
 
-        self.views = arrange_views(self.target, self.cameras)[0]
+        seed = camera_seed(self.target, self.cameras)
+        self.views = arrange_views(self.target, self.cameras, seed=seed)[0]
         logging.info(f'Generated {self.cameras} views for reference mesh')
 
         self.reference_views = self.precompute_reference_views()
@@ -5,3 +5,4 @@ from .miscellaneous import *
 # from .plot import *
 from .siren import *
 from .texture import *
+from .views import *
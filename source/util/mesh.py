@@ -1,5 +1,6 @@
 import meshio
 import os
+import logging
 import subprocess
 import torch
 import ngfutil
@@ -28,7 +29,37 @@ def mesh_from(V, F) -> Mesh:
     return Mesh(V, F, Vn, 'raw', optg)
 
 
-def load_mesh(path, normalizer=None) -> Tuple[Mesh, Callable[[torch.Tensor], torch.Tensor]]:
+def load_mesh(path, normalizer=None, cache=True) -> Tuple[Mesh, Callable[[torch.Tensor], torch.Tensor]]:
+    if not cache:
+        return load_mesh_uncached(path, normalizer)
+
+    # Welded vertices, normals and triangles from the content hashed cache,
+    # which is filled with the native loaders on a miss
+    before = ngfutil.mesh_cache_stats()[0]
+    V, N, F, transform = ngfutil.load_mesh_cached(path)
+    assert V is not None, f'Failed to load {path}'
+
+    hits, misses, saved = ngfutil.mesh_cache_stats()
+    status = 'hit' if hits > before else 'miss'
+    logging.info(f'Mesh cache {status} for {path} ({hits} hits, {misses} misses, {saved:.1f} ms saved)')
+
+    if normalizer is None:
+        center = transform[:3].cuda()
+        extent = transform[3].item()
+        normalizer = lambda x: (x - center) / (extent / 2)
+
+    v = normalizer(V.cuda())
+    f = F.cuda()
+    fn = compute_face_normals(v, f)
+    vn = compute_vertex_normals(v, f, fn)
+
+    # Normalization is a uniform scale and translation, so the cached
+    # normals are still valid and the geometry skips computing them
+    optg = ngfutil.geometry(v.cpu(), N, F)
+    return Mesh(v, f, vn, os.path.abspath(path), optg), normalizer
+
+
+def load_mesh_uncached(path, normalizer=None) -> Tuple[Mesh, Callable[[torch.Tensor], torch.Tensor]]:
     mesh = meshio.read(path)
 
     v = torch.from_numpy(mesh.points[:, :3]).float().cuda()
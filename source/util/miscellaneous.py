@@ -190,60 +190,8 @@ def lookat(eye, center, up):
     ], dtype=torch.float32, device='cuda')
 
 
-def arrange_views(simplified: Mesh, cameras: int, radius: float = 1.0):
-    seeds = list(torch.randint(0, simplified.faces.shape[0], (cameras,)).numpy())
-    clusters = ngfutil.cluster_geometry(simplified.optg, seeds, 3, 'uniform')
-
-    views = []
-    eyes = []
-    fwds = []
-    for cluster in clusters:
-        faces = simplified.faces[cluster]
-
-        v0 = simplified.vertices[faces[:, 0]]
-        v1 = simplified.vertices[faces[:, 1]]
-        v2 = simplified.vertices[faces[:, 2]]
-        centroid = (v0 + v1 + v2) / 3.0
-        centroid = centroid.mean(dim=0)
-
-        normal = torch.cross(v1 - v0, v2 - v0, dim=-1)
-        normal = normal.mean(dim=0)
-        normal = normal / torch.norm(normal)
-
-        eye = centroid + radius * normal
-        up = torch.tensor([0, 1, 0], dtype=torch.float32, device='cuda')
-        look = -normal
-
-        if torch.dot(look, up).abs().item() > 1.0 - 1e-6:
-            up = torch.tensor([1, 0, 0], dtype=torch.float32, device='cuda')
-        if torch.dot(look, up).abs().item() > 1.0 - 1e-6:
-            up = torch.tensor([0, 0, 1], dtype=torch.float32, device='cuda')
-
-        right = torch.cross(look, up, dim=-1)
-        right /= right.norm()
-
-        up = torch.cross(look, right, dim=-1)
-        up /= up.norm()
-
-        look /= look.norm()
-
-        view = torch.tensor([
-            [ right[0], up[0], look[0], eye[0] ],
-            [ right[1], up[1], look[1], eye[1] ],
-            [ right[2], up[2], look[2], eye[2] ],
-            [ 0, 0, 0, 1 ]
-        ], dtype=torch.float32, device='cuda').inverse()
-
-        views.append(view)
-        eyes.append(eye)
-        fwds.append(look)
-
-    # import polyscope as ps
-    # ps.init()
-    # v = torch.stack(eyes)
-    # f = torch.stack(fwds)
-    # ps.register_surface_mesh('ref', simplified.vertices.cpu().numpy(), simplified.faces.cpu().numpy())
-    # ps.register_point_cloud('eyes', v.cpu()).add_vector_quantity('looks', f.cpu())
-    # ps.show()
-
-    return torch.stack(views), torch.stack(eyes)
+def arrange_views(simplified: Mesh, cameras: int, radius: float = 1.0, seed: int = None):
+    generator = None if seed is None else torch.Generator().manual_seed(seed)
+    seeds = list(torch.randint(0, simplified.faces.shape[0], (cameras,), generator=generator).numpy())
+    views, eyes = ngfutil.arrange_views(simplified.optg, seeds, 3, 'uniform', radius)
+    return views.cuda(), eyes.cuda()
@@ -0,0 +1,195 @@
+import os
+import queue
+import struct
+import hashlib
+import logging
+import threading
+import numpy as np
+import torch
+import tqdm
+
+from typing import Callable
+
+from .mesh import Mesh
+
+
+def view_cache_directory() -> str:
+    # Next to the mesh cache of the extension
+    if 'XDG_CACHE_HOME' in os.environ:
+        return os.path.join(os.environ['XDG_CACHE_HOME'], 'ngf', 'views')
+    elif 'HOME' in os.environ:
+        return os.path.join(os.environ['HOME'], '.cache', 'ngf', 'views')
+
+    return os.path.join('.ngf-cache', 'views')
+
+
+def mesh_digest(mesh: Mesh):
+    digest = hashlib.blake2b(digest_size=16)
+    digest.update(mesh.vertices.float().cpu().numpy().tobytes())
+    digest.update(mesh.faces.int().cpu().numpy().tobytes())
+    return digest
+
+
+def camera_seed(mesh: Mesh, cameras: int) -> int:
+    """Seed of the camera placement, derived from the mesh and the camera count
+    so that the same setup always arranges (and stores) the same views"""
+    digest = mesh_digest(mesh)
+    digest.update(struct.pack('<q', cameras))
+    return int.from_bytes(digest.digest()[:8], 'little') & ((1 << 63) - 1)
+
+
+class ReferenceViewStore:
+    """Rendered reference views in a memory mapped file, keyed by the mesh, the
+    camera placement and the renderer; batches are streamed to the GPU through
+    pinned buffers, which a background thread fills ahead of the consumer"""
+
+    MAGIC = b'NGFVIEWS'
+    VERSION = 3
+
+    # Least recently used stores are evicted beyond this many bytes
+    CAPACITY = 8 << 30
+
+    # Magic, version and the (views, height, width, channels) shape, padded
+    # so that the images start aligned
+    HEADER = struct.Struct('<8sq4q')
+    OFFSET = 64
+
+    def __init__(self, path: str, batch: int, depth: int = 2):
+        with open(path, 'rb') as file:
+            magic, version, *shape = ReferenceViewStore.HEADER.unpack(file.read(ReferenceViewStore.HEADER.size))
+
+        assert magic == ReferenceViewStore.MAGIC and version == ReferenceViewStore.VERSION, f'Invalid view store {path}'
+
+        self.path = path
+        self.batch = batch
+        self.views = np.memmap(path, dtype=np.float32, mode='r', offset=ReferenceViewStore.OFFSET, shape=tuple(shape))
+
+        shape = (batch, *self.views.shape[1:])
+        self.buffers = [ torch.empty(shape, dtype=torch.float32, pin_memory=True) for _ in range(depth) ]
+
+    def __len__(self) -> int:
+        return (self.views.shape[0] + self.batch - 1) // self.batch
+
+    def __iter__(self):
+        ready = queue.Queue()
+        free = queue.Queue()
+        stop = threading.Event()
+
+        for buffer in self.buffers:
+            free.put((buffer, None))
+
+        # Pinned buffers are only refilled once their copy to the GPU is done
+        def prefetch():
+            for i in range(len(self)):
+                buffer, event = free.get()
+                if stop.is_set():
+                    return
+
+                if event is not None:
+                    event.synchronize()
+
+                views = self.views[i * self.batch : (i + 1) * self.batch]
+                chunk = buffer[:views.shape[0]]
+                chunk.numpy()[:] = views
+                ready.put((buffer, chunk))
+
+        worker = threading.Thread(target=prefetch, daemon=True)
+        worker.start()
+
+        stream = torch.cuda.Stream()
+        try:
+            for _ in range(len(self)):
+                buffer, chunk = ready.get()
+                with torch.cuda.stream(stream):
+                    device = chunk.cuda(non_blocking=True)
+                    event = torch.cuda.Event()
+                    event.record(stream)
+
+                torch.cuda.current_stream().wait_stream(stream)
+                device.record_stream(torch.cuda.current_stream())
+
+                free.put((buffer, event))
+                yield device
+        finally:
+            stop.set()
+            free.put((None, None))
+            worker.join()
+
+    @staticmethod
+    def key(mesh: Mesh, views: torch.Tensor, renderer) -> str:
+        digest = mesh_digest(mesh)
+        digest.update(struct.pack('<q', ReferenceViewStore.VERSION))
+        digest.update(views.float().cpu().numpy().tobytes())
+        digest.update(renderer.proj.float().cpu().numpy().tobytes())
+        digest.update(struct.pack('<2q', *renderer.res))
+        return digest.hexdigest()
+
+    @staticmethod
+    def evict(directory: str, capacity: int, keep: str) -> None:
+        """Removes the least recently used stores (by modification time, which
+        hits refresh) until the directory fits in the capacity"""
+        stores = []
+        for name in os.listdir(directory):
+            path = os.path.join(directory, name)
+            if name.endswith('.views') and path != keep:
+                try:
+                    stat = os.stat(path)
+                except FileNotFoundError:
+                    continue
+
+                stores.append((stat.st_mtime, stat.st_size, path))
+
+        total = sum(size for _, size, _ in stores) + os.path.getsize(keep)
+        for _, size, path in sorted(stores):
+            if total <= capacity:
+                break
+
+            try:
+                os.remove(path)
+                logging.info(f'Evicted reference view store {path}')
+            except FileNotFoundError:
+                pass
+
+            total -= size
+
+    @staticmethod
+    def open(mesh: Mesh, views: torch.Tensor, renderer, render: Callable[[torch.Tensor], torch.Tensor],
+             batch: int, directory: str = None) -> 'ReferenceViewStore':
+        """Maps the stored views, rendering each view with the given function
+        and writing them out first if they are not stored yet"""
+        directory = directory or view_cache_directory()
+        path = os.path.join(directory, ReferenceViewStore.key(mesh, views, renderer) + '.views')
+
+        if os.path.exists(path):
+            logging.info(f'Reference view store hit at {path}')
+            os.utime(path)
+            return ReferenceViewStore(path, batch)
+
+        os.makedirs(directory, exist_ok=True)
+
+        # Written through a temporary file, so that concurrent runs either see
+        # a complete store or none at all
+        staging = f'{path}.{os.getpid()}.tmp'
+
+        images = None
+        for i, view in enumerate(tqdm.tqdm(views, ncols=50, leave=False)):
+            image = render(view)[0].detach().float().cpu().numpy()
+            if images is None:
+                shape = (views.shape[0], *image.shape)
+                with open(staging, 'wb') as file:
+                    file.write(ReferenceViewStore.HEADER.pack(ReferenceViewStore.MAGIC, ReferenceViewStore.VERSION, *shape))
+                    file.truncate(ReferenceViewStore.OFFSET)
+
+                images = np.memmap(staging, dtype=np.float32, mode='r+', offset=ReferenceViewStore.OFFSET, shape=shape)
+
+            images[i] = image
+
+        images.flush()
+        del images
+
+        os.replace(staging, path)
+        logging.info(f'Reference view store written to {path}')
+
+        ReferenceViewStore.evict(directory, ReferenceViewStore.CAPACITY, path)
+
+        return ReferenceViewStore(path, batch)